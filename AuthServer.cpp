@@ -10,9 +10,14 @@
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
 
+#include <pplx/pplxtasks.h>
+
 #include <was/common.h>
 #include <was/table.h>
 
+#include "JsonBody.h"
+#include "Log.h"
+#include "Routes.h"
 #include "TableCache.h"
 #include "make_unique.h"
 
@@ -108,44 +113,6 @@ prop_str_vals_t get_string_properties (const table_entity::properties_type& prop
   return values;
 }
 
-/*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
- */
-unordered_map<string,string> get_json_body(http_request message) {  
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-          {
-            json = v;
-            return true;
-          })
-    .wait();
-
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-        results[v.first] = v.second.as_string();
-      }
-      else {
-        results[v.first] = v.second.serialize();
-      }
-    }
-  }
-  return results;
-}
-
 /*
   Return a token for 24 hours of access to the specified table,
   for the single entity defind by the partition and row.
@@ -180,13 +147,12 @@ pair<status_code,string> do_get_token (const cloud_table& data_table,
         // Following token allows read access to entire table
         //table.get_shared_access_signature(table_shared_access_policy {exptime, permissions})
       };
-    cout << "Token " << limited_access_token << endl;
+    log_debug(log_category::request) << "Token " << limited_access_token;
     return make_pair(status_codes::OK, limited_access_token);
   }
   catch (const storage_exception& e) {
-    cout << "ERROR FROM do_get_token" << endl;
-    cout << "Azure Table Storage error: " << e.what() << endl;
-    cout << e.result().extended_error().message() << endl;
+    log_error(log_category::storage) << "Azure Table Storage error in do_get_token: " << e.what() << ": "
+        << e.result().extended_error().message();
     return make_pair(status_codes::InternalError, string{});
   }
 }
@@ -202,374 +168,417 @@ value build_json_value (const pair<string,string>& prop) {
 }
 
 /*
-  Top-level routine for processing all HTTP GET requests.
+  Take the password from content, whose only member must be Password,
+  replying and returning false if it is not there.
  */
-void handle_get(http_request message) { 
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** AuthServer GET " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation and userid
-  if (paths.size() < 2) {
-    message.reply(status_codes::BadRequest);
-    return;
+bool prepare_request (http_request message, const request_body& content, string& password) {
+  bool has_password {false};
+  bool has_others {false};
+  json_body_status body_status {read_json_object(content,
+                                                 [&] (string&& name, json_kind, string&& text) {
+                                                   log_debug(log_category::request) << "Property: " << name << ", PropertyValue: " << text;
+                                                   if (name == "Password") {
+                                                     password = std::move(text);
+                                                     has_password = true;
+                                                   }
+                                                   else {
+                                                     has_others = true;
+                                                   }
+                                                 })};
+  if (body_status == json_body_status::too_large) {
+    message.reply(status_codes::RequestEntityTooLarge);
+    return false;
   }
 
-  // Check AuthTable
-  cloud_table auth_table {table_cache.lookup_table(auth_table_name)};
-  if ( ! auth_table.exists()) {
-    cout << "Table does not exist" << endl;
-    message.reply(status_codes::NotFound);
-    return;
+  // The body must be an object with Password as its only property
+  if (body_status != json_body_status::ok || ! has_password || has_others) {
+    message.reply(status_codes::BadRequest);
+    return false;
   }
+  return true;
+}
 
-  // Check DataTable
-  cloud_table data_table {table_cache.lookup_table(data_table_name)};
-  if ( ! data_table.exists()) {
-    cout << "Table does not exist" << endl;
-    message.reply(status_codes::NotFound);
+/*
+  GetReadToken/<userid>: a read token for the user's data entity
+ */
+void handle_get_read_token (http_request message, const route_path& route, const request_body& content) {
+  string password {};
+  if ( ! prepare_request(message, content, password))
     return;
-  }
-
-  unordered_map<string,string> json_body {get_json_body(message)};
-
-  // If command is GetReadToken
-  if (paths[0] == get_read_token_op) {
-
-    vector<string> prop, prop_val;
-
-    // Store Password in prop_val
-    for (auto it = json_body.begin(); it != json_body.end(); it++) {
-      cout << "Property: " << it->first << ", PropertyValue: " << it->second << endl;
-      prop.push_back(it->first);
-      prop_val.push_back(it->second);
-    }
-
-    // Check to make sure only one property was included in the body and the property had the name "Password"
-    if (prop.size() != 1 || prop[0] != "Password") {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-
-    // Iterate AuthTable to find the matching user, check the password, obtain partition and row, get token
-    table_query query {};
-    table_query_iterator end;
-    table_query_iterator it_userid = auth_table.execute_query(query);
-    vector<value> key_vec;
-    string store_partition, store_row;
-    while (it_userid != end) {
-
-      if (it_userid->row_key() == paths[1]) {
+  cloud_table auth_table {table_cache.lookup_table(auth_table_name)};
+  cloud_table data_table {table_cache.lookup_table(data_table_name)};
+  const string userid {route[1]};
 
-        // keys is returned as a pair | <i> if n == 0 then Property, if i == 1 then row | [i] == nth set of Property / Property Value
-        prop_str_vals_t keys {get_string_properties(it_userid->properties())};
+  // Iterate AuthTable to find the matching user, check the password, obtain partition and row, get token
+  table_query query {};
+  table_query_iterator end;
+  table_query_iterator it_userid = auth_table.execute_query(query);
+  vector<value> key_vec;
+  string store_partition, store_row;
+  while (it_userid != end) {
 
-        // Go through the three objects in the entity
-        for (int i = 0; i < keys.size(); i++) {
+    if (it_userid->row_key() == userid) {
 
-          // First find property that associates with the password
-          if (std::get<0>(keys[i]) == "Password") {
+      // keys is returned as a pair | <i> if n == 0 then Property, if i == 1 then row | [i] == nth set of Property / Property Value
+      prop_str_vals_t keys {get_string_properties(it_userid->properties())};
 
-            // Check if the password in the table matches the password in our message
-            if (std::get<1>(keys[i]) == prop_val[0]) {
-              cout << "Password provided was correct" << endl;
-              
-              // Go through the three properties to the the ones associated with partition and row
-              for (int n = 0; n < keys.size(); n++) {
+      // Go through the three objects in the entity
+      for (int i = 0; i < keys.size(); i++) {
 
-                // Store the name of the partition in DataTable associated with the user in store_partition
-                if (std::get<0>(keys[n]) == "DataPartition") {
-                  store_partition = std::get<1>(keys[n]);
-                }
+        // First find property that associates with the password
+        if (std::get<0>(keys[i]) == "Password") {
 
-                // Store the name of the row in DataTable associated wit the user in store_row
-                if (std::get<0>(keys[n]) == "DataRow") {
-                  store_row = std::get<1>(keys[n]);
-                }
+          // Check if the password in the table matches the password in our message
+          if (std::get<1>(keys[i]) == password) {
+            log_info(log_category::request) << "Password provided was correct";
+            
+            // Go through the three properties to the the ones associated with partition and row
+            for (int n = 0; n < keys.size(); n++) {
 
+              // Store the name of the partition in DataTable associated with the user in store_partition
+              if (std::get<0>(keys[n]) == "DataPartition") {
+                store_partition = std::get<1>(keys[n]);
               }
-              
-              // Upon leaving the loop we should have obtained a string for the partition and the row
-              // Make sure the strings are not empty
-              if (store_partition.size() == 0 || store_row.size() == 0) {
-                message.reply(status_codes::NotFound);
-                return;
-              }
-
-              else {
-                // Once found, obtain the token
-                pair<status_code,string> result {do_get_token(data_table, store_partition, store_row, 
-                                                              table_shared_access_policy::permissions::read)};
 
-                pair<string,string> tokenPair {make_pair ("token", result.second)};
-                value token {build_json_value(tokenPair)};
-                message.reply(result.first, token);
-                return;
+              // Store the name of the row in DataTable associated wit the user in store_row
+              if (std::get<0>(keys[n]) == "DataRow") {
+                store_row = std::get<1>(keys[n]);
               }
+
+            }
+            
+            // Upon leaving the loop we should have obtained a string for the partition and the row
+            // Make sure the strings are not empty
+            if (store_partition.size() == 0 || store_row.size() == 0) {
+              message.reply(status_codes::NotFound);
+              return;
             }
 
-            // If the password in the table does not match the password provided in the message
             else {
-              cout << "Incorrect Password" << endl;
-              message.reply(status_codes::NotFound);
+              // Once found, obtain the token
+              pair<status_code,string> result {do_get_token(data_table, store_partition, store_row, 
+                                                            table_shared_access_policy::permissions::read)};
+
+              pair<string,string> tokenPair {make_pair ("token", result.second)};
+              value token {build_json_value(tokenPair)};
+              message.reply(result.first, token);
               return;
             }
+          }
 
+          // If the password in the table does not match the password provided in the message
+          else {
+            log_info(log_category::request) << "Incorrect Password";
+            message.reply(status_codes::NotFound);
+            return;
           }
-          // There should be no else case, if the current property pair is not associated with the password then it just moves to the next property
+
         }
-        // If the user is found to be in the table
-        // the only two returns should be from either an incorrect password or a successful request to obtain a token so nothing else is needed
+        // There should be no else case, if the current property pair is not associated with the password then it just moves to the next property
       }
-
-      // Go to next entity of AuthTable
-      it_userid ++;
+      // If the user is found to be in the table
+      // the only two returns should be from either an incorrect password or a successful request to obtain a token so nothing else is needed
     }
 
-    // If it leaves the while loop without then the user id was not found so we return the status code NotFound
-    cout << "User Not Found" << endl;
-    message.reply(status_codes::NotFound);
-    return;
+    // Go to next entity of AuthTable
+    it_userid ++;
   }
 
+  // If it leaves the while loop without then the user id was not found so we return the status code NotFound
+  log_info(log_category::request) << "User Not Found";
+  message.reply(status_codes::NotFound);
+  return;
+}
 
-   // If command is GetUpdateToken
-  if (paths[0] == get_update_token_op) {
-
-    vector<string> prop, prop_val;
-
-    // Store Password in prop_val
-    for (auto it = json_body.begin(); it != json_body.end(); it++) {
-      cout << "Property: " << it->first << ", PropertyValue: " << it->second << endl;
-      prop.push_back(it->first);
-      prop_val.push_back(it->second);
-    }
-
-    // Check to make sure only one property was included in the body and the property had the name "Password"
-    if (prop.size() != 1 || prop[0] != "Password") {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-
-    // Iterate AuthTable to find the matching user, check the password, obtain partition and row, get token
-    table_query query {};
-    table_query_iterator end;
-    table_query_iterator it_userid = auth_table.execute_query(query);
-    vector<value> key_vec;
-    string store_partition, store_row;
-    while (it_userid != end) {
-
-      if (it_userid->row_key() == paths[1]) {
+/*
+  GetUpdateToken/<userid>: a read and update token for the user's
+  data entity
+ */
+void handle_get_update_token (http_request message, const route_path& route, const request_body& content) {
+  string password {};
+  if ( ! prepare_request(message, content, password))
+    return;
+  cloud_table auth_table {table_cache.lookup_table(auth_table_name)};
+  cloud_table data_table {table_cache.lookup_table(data_table_name)};
+  const string userid {route[1]};
 
-        // keys is returned as a pair | <i> if n == 0 then Property, if i == 1 then row | [i] == nth set of Property / Property Value
-        prop_str_vals_t keys {get_string_properties(it_userid->properties())};
+  // Iterate AuthTable to find the matching user, check the password, obtain partition and row, get token
+  table_query query {};
+  table_query_iterator end;
+  table_query_iterator it_userid = auth_table.execute_query(query);
+  vector<value> key_vec;
+  string store_partition, store_row;
+  while (it_userid != end) {
 
-        // Go through the three objects in the entity
-        for (int i = 0; i < keys.size(); i++) {
+    if (it_userid->row_key() == userid) {
 
-          // First find property that associates with the password
-          if (std::get<0>(keys[i]) == "Password") {
+      // keys is returned as a pair | <i> if n == 0 then Property, if i == 1 then row | [i] == nth set of Property / Property Value
+      prop_str_vals_t keys {get_string_properties(it_userid->properties())};
 
-            // Check if the password in the table matches the password in our message
-            if (std::get<1>(keys[i]) == prop_val[0]) {
-              cout << "Password provided was correct" << endl;
-              
-              // Go through the three properties to the the ones associated with partition and row
-              for (int n = 0; n < keys.size(); n++) {
+      // Go through the three objects in the entity
+      for (int i = 0; i < keys.size(); i++) {
 
-                // Store the name of the partition in DataTable associated with the user in store_partition
-                if (std::get<0>(keys[n]) == "DataPartition") {
-                  store_partition = std::get<1>(keys[n]);
-                }
+        // First find property that associates with the password
+        if (std::get<0>(keys[i]) == "Password") {
 
-                // Store the name of the row in DataTable associated wit the user in store_row
-                if (std::get<0>(keys[n]) == "DataRow") {
-                  store_row = std::get<1>(keys[n]);
-                }
+          // Check if the password in the table matches the password in our message
+          if (std::get<1>(keys[i]) == password) {
+            log_info(log_category::request) << "Password provided was correct";
+            
+            // Go through the three properties to the the ones associated with partition and row
+            for (int n = 0; n < keys.size(); n++) {
 
+              // Store the name of the partition in DataTable associated with the user in store_partition
+              if (std::get<0>(keys[n]) == "DataPartition") {
+                store_partition = std::get<1>(keys[n]);
               }
-              
-              // Upon leaving the loop we should have obtained a string for the partition and the row
-              // Make sure the strings are not empty
-              if (store_partition.size() == 0 || store_row.size() == 0) {
-                message.reply(status_codes::NotFound);
-                return;
-              }
-
-              else {
-                // Once found, obtain the token
-                pair<status_code,string> result {do_get_token(data_table, store_partition, store_row, 
-                                                              table_shared_access_policy::permissions::read |
-                                                              table_shared_access_policy::permissions::update)};
 
-                pair<string,string> tokenPair {make_pair ("token", result.second)};
-                value token {build_json_value(tokenPair)};
-                message.reply(result.first, token);
-                return;
+              // Store the name of the row in DataTable associated wit the user in store_row
+              if (std::get<0>(keys[n]) == "DataRow") {
+                store_row = std::get<1>(keys[n]);
               }
+
+            }
+            
+            // Upon leaving the loop we should have obtained a string for the partition and the row
+            // Make sure the strings are not empty
+            if (store_partition.size() == 0 || store_row.size() == 0) {
+              message.reply(status_codes::NotFound);
+              return;
             }
 
-            // If the password in the table does not match the password provided in the message
             else {
-              cout << "Incorrect Password" << endl;
-              message.reply(status_codes::NotFound);
+              // Once found, obtain the token
+              pair<status_code,string> result {do_get_token(data_table, store_partition, store_row, 
+                                                            table_shared_access_policy::permissions::read |
+                                                            table_shared_access_policy::permissions::update)};
+
+              pair<string,string> tokenPair {make_pair ("token", result.second)};
+              value token {build_json_value(tokenPair)};
+              message.reply(result.first, token);
               return;
             }
+          }
 
+          // If the password in the table does not match the password provided in the message
+          else {
+            log_info(log_category::request) << "Incorrect Password";
+            message.reply(status_codes::NotFound);
+            return;
           }
-          // There should be no else case, if the current property pair is not associated with the password then it just moves to the next property
+
         }
-        // If the user is found to be in the table
-        // the only two returns should be from either an incorrect password or a successful request to obtain a token so nothing else is needed
+        // There should be no else case, if the current property pair is not associated with the password then it just moves to the next property
       }
-
-      // Go to next entity of AuthTable
-      it_userid ++;
+      // If the user is found to be in the table
+      // the only two returns should be from either an incorrect password or a successful request to obtain a token so nothing else is needed
     }
 
-    // If it leaves the while loop without then the user id was not found so we return the status code NotFound
-    cout << "User Not Found" << endl;
-    message.reply(status_codes::NotFound);
-    return;
+    // Go to next entity of AuthTable
+    it_userid ++;
   }
 
+  // If it leaves the while loop without then the user id was not found so we return the status code NotFound
+  log_info(log_category::request) << "User Not Found";
+  message.reply(status_codes::NotFound);
+  return;
+}
 
-  // If command is GetUpdateData
-  if (paths[0] == get_update_data_op) {
-
-    vector<string> prop, prop_val;
-
-    // Store Password in prop_val
-    for (auto it = json_body.begin(); it != json_body.end(); it++) {
-      cout << "Property: " << it->first << ", PropertyValue: " << it->second << endl;
-      prop.push_back(it->first);
-      prop_val.push_back(it->second);
-    }
-
-    // Check to make sure only one property was included in the body and the property had the name "Password"
-    if (prop.size() != 1 || prop[0] != "Password") {
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-
-    // Iterate AuthTable to find the matching user, check the password, obtain partition and row, get token
-    table_query query {};
-    table_query_iterator end;
-    table_query_iterator it_userid = auth_table.execute_query(query);
-    vector<value> key_vec;
-    string store_partition, store_row;
-    while (it_userid != end) {
-
-      if (it_userid->row_key() == paths[1]) {
+/*
+  GetUpdateData/<userid>: a read and update token for the user's
+  data entity, with its DataPartition and DataRow
+ */
+void handle_get_update_data (http_request message, const route_path& route, const request_body& content) {
+  string password {};
+  if ( ! prepare_request(message, content, password))
+    return;
+  cloud_table auth_table {table_cache.lookup_table(auth_table_name)};
+  cloud_table data_table {table_cache.lookup_table(data_table_name)};
+  const string userid {route[1]};
 
-        // keys is returned as a pair | <i> if n == 0 then Property, if i == 1 then row | [i] == nth set of Property / Property Value
-        prop_str_vals_t keys {get_string_properties(it_userid->properties())};
+  // Iterate AuthTable to find the matching user, check the password, obtain partition and row, get token
+  table_query query {};
+  table_query_iterator end;
+  table_query_iterator it_userid = auth_table.execute_query(query);
+  vector<value> key_vec;
+  string store_partition, store_row;
+  while (it_userid != end) {
 
-        // Go through the three objects in the entity
-        for (int i = 0; i < keys.size(); i++) {
+    if (it_userid->row_key() == userid) {
 
-          // First find property that associates with the password
-          if (std::get<0>(keys[i]) == "Password") {
+      // keys is returned as a pair | <i> if n == 0 then Property, if i == 1 then row | [i] == nth set of Property / Property Value
+      prop_str_vals_t keys {get_string_properties(it_userid->properties())};
 
-            // Check if the password in the table matches the password in our message
-            if (std::get<1>(keys[i]) == prop_val[0]) {
-              cout << "Password provided was correct" << endl;
-              
-              // Go through the three properties to the the ones associated with partition and row
-              for (int n = 0; n < keys.size(); n++) {
+      // Go through the three objects in the entity
+      for (int i = 0; i < keys.size(); i++) {
 
-                // Store the name of the partition in DataTable associated with the user in store_partition
-                if (std::get<0>(keys[n]) == "DataPartition") {
-                  store_partition = std::get<1>(keys[n]);
-                }
+        // First find property that associates with the password
+        if (std::get<0>(keys[i]) == "Password") {
 
-                // Store the name of the row in DataTable associated wit the user in store_row
-                if (std::get<0>(keys[n]) == "DataRow") {
-                  store_row = std::get<1>(keys[n]);
-                }
+          // Check if the password in the table matches the password in our message
+          if (std::get<1>(keys[i]) == password) {
+            log_info(log_category::request) << "Password provided was correct";
+            
+            // Go through the three properties to the the ones associated with partition and row
+            for (int n = 0; n < keys.size(); n++) {
 
-              }
-              
-              // Upon leaving the loop we should have obtained a string for the partition and the row
-              // Make sure the strings are not empty
-              if (store_partition.size() == 0 || store_row.size() == 0) {
-                message.reply(status_codes::NotFound);
-                return;
+              // Store the name of the partition in DataTable associated with the user in store_partition
+              if (std::get<0>(keys[n]) == "DataPartition") {
+                store_partition = std::get<1>(keys[n]);
               }
 
-              else {
-                // Once found, obtain the token
-                pair<status_code,string> result {do_get_token(data_table, store_partition, store_row, 
-                                                              table_shared_access_policy::permissions::read |
-                                                              table_shared_access_policy::permissions::update)};
-
-                // Pair up property and property values that will make up the properties in the return message
-                pair<string,string> tokenPair {make_pair ("token", result.second)};
-                pair<string,string> partitionPair {make_pair("DataPartition", store_partition)};
-                pair<string,string> rowPair {make_pair("DataRow", store_row)};
-                
-                // Push the properties into a vector
-                vector<pair<string,string>> temp_vec;
-                temp_vec.push_back(tokenPair);
-                temp_vec.push_back(partitionPair);
-                temp_vec.push_back(rowPair);
-
-                // Pass the vector to a function Ted made; returns a json value containing the properties above
-                value prop_return {build_json_value(temp_vec)};
-
-                message.reply(result.first, prop_return);
-                return;
+              // Store the name of the row in DataTable associated wit the user in store_row
+              if (std::get<0>(keys[n]) == "DataRow") {
+                store_row = std::get<1>(keys[n]);
               }
+
+            }
+            
+            // Upon leaving the loop we should have obtained a string for the partition and the row
+            // Make sure the strings are not empty
+            if (store_partition.size() == 0 || store_row.size() == 0) {
+              message.reply(status_codes::NotFound);
+              return;
             }
 
-            // If the password in the table does not match the password provided in the message
             else {
-              cout << "Incorrect Password" << endl;
-              message.reply(status_codes::NotFound);
+              // Once found, obtain the token
+              pair<status_code,string> result {do_get_token(data_table, store_partition, store_row, 
+                                                            table_shared_access_policy::permissions::read |
+                                                            table_shared_access_policy::permissions::update)};
+
+              // Pair up property and property values that will make up the properties in the return message
+              pair<string,string> tokenPair {make_pair ("token", result.second)};
+              pair<string,string> partitionPair {make_pair("DataPartition", store_partition)};
+              pair<string,string> rowPair {make_pair("DataRow", store_row)};
+              
+              // Push the properties into a vector
+              vector<pair<string,string>> temp_vec;
+              temp_vec.push_back(tokenPair);
+              temp_vec.push_back(partitionPair);
+              temp_vec.push_back(rowPair);
+
+              // Pass the vector to a function Ted made; returns a json value containing the properties above
+              value prop_return {build_json_value(temp_vec)};
+
+              message.reply(result.first, prop_return);
               return;
             }
+          }
 
+          // If the password in the table does not match the password provided in the message
+          else {
+            log_info(log_category::request) << "Incorrect Password";
+            message.reply(status_codes::NotFound);
+            return;
           }
-          // There should be no else case, if the current property pair is not associated with the password then it just moves to the next property
+
         }
-        // If the user is found to be in the table
-        // the only two returns should be from either an incorrect password or a successful request to obtain a token so nothing else is needed
+        // There should be no else case, if the current property pair is not associated with the password then it just moves to the next property
       }
-
-      // Go to next entity of AuthTable
-      it_userid ++;
+      // If the user is found to be in the table
+      // the only two returns should be from either an incorrect password or a successful request to obtain a token so nothing else is needed
     }
 
-    // If it leaves the while loop without then the user id was not found so we return the status code NotFound
-    cout << "User Not Found" << endl;
-    message.reply(status_codes::NotFound);
-    return;
+    // Go to next entity of AuthTable
+    it_userid ++;
   }
 
-  message.reply(status_codes::NotImplemented);
+  // If it leaves the while loop without then the user id was not found so we return the status code NotFound
+  log_info(log_category::request) << "User Not Found";
+  message.reply(status_codes::NotFound);
+  return;
+}
+
+/*
+  Adapt handler to answer a storage error with InternalError. Either
+  table may have been deleted since it was last checked, so the
+  cache forgets a table that storage reports missing.
+ */
+body_route_handler checked (body_route_handler handler) {
+  return [handler] (http_request message, const route_path& route, const request_body& content) {
+    try {
+      handler(message, route, content);
+    }
+    catch (const storage_exception& e) {
+      log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+      table_cache.forget_if_missing(auth_table_name, e);
+      table_cache.forget_if_missing(data_table_name, e);
+      message.reply(status_codes::InternalError);
+    }
+  };
+}
+
+/*
+  Adapt handler to run only if AuthTable and DataTable both exist,
+  replying NotFound if either does not. Tables known to exist are
+  handled at once; otherwise storage is asked about both together and
+  the handler runs from the continuation, so no thread waits for the
+  answers.
+ */
+route_handler if_tables_exist (route_handler handler) {
+  return [handler] (http_request message, const route_path& route) {
+    if (table_cache.known_exists(auth_table_name) && table_cache.known_exists(data_table_name)) {
+      handler(message, route);
+      return;
+    }
+    vector<pplx::task<bool>> checks {table_cache.table_exists_async(auth_table_name),
+                                     table_cache.table_exists_async(data_table_name)};
+    pplx::when_all(checks.begin(), checks.end())
+      .then([handler, message] (pplx::task<vector<bool>> found) {
+          try {
+            vector<bool> exist {found.get()};
+            if ( ! exist[0] || ! exist[1]) {
+              log_info(log_category::request) << "Table does not exist";
+              message.reply(status_codes::NotFound);
+              return;
+            }
+            // The route viewed the caller's path; take it from message
+            handler(message, route_path {message.request_uri().path()});
+          }
+          catch (const std::exception& e) {
+            log_error(log_category::storage) << "Table check failed: " << e.what();
+            message.reply(status_codes::InternalError);
+          }
+        });
+  };
+}
+
+// Every operation needs at least an operation and userid
+const route_table get_routes {vector<route> {
+    {get_read_token_op, 2, route_path::max_segments, if_tables_exist(with_json_body(checked(handle_get_read_token)))},
+    {get_update_token_op, 2, route_path::max_segments, if_tables_exist(with_json_body(checked(handle_get_update_token)))},
+    {get_update_data_op, 2, route_path::max_segments, if_tables_exist(with_json_body(checked(handle_get_update_data)))}
+  }, status_codes::NotImplemented};
+
+/*
+  Top-level routine for processing all HTTP GET requests.
+ */
+void handle_get(http_request message) { 
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** AuthServer GET " << path;
+  get_routes.dispatch(message, route_path {path});
 }
 
 /*
   Top-level routine for processing all HTTP POST requests.
  */
 void handle_post(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
+  log_debug(log_category::request) << "\n**** POST " << message.request_uri().path();
 }
 
 /*
   Top-level routine for processing all HTTP PUT requests.
  */
 void handle_put(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** PUT " << path << endl;
+  log_debug(log_category::request) << "\n**** PUT " << message.request_uri().path();
 }
 
 /*
   Top-level routine for processing all HTTP DELETE requests.
  */
 void handle_delete(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** DELETE " << path << endl;
+  log_debug(log_category::request) << "\n**** DELETE " << message.request_uri().path();
 }
 
 /*
@@ -590,10 +599,10 @@ void handle_delete(http_request message) {
   Wait for a carriage return, then shut the server down.
  */
 int main (int argc, char const * argv[]) {
-  cout << "AuthServer: Parsing connection string" << endl;
+  log_info(log_category::server) << "AuthServer: Parsing connection string";
   table_cache.init (storage_connection_string);
 
-  cout << "AuthServer: Opening listener" << endl;
+  log_info(log_category::server) << "AuthServer: Opening listener";
   http_listener listener {def_url};
   listener.support(methods::GET, &handle_get);
   //listener.support(methods::POST, &handle_post);
@@ -607,5 +616,6 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  Logger::instance().stop();
   cout << "AuthServer closed" << endl;
 }
\ No newline at end of file
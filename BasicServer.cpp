@@ -2,17 +2,26 @@
  Basic Server code for CMPT 276, Spring 2016.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include <cpprest/base_uri.h>
+#include <cpprest/containerstream.h>
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
+#include <cpprest/producerconsumerstream.h>
 
 #include <pplx/pplxtasks.h>
 
@@ -20,7 +29,19 @@
 #include <was/storage_account.h>
 #include <was/table.h>
 
+#include "EntityCache.h"
+#include "EntityJson.h"
+#include "FilterExpr.h"
+#include "JsonBody.h"
+#include "Log.h"
+#include "MissCache.h"
+#include "RangeScan.h"
+#include "Routes.h"
+#include "ScanFlights.h"
+#include "StreamPacer.h"
+#include "TableBatcher.h"
 #include "TableCache.h"
+#include "WriteBehind.h"
 #include "make_unique.h"
 
 #include "azure_keys.h"
@@ -32,14 +53,18 @@ using azure::storage::storage_credentials;
 using azure::storage::storage_exception;
 using azure::storage::cloud_table;
 using azure::storage::cloud_table_client;
+using azure::storage::continuation_token;
 using azure::storage::edm_type;
 using azure::storage::entity_property;
 using azure::storage::table_entity;
 using azure::storage::table_operation;
 using azure::storage::table_query;
-using azure::storage::table_query_iterator;
+using azure::storage::table_query_segment;
 using azure::storage::table_result;
 
+using concurrency::streams::container_buffer;
+using concurrency::streams::producer_consumer_buffer;
+
 using pplx::extensibility::critical_section_t;
 using pplx::extensibility::scoped_critical_section_t;
 
@@ -55,6 +80,7 @@ using std::vector;
 
 using web::http::http_headers;
 using web::http::http_request;
+using web::http::http_response;
 using web::http::methods;
 using web::http::status_code;
 using web::http::status_codes;
@@ -72,8 +98,14 @@ const string create_table {"CreateTableAdmin"};
 const string delete_table {"DeleteTableAdmin"};
 
 const string read_entity_admin {"ReadEntityAdmin"};
+const string read_entities_admin {"ReadEntitiesAdmin"};
+const string export_entities_admin {"ExportEntitiesAdmin"};
 const string update_entity_admin {"UpdateEntityAdmin"};
+const string batch_update_entity_admin {"BatchUpdateEntityAdmin"};
+const string import_entities_admin {"ImportEntitiesAdmin"};
 const string delete_entity_admin {"DeleteEntityAdmin"};
+const string delete_partition_admin {"DeletePartitionAdmin"};
+const string truncate_table_admin {"TruncateTableAdmin"};
 
 const string read_entity_auth {"ReadEntityAuth"};
 const string update_entity_auth {"UpdateEntityAuth"};
@@ -84,18 +116,244 @@ const string get_update_token_op {"GetUpdateToken"};
 const string add_property_admin {"AddPropertyAdmin"};
 const string update_property_admin {"UpdatePropertyAdmin"};
 
+const string get_cache_stats_admin {"GetCacheStatsAdmin"};
+const string get_imports_admin {"GetImportsAdmin"};
+
+// Query parameters and response header for paged scans
+const string limit_param {"limit"};
+const string continuation_param {"continuation"};
+const string continuation_header {"Continuation"};
+
+// Query parameter naming the properties a read should return
+const string select_param {"select"};
+
+// Query parameter holding a filter expression (see FilterExpr.h)
+const string filter_param {"filter"};
+
+// Query parameter making an UpdateEntityAdmin wait for its storage
+// write when write-behind is on
+const string sync_param {"sync"};
+
+// Query parameters bounding and splitting an export
+const string partition_from_param {"partition_from"};
+const string partition_to_param {"partition_to"};
+const string parallel_param {"parallel"};
+constexpr int def_export_ranges {4};
+constexpr int max_export_ranges {16};
+
+// Headers for conditional entity reads
+const string etag_header {"ETag"};
+const string if_none_match_header {"If-None-Match"};
+
+// Response header marking an update that changed nothing and was
+// not written
+const string write_skipped_header {"Write-Skipped"};
+
+// Table storage returns at most this many entities per segment
+constexpr int max_page_size {1000};
+
+// Table storage allows at most 15 comparisons in a filter
+constexpr size_t max_filter_comparisons {15};
+constexpr size_t max_rows_per_filter {14};
+
+// Comparisons in each has_property_filter() condition
+constexpr size_t property_filter_comparisons {9};
+
+// Imports read the body this many bytes at a time, reject longer
+// lines, keep this many batches in flight, and report this many errors
+constexpr size_t import_read_bytes {64 * 1024};
+constexpr size_t max_import_line {1024 * 1024};
+constexpr size_t import_batches_in_flight {8};
+constexpr size_t max_import_errors {10};
+
+// Storage reads in flight for one ReadEntitiesAdmin request
+constexpr size_t reads_in_flight {8};
+
+// Partitions written at once by BatchUpdateEntityAdmin
+constexpr size_t batch_update_partitions_in_flight {8};
+
+// Batches in flight for AddPropertyAdmin and UpdatePropertyAdmin
+constexpr size_t property_batches_in_flight {8};
+
+// Batches in flight for DeletePartitionAdmin and TruncateTableAdmin
+constexpr size_t delete_batches_in_flight {16};
+
 
 /*
   Cache of opened tables
  */
 TableCache table_cache {};
 
+/*
+  Cache of recently read entities, for point reads
+
+  Capacity in bytes can be set with --entity-cache-bytes.
+ */
+constexpr size_t def_entity_cache_bytes {64 * 1024 * 1024};
+EntityCache entity_cache {def_entity_cache_bytes};
+
+/*
+  Entities and partitions known not to exist, so point reads of them
+  can be answered NotFound without a storage round trip
+
+  Set with --negative-ttl-ms and --key-filters.
+ */
+MissCache miss_cache {};
+
+/*
+  Progress of an import, readable while it runs
+ */
+struct import_progress {
+  string table_name;
+  std::atomic<uint64_t> lines {0};
+  std::atomic<uint64_t> imported {0};
+  std::atomic<uint64_t> failed {0};
+  std::atomic<uint64_t> rejected {0};
+};
+
+/*
+  Imports in progress, by import id
+ */
+critical_section_t imports_lock {};
+unordered_map<string,std::shared_ptr<import_progress>> imports {};
+uint64_t next_import_id {0};
+
+/*
+  Full-table and partition scans in progress, so identical requests
+  that arrive while one runs share its storage query and response
+ */
+ScanFlights scan_flights {};
+
+/*
+  UpdateEntityAdmin merges waiting to be coalesced into one storage
+  write per entity
+
+  Off unless --write-behind-ms sets the window.
+ */
+WriteBehind write_behind {};
+
+/*
+  Updates not written because they would have changed nothing
+ */
+std::atomic<uint64_t> skipped_writes {0};
+
+/*
+  Record a storage error on table_name. If it says the table is
+  gone, the cache forgets that the table exists and the next request
+  checks again. A NotFound for a missing entity leaves it alone.
+ */
+void note_storage_error (const string& table_name, const storage_exception& e) {
+  table_cache.forget_if_missing(table_name, e);
+}
+
+/*
+  Record the status of an insert-or-merge into table_name. Such a
+  write cannot miss an entity, so a NotFound means the table is gone.
+ */
+void note_write_status (const string& table_name, int http_status) {
+  if (http_status == status_codes::NotFound)
+    table_cache.forget_exists(table_name);
+}
+
+/*
+  Reply InternalError to message from a task continuation that
+  failed with e. Nothing may escape a continuation, as an unobserved
+  task exception ends the process, so a reply that fails too (one
+  may already have gone out) is only logged.
+ */
+void reply_failed (http_request message, const std::exception& e) {
+  log_error(log_category::request) << "Request failed: " << e.what();
+  try {
+    message.reply(status_codes::InternalError);
+  }
+  catch (const std::exception& again) {
+    log_error(log_category::request) << "Reply failed: " << again.what();
+  }
+}
+
+/*
+  Record that an entity of table_name has been written (or that a
+  write may have reached storage), so that no cache serves what
+  storage held before.
+ */
+void note_entity_write (const string& table_name, const string& partition, const string& row) {
+  entity_cache.invalidate(table_name, partition, row);
+  miss_cache.note_write(table_name, partition, row);
+  scan_flights.detach_table(table_name);
+}
+
+/*
+  Record that an entity of table_name has been deleted (or that a
+  delete may have reached storage).
+ */
+void note_entity_delete (const string& table_name, const string& partition, const string& row) {
+  entity_cache.invalidate(table_name, partition, row);
+  scan_flights.detach_table(table_name);
+}
+
+/*
+  Write out the merges pending in write_behind that the request on
+  route could observe or be reordered with: those of its entity if it
+  names one, otherwise those of its whole table.
+
+  Paths that carry a token name the entity after the token.
+ */
+void settle_pending_writes (const route_path& route) {
+  if ( ! write_behind.enabled() || route.size() < 2)
+    return;
+  const bool has_token {route.equals(0, read_entity_auth) || route.equals(0, update_entity_auth)};
+  if (has_token && route.size() == 5)
+    write_behind.flush_entity(route[1], route[3], route[4]);
+  else if ( ! has_token && route.size() == 4)
+    write_behind.flush_entity(route[1], route[2], route[3]);
+  else
+    write_behind.flush_table(route[1]);
+}
+
+/*
+  Return true if merging properties into entity partition/row of
+  table_name would change nothing, judged by the entity cache.
+
+  An entity not in the cache, or with a merge pending in write_behind
+  that the cached copy does not show yet, is never judged unchanged.
+ */
+bool merge_is_noop (const string& table_name, const string& partition, const string& row,
+                    const table_entity::properties_type& properties) {
+  if (write_behind.has_pending(table_name, partition, row))
+    return false;
+  table_entity current {};
+  if ( ! entity_cache.lookup(table_name, partition, row, current))
+    return false;
+  for (const auto& prop : properties) {
+    auto found = current.properties().find(prop.first);
+    if (found == current.properties().end() ||
+        found->second.property_type() != prop.second.property_type() ||
+        found->second.str() != prop.second.str())
+      return false;
+  }
+  return true;
+}
+
+/*
+  Return the subset of properties named in columns.
+ */
+table_entity::properties_type select_properties (const table_entity::properties_type& properties,
+                                                 const vector<string>& columns) {
+  table_entity::properties_type selected {};
+  for (const auto& column : columns) {
+    auto prop = properties.find(column);
+    if (prop != properties.end())
+      selected.insert(*prop);
+  }
+  return selected;
+}
+
 /*
   Convert properties represented in Azure Storage type
   to prop_vals_t type.
  */
 prop_vals_t get_properties (const table_entity::properties_type& properties, prop_vals_t values = prop_vals_t {}) {
-  for (const auto v : properties) {
+  for (const auto& v : properties) {
     if (v.second.property_type() == edm_type::string) {
       values.push_back(make_pair(v.first, value::string(v.second.string_value())));
     }
@@ -122,426 +380,2302 @@ prop_vals_t get_properties (const table_entity::properties_type& properties, pro
 }
 
 /*
-  Return true if an HTTP request has a JSON body
-
-  This routine canbe called multiple times on the same message.
-*/
-/*bool has_json_body (http_request message) {
-  return message.headers()["Content-type"] == "application/json";
-}*/
+  Return a filter condition that holds only for entities that have
+  the property prop_name.
+
+  Table storage has no "property exists" test, but a comparison
+  against a property an entity does not have, or has with another
+  type, is false. So the condition is one comparison for each type
+  storage holds that every value of the type passes, or'd together:
+  property_filter_comparisons in all. This server only writes some
+  of the types (see json_to_property()), but entities written by
+  other clients may hold any of them.
+ */
+string has_property_filter (const string& prop_name) {
+  const string ge {azure::storage::query_comparison_operator::greater_than_or_equal};
+  const string eq {azure::storage::query_comparison_operator::equal};
+  const vector<string> conditions {
+    table_query::generate_filter_condition(prop_name, ge, string {}),
+    table_query::generate_filter_condition(prop_name, ge, std::numeric_limits<int32_t>::min()),
+    table_query::generate_filter_condition(prop_name, ge, std::numeric_limits<int64_t>::min()),
+    table_query::generate_filter_condition(prop_name, ge, std::numeric_limits<double>::lowest()),
+    table_query::generate_filter_condition(prop_name, eq, true),
+    table_query::generate_filter_condition(prop_name, eq, false),
+    table_query::generate_filter_condition(prop_name, ge, utility::datetime {}),
+    table_query::generate_filter_condition(prop_name, ge, utility::uuid {}),
+    table_query::generate_filter_condition(prop_name, ge, vector<uint8_t> {})
+  };
+  string filter {conditions[0]};
+  for (size_t i = 1; i < conditions.size(); ++i) {
+    filter = table_query::combine_filter_conditions(filter, azure::storage::query_logical_operator::op_or,
+                                                    conditions[i]);
+  }
+  return filter;
+}
 
 /*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-
-  If the message has no JSON body, return an empty map.
+  Return true if entity has every property named in names.
+ */
+bool has_properties (const table_entity& entity, const vector<string>& names) {
+  for (const auto& name : names) {
+    auto prop = entity.properties().find(name);
+    if (prop == entity.properties().end() || prop->second.is_null())
+      return false;
+  }
+  return true;
+}
 
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
+/*
+  Write the bytes of chunk to a response body that is being streamed.
+  The task completes once the buffer has taken them, and holds chunk
+  until then.
+ */
+pplx::task<void> write_chunk (producer_consumer_buffer<uint8_t> body, string chunk) {
+  if (chunk.empty())
+    return pplx::task_from_result();
+  auto held = std::make_shared<const string>(std::move(chunk));
+  return body.putn(reinterpret_cast<const uint8_t*>(held->data()), held->size())
+    .then([held] (size_t) {});
+}
 
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
+/*
+  Write chunk as write_chunk() does, but complete only once the client
+  has read enough of body that the server holds less than
+  StreamPacer::def_max_unread bytes of it. A producer that waits for
+  this before producing more goes no faster than its client.
  */
-unordered_map<string,string> get_json_body(http_request message) {  
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-    {
-            json = v;
-      return true;
-    })
-    .wait();
+pplx::task<void> write_paced (producer_consumer_buffer<uint8_t> body, string chunk) {
+  return write_chunk(body, std::move(chunk))
+    .then([body] () {
+        return StreamPacer::instance().room(body);
+      });
+}
 
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-  results[v.first] = v.second.as_string();
+/*
+  Close a streamed response body, ending it with failure if given. The
+  task never fails: a client that has gone away is only logged.
+ */
+pplx::task<void> close_body (producer_consumer_buffer<uint8_t> body,
+                             std::exception_ptr failure = std::exception_ptr {}) {
+  pplx::task<void> closed {failure ? body.close(std::ios_base::out, failure) : body.close(std::ios_base::out)};
+  return closed.then([] (pplx::task<void> c) {
+      try {
+        c.get();
       }
-      else {
-  results[v.first] = v.second.serialize();
+      catch (const std::exception& e) {
+        log_warning(log_category::request) << "Client went away: " << e.what();
       }
-    }
-  }
-  return results;
+    });
 }
 
 /*
-  Top-level routine for processing all HTTP GET requests.
-
-  GET is the only request that has no command. All
-  operands specify the value(s) to be retrieved.
+  Run query to its end without holding a thread while storage works,
+  calling on_segment with each segment as it arrives. The task
+  completes after the last segment, or with the first exception.
  */
-void handle_get(http_request message) { 
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** GET " << path << endl;
-  auto paths = uri::split_path(path);
-
-  // If command was ReadEntityAdmin
-  if (paths[0] == read_entity_admin) {
-    
-    unordered_map<string,string> json_body {get_json_body (message)};
-
-    // Need at least a table name
-    if (paths.size() < 2) {
-      cout << "Missing table name" << endl;
-      message.reply(status_codes::BadRequest);
-      return;
-    }
-
-    cloud_table table {table_cache.lookup_table(paths[1])};
-    if ( ! table.exists()) {
-      cout << "Table does not exist" << endl;
-      message.reply(status_codes::NotFound);
-      return;
-    }
+pplx::task<void> for_each_segment_async (const cloud_table& table, const table_query& query,
+                                         std::function<void (const table_query_segment&)> on_segment,
+                                         const continuation_token& token = continuation_token {}) {
+  return table.execute_query_segmented_async(query, token)
+    .then([table, query, on_segment] (table_query_segment segment) {
+      on_segment(segment);
+      if (segment.continuation_token().empty())
+        return pplx::task_from_result();
+      return for_each_segment_async(table, query, on_segment, segment.continuation_token());
+    });
+}
 
-    /*
-      Code for Operation 2
+/*
+  Like for_each_segment_async(), but on_segment returns a task, and the
+  next segment is not fetched until it completes, so a consumer that
+  falls behind holds up the scan.
+ */
+pplx::task<void> for_each_segment_paced (const cloud_table& table, const table_query& query,
+                                         std::function<pplx::task<void> (const table_query_segment&)> on_segment,
+                                         const continuation_token& token = continuation_token {}) {
+  return table.execute_query_segmented_async(query, token)
+    .then([table, query, on_segment] (table_query_segment segment) {
+      const continuation_token next {segment.continuation_token()};
+      return on_segment(segment)
+        .then([table, query, on_segment, next] () {
+            if (next.empty())
+              return pplx::task_from_result();
+            return for_each_segment_paced(table, query, on_segment, next);
+          });
+    });
+}
 
-      Get entities containing properties specific to the ones in the body
-      Size of paths is 2
-    */
-    if (paths.size() == 2 && json_body.size() > 0) {
-      table_query query {};
-      table_query_iterator end;
-      table_query_iterator it = table.execute_query(query);
-      vector<value> key_vec;
-      vector<string> found_properties;
-
-      // Push properties from json body of request into a vector called found_properties
-      for(auto it_json = json_body.begin(); it_json != json_body.end(); ++it_json){
-        found_properties.push_back(it_json->first);
-      }
+/*
+  Return the entities of the first segment of query that has any, or
+  none if the scan ends without finding one. Storage may answer with
+  an empty segment and a continuation, so one fetch is not enough.
+ */
+pplx::task<vector<table_entity>> first_found_async (const cloud_table& table, const table_query& query,
+                                                    const continuation_token& token = continuation_token {}) {
+  return table.execute_query_segmented_async(query, token)
+    .then([table, query] (table_query_segment segment) {
+      if (segment.results().size() > 0 || segment.continuation_token().empty())
+        return pplx::task_from_result(segment.results());
+      return first_found_async(table, query, segment.continuation_token());
+    });
+}
 
-      //If flag = 0, properties does not match
-      int flag = 0;
-      while(it != end) {
-        cout << "GET: " << it->partition_key() << " / " << it->row_key() << endl; 
-        prop_vals_t keys { make_pair("Partition",value::string(it->partition_key())), make_pair("Row", value::string(it->row_key())) }; //saves partition
-        keys = get_properties(it->properties(), keys);
-        int i = 0;
-        int j = 0;
-        for(i = 0;i < found_properties.size();i++) {
-          for(j = 0;j < keys.size();j++) {
-            if(found_properties[i] == std::get<0>(keys[j])) {
-              flag++;
-              break;
-            }
+/*
+  Reply OK to message with the entities matched by query, as a JSON
+  array of objects with Partition, Row, and property values.
+
+  If query covers a whole table or partition, recorder (if given)
+  is told every key the scan sees.
+
+  The response uses chunked transfer encoding and is written one
+  storage segment at a time, so the client starts receiving the array
+  before the scan finishes. The next segment is not fetched while the
+  client has StreamPacer::def_max_unread bytes or more left to read,
+  so a slow client slows the scan down instead of the server buffering
+  the result for it. The scan runs as task continuations, so this
+  returns at once and no thread waits on storage or the client.
+
+  If storage fails part way through, the status line has already
+  gone out, so the body is closed with an error and the client sees
+  a truncated response rather than a well-formed partial array.
+
+  If lead (if given) is held by this request, every chunk is also
+  published to the requests following it. The recorder and lead are
+  held until the scan ends.
+
+  Entities failing keep (if given) are left out, and if columns is
+  not empty only those properties of each entity are returned.
+ */
+void reply_query_streamed (http_request message, const cloud_table& table, const table_query& query,
+                           std::shared_ptr<MissCache::scan_recorder> recorder = nullptr,
+                           std::shared_ptr<ScanFlights::lead> lead = nullptr,
+                           const entity_predicate& keep = entity_predicate {},
+                           const vector<string>& columns = vector<string> {}) {
+  producer_consumer_buffer<uint8_t> body {};
+  http_response response {status_codes::OK};
+  response.set_body(body.create_istream(), "application/json");
+  message.reply(response);
+  if (lead)
+    lead->flight().seal(status_codes::OK);
+
+  // Shared by the continuations of the scan
+  struct stream_state {
+    bool first;
+    size_t count;
+  };
+  auto state = std::make_shared<stream_state>(stream_state {true, 0});
+
+  if (lead)
+    lead->flight().append("[");
+
+  write_chunk(body, "[")
+    .then([table, query, body, state, recorder, lead, keep, columns] () {
+        return for_each_segment_paced(table, query,
+            [body, state, recorder, lead, keep, columns] (const table_query_segment& segment) {
+              string chunk {};
+              for (const auto& entity : segment.results()) {
+                log_debug(log_category::entity) << "Key: " << entity.partition_key() << " / " << entity.row_key();
+                if (recorder)
+                  recorder->add(entity.partition_key(), entity.row_key());
+                if (keep && ! keep(entity))
+                  continue;
+                if ( ! state->first)
+                  chunk += ",";
+                append_entity_json(chunk, entity, columns);
+                state->first = false;
+                ++state->count;
+              }
+              if (lead)
+                lead->flight().append(chunk);
+              return write_paced(body, std::move(chunk));
+            });
+      })
+    .then([body, state, recorder, lead, table] (pplx::task<void> scan) {
+        std::exception_ptr failure {};
+        try {
+          scan.get();
+          if (recorder)
+            recorder->finish();
+          if (lead) {
+            lead->flight().append("]");
+            lead->flight().finish();
           }
+          log_info(log_category::request) << "Streamed " << state->count << " entities";
+          return write_chunk(body, "]")
+            .then([body] (pplx::task<void> written) {
+                try {
+                  written.get();
+                }
+                catch (const std::exception& e) {
+                  return close_body(body, std::current_exception());
+                }
+                return close_body(body);
+              });
         }
-
-        //If correct number of properties found, save our partition into key_vec
-        if(flag == found_properties.size()) {
-          key_vec.push_back(value::object(keys)); 
+        catch (const storage_exception& e) {
+          log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+          note_storage_error(table.name(), e);
+          failure = std::current_exception();
         }
-        
-        //Reset flag for next partition
-        flag = 0;
-        ++it;
-      }
-
-      // If key_vec is empty then nothing was found; return NotFound and an empty body
-      if (key_vec.size() == 0) {
-        message.reply(status_codes::NotFound, value::array(key_vec));
-        return;
-      }
-
-      // If key_vec is not empty then something was found; return OK with entities in a body
-      message.reply(status_codes::OK, value::array(key_vec));
-      return;
-    }
-
-    // GET all entries in table
-    if (paths.size() == 2) {
-      table_query query {};
-      table_query_iterator end;
-      table_query_iterator it = table.execute_query(query);
-      vector<value> key_vec;
-      while (it != end) {
-        cout << "Key: " << it->partition_key() << " / " << it->row_key() << endl;
-        prop_vals_t keys { make_pair("Partition",value::string(it->partition_key())), make_pair("Row", value::string(it->row_key())) };
-        keys = get_properties(it->properties(), keys);
-        key_vec.push_back(value::object(keys));
-        ++it;
-      }
-      message.reply(status_codes::OK, value::array(key_vec));
-      return;
-    }
-
-    // GET specific entry: Partition == paths[1], Row == paths[2]
-    if (paths.size() != 4) {
-      message.reply (status_codes::BadRequest);
-      return;
-    }
-
-    /*
-      Code for Operation 1
-
-      GET all entities from a specific partition
-      Size of paths is 4
-
-      Note that Ted's code above this makes sure there are 4 parameters
-      If the row is '*' it will get all entities within the specified partition
-      If the row is not '*' it will skip this and go to Teds code where it will get all entities with the specified partition and row
-    */
-    if( paths[3] == "*" ) {
-        table_query query {};
-        table_query_iterator end;
-        table_query_iterator it = table.execute_query(query);
-        vector<value> key_vec;
-        prop_vals_t keys;
-        while(it != end) {
-          if( paths[2] == it->partition_key() ) {
-            cout << "GET: " << it->partition_key() << " / " << it->row_key() << endl; 
-            keys = { make_pair("Partition",value::string(it->partition_key())), make_pair("Row",value::string(it->row_key())) };
-            keys = get_properties(it->properties(), keys);
-            key_vec.push_back(value::object(keys));
-          }
-          ++it;
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Scan failed: " << e.what();
+          failure = std::current_exception();
         }
 
-        // If key_vec is empty then nothing was found; return NotFound and an empty body
-        if (key_vec.size() == 0) {
-          message.reply(status_codes::NotFound, value::array(key_vec));
-          return;
-        }
+        // The status has gone out, so end the body with the error
+        if (lead)
+          lead->flight().fail();
+        return close_body(body, failure);
+      });
+}
 
-        // If key_vec is not empty then something was found; return OK with entities in a body
-        message.reply(status_codes::OK, value::array(key_vec));
-        return;
-    }
+/*
+  Paging parameters of a scan request
 
-    table_operation retrieve_operation {table_operation::retrieve_entity(paths[2], paths[3])};
-    table_result retrieve_result {table.execute(retrieve_operation)};
-    cout << "HTTP code: " << retrieve_result.http_status_code() << endl;
-    if (retrieve_result.http_status_code() == status_codes::NotFound) {
-      message.reply(status_codes::NotFound);
-      return;
-    }
+  paged: true if the request named a limit or a continuation
+  limit: maximum number of entities to return in this page
+  token: storage position at which this page starts
+ */
+struct page_params {
+  bool paged;
+  int limit;
+  continuation_token token;
+};
 
-    table_entity entity {retrieve_result.entity()};
-    table_entity::properties_type properties {entity.properties()};
-    
-    // If the entity has any properties, return them as JSON
-    prop_vals_t values (get_properties(properties));
-    if (values.size() > 0) {
-      message.reply(status_codes::OK, value::object(values));
-      return;
-    }
-    else {
-      message.reply(status_codes::OK);
-      return;
-    }
+/*
+  Continuation tokens are handed to clients as lowercase hex of the
+  storage marker, which keeps them opaque and safe in a query string
+  without any further escaping.
+ */
+string encode_continuation (const continuation_token& token) {
+  static const char digits[] {"0123456789abcdef"};
+  const string& marker {token.next_marker()};
+  string result {};
+  result.reserve(2 * marker.size());
+  for (unsigned char c : marker) {
+    result += digits[c >> 4];
+    result += digits[c & 0xf];
   }
-  
+  return result;
+}
 
-  /*
-    Code for Assign2 Operation 1
-  */
-  // If command was ReadEntityAuth
-  if (paths[0] == read_entity_auth) {
+/*
+  Inverse of encode_continuation()
 
-    // Parameter checking done by ServerUtils
+  Returns false if encoded is not a well-formed token.
+ */
+bool decode_continuation (const string& encoded, continuation_token& token) {
+  auto nibble = [] (char c) -> int {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  if (encoded.size() % 2 != 0)
+    return false;
+  string marker {};
+  marker.reserve(encoded.size() / 2);
+  for (string::size_type i = 0; i < encoded.size(); i += 2) {
+    int high {nibble(encoded[i])};
+    int low {nibble(encoded[i+1])};
+    if (high < 0 || low < 0)
+      return false;
+    marker += static_cast<char>((high << 4) | low);
+  }
+  token = continuation_token {marker};
+  return true;
+}
 
-    // Check if table exists
-    cloud_table table {table_cache.lookup_table(paths[1])};
-    if ( ! table.exists()) {
-      cout << "Table does not exist" << endl;
-      message.reply(status_codes::NotFound);
-      return;
-    }
+/*
+  Read the limit and continuation query parameters of a scan request.
 
-    // Use function Ted made in ServerUtils.cpp
-    pair<status_code,table_entity> result {read_with_token(message, tables_endpoint)};
-    
-    // read_with_token only returns OK as status_code if an entity was found with the given partition and row name
-    if (result.first == status_codes::OK) {
-      
-      table_entity::properties_type properties {result.second.properties()};
-
-      // If the entity has any properties, return them as JSON
-      prop_vals_t values (get_properties(properties));
-      if (values.size() > 0) {
-        message.reply(result.first, value::object(values));
-        return;
-      }
-      else {
-        message.reply(result.first);
-        return;
-      }
+  Returns a pair:
+    first: BadRequest if either parameter is malformed, else OK
+    second: the paging parameters
+ */
+pair<status_code,page_params> get_page_params (const http_request& message) {
+  page_params page {false, max_page_size, continuation_token {}};
+  auto query = uri::split_query(message.relative_uri().query());
+
+  auto limit = query.find(limit_param);
+  if (limit != query.end()) {
+    try {
+      page.limit = std::stoi(uri::decode(limit->second));
     }
-
-    else {
-      message.reply(result.first);
-      return;
+    catch (const std::exception&) {
+      return make_pair(status_codes::BadRequest, page);
     }
+    if (page.limit <= 0 || page.limit > max_page_size)
+      return make_pair(status_codes::BadRequest, page);
+    page.paged = true;
   }
 
-
-  // Return BadRequest if GET operation does not match
-  else { 
-    message.reply(status_codes::BadRequest);
-    return;
+  auto continuation = query.find(continuation_param);
+  if (continuation != query.end()) {
+    if ( ! decode_continuation(uri::decode(continuation->second), page.token))
+      return make_pair(status_codes::BadRequest, page);
+    page.paged = true;
   }
+  return make_pair(status_codes::OK, page);
 }
 
 /*
-  Top-level routine for processing all HTTP POST requests.
+  Return the property names listed in the select query parameter
+  (comma-separated), or an empty vector if the request has none.
  */
-void handle_post(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation and a table name
-  if (paths.size() < 2) {
-    message.reply(status_codes::BadRequest);
-    return;
+vector<string> get_select_columns (const http_request& message) {
+  vector<string> columns {};
+  auto query = uri::split_query(message.relative_uri().query());
+  auto select = query.find(select_param);
+  if (select == query.end())
+    return columns;
+
+  const string names {uri::decode(select->second)};
+  string::size_type start {0};
+  while (start <= names.size()) {
+    string::size_type comma {names.find(',', start)};
+    if (comma == string::npos)
+      comma = names.size();
+    if (comma > start)
+      columns.push_back(names.substr(start, comma - start));
+    start = comma + 1;
   }
+  return columns;
+}
 
-  string table_name {paths[1]};
-  cloud_table table {table_cache.lookup_table(table_name)};
-
-  // Create table (idempotent if table exists)
-  if (paths[0] == create_table) {
-    cout << "Create " << table_name << endl;
-    bool created {table.create_if_not_exists()};
-    cout << "Administrative table URI " << table.uri().primary_uri().to_string() << endl;
-    if (created)
-      message.reply(status_codes::Created);
-    else
-      message.reply(status_codes::Accepted);
-  }
-  else {
-    message.reply(status_codes::BadRequest);
+/*
+  Return the key under which identical scans are coalesced: the kind
+  of scan, what it is restricted to, and the columns it returns
+ */
+string scan_key (const string& kind, const string& restriction, const vector<string>& columns) {
+  string key {kind + "/" + restriction + "?"};
+  for (const auto& column : columns) {
+    key += column + ",";
   }
+  return key;
 }
 
 /*
-  Top-level routine for processing all HTTP PUT requests.
+  Return a filter condition matching exactly the entity partition/row
  */
-void handle_put(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** PUT " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation, table name, partition, and row
-  if (paths.size() < 4) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
+string entity_key_filter (const string& partition, const string& row) {
+  return table_query::combine_filter_conditions(
+    table_query::generate_filter_condition("PartitionKey",
+                                           azure::storage::query_comparison_operator::equal,
+                                           partition),
+    azure::storage::query_logical_operator::op_and,
+    table_query::generate_filter_condition("RowKey",
+                                           azure::storage::query_comparison_operator::equal,
+                                           row));
+}
 
-  unordered_map<string,string> json_body {get_json_body (message)};  
+/*
+  Return true if the If-None-Match header of message names etag
 
-  cloud_table table {table_cache.lookup_table(paths[1])};
-  if ( ! table.exists()) {
-    message.reply(status_codes::NotFound);
-    return;
+  The header is a comma-separated list of entity tags, or "*".
+  Weak ("W/") prefixes are ignored, as RFC 7232 requires for
+  If-None-Match. Storage etags never contain commas.
+ */
+bool etag_matches (const http_request& message, const string& etag) {
+  const http_headers& headers {message.headers()};
+  auto if_none_match (headers.find(if_none_match_header));
+  if (etag.empty() || if_none_match == headers.end())
+    return false;
+
+  auto strip_weak = [] (const string& tag) {
+    return tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag;
+  };
+  const string wanted {strip_weak(etag)};
+  std::istringstream tags {if_none_match->second};
+  string tag;
+  while (getline(tags, tag, ',')) {
+    size_t first {tag.find_first_not_of(" \t")};
+    if (first == string::npos)
+      continue;
+    tag = tag.substr(first, tag.find_last_not_of(" \t") - first + 1);
+    if (tag == "*" || strip_weak(tag) == wanted)
+      return true;
   }
+  return false;
+}
 
-  // Code for Assign2 (Commands for extra things we did not do in Assign1)
-  // If command was AddPropertyAdmin or UpdatePropertyAdmin
-  if (paths[0] == add_property_admin || paths[0] == update_property_admin) {
-    message.reply(status_codes::NotImplemented);
-    return;
-  }
+/*
+  Reply OK to message with the properties of entity as a JSON object,
+  and its storage etag in the ETag header.
 
-  /*
-    Coded for Assign2 Operation 2
-    
-    Check if command is for auth access
-    Uses Teds code in ServerUtils to update
-    Return
-  */
-  // If command was UpdateEntityAuth
-  if (paths[0] == update_entity_auth) {
-    message.reply(update_with_token(message, tables_endpoint, json_body));
+  If the client already holds this version (If-None-Match names the
+  etag) reply NotModified with no body instead.
+ */
+void reply_entity (http_request message, const table_entity& entity) {
+  if (etag_matches(message, entity.etag())) {
+    log_debug(log_category::request) << "Entity not modified";
+    http_response response {status_codes::NotModified};
+    response.headers().add(etag_header, entity.etag());
+    message.reply(response);
     return;
-  }  
-
-  table_entity entity {paths[2], paths[3]};
-
-  // Update entity
-  try {
-    if (paths[0] == update_entity_admin) {
-      cout << "Update " << entity.partition_key() << " / " << entity.row_key() << endl;
-      table_entity::properties_type& properties = entity.properties();
-      for (const auto v : json_body) {
-  properties[v.first] = entity_property {v.second};
-      }
+  }
 
-      table_operation operation {table_operation::insert_or_merge_entity(entity)};
-      table_result op_result {table.execute(operation)};
+  http_response response {status_codes::OK};
+  if ( ! entity.etag().empty())
+    response.headers().add(etag_header, entity.etag());
 
-      message.reply(status_codes::OK);
-    }
-    else {
-      message.reply(status_codes::BadRequest);
-    }
-  }
-  catch (const storage_exception& e)
-  {
-    cout << "Azure Table Storage error: " << e.what() << endl;
-    message.reply(status_codes::InternalError);
+  // If the entity has any properties, return them as JSON
+  if (entity.properties().size() > 0) {
+    string body {};
+    append_properties_json(body, entity);
+    response.set_body(body, "application/json");
   }
+  message.reply(response);
 }
 
 /*
-  Top-level routine for processing all HTTP DELETE requests.
+  One page of a query, shared by the continuations that fetch it
  */
-void handle_delete(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** DELETE " << path << endl;
-  auto paths = uri::split_path(path);
-  // Need at least an operation and table name
-  if (paths.size() < 2) {
-  message.reply(status_codes::BadRequest);
-  return;
-  }
+struct page_fetch {
+  cloud_table table;
+  table_query query;
+  size_t limit;
+  entity_predicate keep;
+  vector<string> columns;
+  string body;
+  size_t found;
+  continuation_token token;
+};
 
-  string table_name {paths[1]};
-  cloud_table table {table_cache.lookup_table(table_name)};
+/*
+  Fetch segments into fetch until it holds its limit of entities or
+  the scan ends, leaving in fetch->token where the scan resumes. The
+  task fails with the first storage error.
+ */
+pplx::task<void> fetch_page_async (std::shared_ptr<page_fetch> fetch) {
+  fetch->query.set_take_count(static_cast<int>(fetch->limit - fetch->found));
+  return fetch->table.execute_query_segmented_async(fetch->query, fetch->token)
+    .then([fetch] (table_query_segment segment) {
+      for (const auto& entity : segment.results()) {
+        if (fetch->keep && ! fetch->keep(entity))
+          continue;
+        log_debug(log_category::entity) << "Key: " << entity.partition_key() << " / " << entity.row_key();
+        if (fetch->found > 0)
+          fetch->body += ",";
+        append_entity_json(fetch->body, entity, fetch->columns);
+        ++fetch->found;
+      }
+      fetch->token = segment.continuation_token();
+      if (fetch->found >= fetch->limit || fetch->token.empty())
+        return pplx::task_from_result();
+      return fetch_page_async(fetch);
+    });
+}
 
-  // Delete table
-  if (paths[0] == delete_table) {
-    cout << "Delete " << table_name << endl;
-    if ( ! table.exists()) {
-      message.reply(status_codes::NotFound);
-    }
-    table.delete_table();
-    table_cache.delete_entry(table_name);
-    message.reply(status_codes::OK);
-  }
-  // Delete entity
-  else if (paths[0] == delete_entity_admin) {
-    // For delete entity, also need partition and row
-    if (paths.size() < 4) {
-  message.reply(status_codes::BadRequest);
-  return;
+/*
+  Reply to message with one page of the entities matched by query,
+  as a JSON array of objects with Partition, Row, and property values.
+
+  Segments are fetched until page.limit entities are found or the
+  scan ends. If the scan can be resumed, the Continuation header of
+  the response holds the token to pass as the continuation parameter
+  of the next request. The reply is sent from a task continuation,
+  so no thread waits on storage.
+
+  empty_status is the status for a first page that finds nothing at
+  all; any other page replies OK.
+
+  Entities failing keep (if given) are skipped, for conditions too
+  large for the filter. If columns is not empty, only those
+  properties of each entity are returned.
+ */
+void reply_query_page (http_request message, const cloud_table& table, const table_query& query,
+                       const page_params& page, status_code empty_status,
+                       const entity_predicate& keep = entity_predicate {},
+                       const vector<string>& columns = vector<string> {}) {
+  auto fetch = std::make_shared<page_fetch>(page_fetch {table, query, static_cast<size_t>(page.limit),
+                                                         keep, columns, "[", 0, page.token});
+  const bool first_page {page.token.empty()};
+  fetch_page_async(fetch)
+    .then([message, fetch, first_page, empty_status] (pplx::task<void> fetched) {
+      try {
+        fetched.get();
+        bool nothing_found {fetch->found == 0 && fetch->token.empty() && first_page};
+        http_response response {nothing_found ? empty_status : status_codes::OK};
+        if ( ! fetch->token.empty())
+          response.headers().add(continuation_header, encode_continuation(fetch->token));
+        fetch->body += "]";
+        response.set_body(fetch->body, "application/json");
+        message.reply(response);
+      }
+      catch (const storage_exception& e) {
+        // Storage rejects bad filters and tokens it did not issue
+        log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+        note_storage_error(fetch->table.name(), e);
+        if (e.result().http_status_code() == status_codes::BadRequest ||
+            e.result().http_status_code() == status_codes::NotFound)
+          message.reply(e.result().http_status_code());
+        else
+          message.reply(status_codes::InternalError);
+      }
+      catch (const std::exception& e) {
+        reply_failed(message, e);
+      }
+    });
+}
+
+/*
+  Return true if an HTTP request has a JSON body
+
+  This routine canbe called multiple times on the same message.
+*/
+/*bool has_json_body (http_request message) {
+  return message.headers()["Content-type"] == "application/json";
+}*/
+
+/*
+  Convert a JSON value to the entity property to store for it.
+
+  Strings and booleans keep their type. Integers become int32 if they
+  fit and int64 otherwise, and other numbers become double, so
+  storage can compare them as numbers. Anything else (null, arrays,
+  objects, integers beyond int64) is stored as its JSON text, as all
+  values were before typed writes. Readers that turn values back
+  into text get the same text either way.
+ */
+entity_property json_to_property (const value& v) {
+  if (v.is_string())
+    return entity_property {v.as_string()};
+  if (v.is_boolean())
+    return entity_property {v.as_bool()};
+  if (v.is_number()) {
+    const web::json::number& n = v.as_number();
+    if (n.is_int32())
+      return entity_property {n.to_int32()};
+    if (n.is_int64())
+      return entity_property {n.to_int64()};
+    if ( ! n.is_integral())
+      return entity_property {n.to_double()};
+  }
+  return entity_property {v.serialize()};
+}
+
+/*
+  Convert a member of a JSON body, as read by read_json_object(), to
+  the entity property to store for it, typed as json_to_property()
+  would type the same value.
+ */
+entity_property member_to_property (json_kind kind, string&& text) {
+  if (kind == json_kind::string)
+    return entity_property {std::move(text)};
+  if (kind == json_kind::boolean)
+    return entity_property {text == "true"};
+  if (kind == json_kind::number) {
+    const char* begin {text.c_str()};
+    char* end {nullptr};
+    errno = 0;
+    if (text.find_first_of(".eE") == string::npos) {
+      long long n {std::strtoll(begin, &end, 10)};
+      if (errno == 0 && *end == '\0') {
+        if (n >= std::numeric_limits<int32_t>::min() && n <= std::numeric_limits<int32_t>::max())
+          return entity_property {static_cast<int32_t>(n)};
+        return entity_property {static_cast<int64_t>(n)};
+      }
+    }
+    else {
+      double d {std::strtod(begin, &end)};
+      if (errno == 0 && *end == '\0')
+        return entity_property {d};
+    }
+  }
+  return entity_property {std::move(text)};
+}
+
+/*
+  Given an HTTP message with a JSON body, set properties to the
+  fields of the body, typed by member_to_property(), and return the
+  status of decoding it (see JsonBody.h).
+
+  If content is not a JSON object, properties is left empty.
+ */
+json_body_status get_json_properties (const request_body& content, table_entity::properties_type& properties) {
+  json_body_status status {read_json_object(content,
+                                            [&properties] (string&& name, json_kind kind, string&& text) {
+                                              properties[std::move(name)] = member_to_property(kind, std::move(text));
+                                            })};
+  if (status != json_body_status::ok)
+    properties.clear();
+  return status;
+}
+
+/*
+  Reply to message for a body that get_json_properties(),
+  get_json_body() or read_json_value() could not decode, returning
+  true if it did.
+ */
+bool reply_body_error (http_request message, json_body_status status) {
+  if (status == json_body_status::too_large) {
+    message.reply(status_codes::RequestEntityTooLarge);
+    return true;
+  }
+  if (status == json_body_status::malformed) {
+    message.reply(status_codes::BadRequest);
+    return true;
+  }
+  return false;
+}
+
+/*
+  A ReadEntitiesAdmin request, shared by its reads. The keys not
+  answered from the caches are split into groups of one partition,
+  each read with one storage request; a read fills in only the
+  results of its own group.
+ */
+struct multi_read {
+  cloud_table table;
+  string table_name;
+  vector<pair<string,string>> keys;
+  vector<pair<status_code,table_entity>> results;
+  vector<vector<size_t>> groups;
+  std::atomic<size_t> next_group {0};
+  uint64_t generation {0};
+  uint64_t miss_generation {0};
+};
+
+/*
+  Read group g of state: a lone key with a retrieve, several with a
+  query naming their rows. The task never fails; a failed read marks
+  its keys InternalError.
+ */
+pplx::task<void> read_key_group (std::shared_ptr<multi_read> state, size_t g) {
+  const vector<size_t>& indices = state->groups[g];
+  for (size_t k : indices) {
+    state->results[k].first = status_codes::NotFound;
+  }
+
+  pplx::task<void> read {};
+  if (indices.size() == 1) {
+    const size_t k {indices[0]};
+    read = state->table.execute_async(table_operation::retrieve_entity(state->keys[k].first, state->keys[k].second))
+      .then([state, k] (table_result retrieve_result) {
+          if (retrieve_result.http_status_code() != status_codes::NotFound)
+            state->results[k] = make_pair(status_codes::OK, retrieve_result.entity());
+        });
+  }
+  else {
+    string rows_filter {};
+    auto wanted = std::make_shared<unordered_map<string,size_t>>();
+    for (size_t k : indices) {
+      string row_filter {table_query::generate_filter_condition("RowKey",
+                                                                azure::storage::query_comparison_operator::equal,
+                                                                state->keys[k].second)};
+      rows_filter = rows_filter.empty() ? row_filter
+        : table_query::combine_filter_conditions(rows_filter, azure::storage::query_logical_operator::op_or, row_filter);
+      (*wanted)[state->keys[k].second] = k;
+    }
+    table_query query {};
+    query.set_filter_string(table_query::combine_filter_conditions(
+      table_query::generate_filter_condition("PartitionKey",
+                                             azure::storage::query_comparison_operator::equal,
+                                             state->keys[indices[0]].first),
+      azure::storage::query_logical_operator::op_and,
+      rows_filter));
+    read = for_each_segment_async(state->table, query,
+        [state, wanted] (const table_query_segment& segment) {
+          for (const auto& entity : segment.results()) {
+            auto found = wanted->find(entity.row_key());
+            if (found != wanted->end())
+              state->results[found->second] = make_pair(status_codes::OK, entity);
+          }
+        });
+  }
+
+  return read.then([state, g] (pplx::task<void> done) {
+      try {
+        done.get();
+        return;
+      }
+      catch (const storage_exception& e) {
+        log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+        note_storage_error(state->table_name, e);
+      }
+      catch (const std::exception& e) {
+        log_error(log_category::storage) << "Read error: " << e.what();
+      }
+      for (size_t k : state->groups[g]) {
+        state->results[k].first = status_codes::InternalError;
+      }
+    });
+}
+
+/*
+  Read the groups of state one after another, taking each from those
+  not yet started, until none are left. A few such lanes bound the
+  reads a request has in flight.
+ */
+pplx::task<void> read_lane (std::shared_ptr<multi_read> state) {
+  const size_t g {state->next_group++};
+  if (g >= state->groups.size())
+    return pplx::task_from_result();
+  return read_key_group(state, g).then([state] { return read_lane(state); });
+}
+
+/*
+  Remember what the reads of state found and reply with the result
+  of every key
+ */
+void reply_multi_read (http_request message, const multi_read& state) {
+  size_t requests {0};
+  for (const auto& group : state.groups) {
+    ++requests;
+    for (size_t k : group) {
+      if (state.results[k].first == status_codes::OK)
+        entity_cache.insert(state.table_name, state.results[k].second, state.generation);
+      else if (state.results[k].first == status_codes::NotFound)
+        miss_cache.remember_miss(state.table_name, state.keys[k].first, state.keys[k].second, state.miss_generation);
     }
-    table_entity entity {paths[2], paths[3]};
-    cout << "Delete " << entity.partition_key() << " / " << entity.row_key()<< endl;
+  }
+  log_info(log_category::request) << "Read " << state.keys.size() << " keys with " << requests << " storage requests";
+
+  value reply {value::object()};
+  for (size_t k = 0; k < state.keys.size(); ++k) {
+    const pair<string,string>& key = state.keys[k];
+    vector<pair<string,value>> entry {make_pair("Status", value::number(state.results[k].first))};
+    if (state.results[k].first == status_codes::OK)
+      entry.push_back(make_pair("Entity", value::object(get_properties(state.results[k].second.properties()))));
+    if ( ! reply.has_field(key.first))
+      reply[key.first] = value::object();
+    reply[key.first][key.second] = value::object(entry);
+  }
+  message.reply(status_codes::OK, reply);
+}
 
-    table_operation operation {table_operation::delete_entity(entity)};
-    table_result op_result {table.execute(operation)};
+/*
+  Code for ReadEntitiesAdmin/<table>
+
+  The body is a JSON array of objects, each naming an entity with
+  Partition and Row. Keys held by the entity or miss caches are
+  answered from them. The rest are read concurrently, at most
+  reads_in_flight storage requests at a time: a partition with
+  several keys is read with queries naming up to max_rows_per_filter
+  rows each, a lone key with a retrieve.
+
+  Replies OK with an object keyed by partition, then by row, whose
+  values hold the Status of each read and, if OK, the Entity's
+  properties. A malformed body gets BadRequest, and one longer than
+  max_json_body RequestEntityTooLarge.
+ */
+void read_entities (http_request message, const route_path& route, const request_body& content) {
+  const string table_name {route[1]};
+  value body {};
+  if (reply_body_error(message, read_json_value(content, body)))
+    return;
+  if ( ! body.is_array()) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
 
-    int code {op_result.http_status_code()};
-    if (code == status_codes::OK || 
-  code == status_codes::NoContent)
-      message.reply(status_codes::OK);
+  // The distinct keys asked for, in the order first asked
+  vector<pair<string,string>> keys {};
+  unordered_map<string,unordered_map<string,size_t>> key_index {};
+  for (const auto& element : body.as_array()) {
+    if ( ! element.is_object() ||
+         ! element.has_field("Partition") || ! element.at("Partition").is_string() ||
+         ! element.has_field("Row") || ! element.at("Row").is_string()) {
+      message.reply(status_codes::BadRequest);
+      return;
+    }
+    const string& partition = element.at("Partition").as_string();
+    const string& row = element.at("Row").as_string();
+    auto& rows = key_index[partition];
+    if (rows.find(row) == rows.end()) {
+      rows[row] = keys.size();
+      keys.push_back(make_pair(partition, row));
+    }
+  }
+
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  auto state = std::make_shared<multi_read>();
+  state->table = table;
+  state->table_name = table_name;
+  state->results.resize(keys.size());
+  state->generation = entity_cache.generation();
+  state->miss_generation = miss_cache.generation();
+
+  vector<string> partitions {};
+  unordered_map<string,vector<size_t>> pending {};
+  for (size_t k = 0; k < keys.size(); ++k) {
+    if (entity_cache.lookup(table_name, keys[k].first, keys[k].second, state->results[k].second)) {
+      state->results[k].first = status_codes::OK;
+    }
+    else if (miss_cache.known_missing(table_name, keys[k].first, keys[k].second)) {
+      state->results[k].first = status_codes::NotFound;
+    }
+    else {
+      auto& indices = pending[keys[k].first];
+      if (indices.size() == 0)
+        partitions.push_back(keys[k].first);
+      indices.push_back(k);
+    }
+  }
+  for (const auto& partition : partitions) {
+    const vector<size_t>& indices = pending[partition];
+    for (size_t first = 0; first < indices.size(); first += max_rows_per_filter) {
+      state->groups.push_back(vector<size_t> (indices.begin() + first,
+                                              indices.begin() + std::min(indices.size(), first + max_rows_per_filter)));
+    }
+  }
+  state->keys = std::move(keys);
+
+  // Reply from a continuation, so no thread waits on storage
+  vector<pplx::task<void>> lanes {};
+  for (size_t l = 0; l < std::min(reads_in_flight, state->groups.size()); ++l) {
+    lanes.push_back(read_lane(state));
+  }
+  if (lanes.empty()) {
+    reply_multi_read(message, *state);
+    return;
+  }
+  pplx::when_all(lanes.begin(), lanes.end())
+    .then([message, state] (pplx::task<void> done) {
+        try {
+          done.get();
+          reply_multi_read(message, *state);
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+}
+
+/*
+  Code for ExportEntitiesAdmin/<table>
+
+  Streams the entities of the table as newline-delimited JSON, one
+  object with Partition, Row, and property values per line.
+
+  Query parameters:
+    partition_from  first partition key to export (default: none)
+    partition_to    partition key to stop before (default: none)
+    parallel        number of key ranges scanned at once (default 4)
+    select          as for ReadEntityAdmin
+
+  The bounds let exports be sharded: [a,m) and [m,z) together export
+  [a,z) exactly once. Lines come in no particular order.
+
+  The ranges are scanned as task continuations, so no thread waits
+  on storage. A range fetches its next segment only once the client
+  has read all but StreamPacer::def_max_unread bytes of the body, so
+  the server holds at most that plus one segment per range however
+  slowly the client reads. As in reply_query_streamed(), a storage
+  failure after the reply has started closes the body with an error.
+ */
+void export_entities (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  auto query_params = uri::split_query(message.relative_uri().query());
+  key_range range {};
+  auto from = query_params.find(partition_from_param);
+  if (from != query_params.end())
+    range.first = uri::decode(from->second);
+  auto to = query_params.find(partition_to_param);
+  if (to != query_params.end())
+    range.second = uri::decode(to->second);
+  int parallel {def_export_ranges};
+  auto parallel_value = query_params.find(parallel_param);
+  if (parallel_value != query_params.end()) {
+    try {
+      parallel = std::stoi(uri::decode(parallel_value->second));
+    }
+    catch (const std::exception&) {
+      parallel = 0;
+    }
+  }
+  if (parallel <= 0 || parallel > max_export_ranges ||
+      ( ! range.second.empty() && range.first >= range.second)) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  table_query query {};
+  vector<string> select_columns {get_select_columns(message)};
+  if (select_columns.size() > 0)
+    query.set_select_columns(select_columns);
+  vector<key_range> ranges {split_key_range(range, static_cast<size_t>(parallel))};
+
+  producer_consumer_buffer<uint8_t> body {};
+  http_response response {status_codes::OK};
+  response.set_body(body.create_istream(), "application/x-ndjson");
+  message.reply(response);
+
+  auto count = std::make_shared<std::atomic<size_t>>(0);
+  const size_t range_count {ranges.size()};
+  scan_key_ranges(table, query, ranges,
+                  [] (const table_entity& entity) {
+                    string line {};
+                    append_entity_json(line, entity);
+                    line += "\n";
+                    return line;
+                  },
+                  [body, count] (const string& piece) {
+                    *count += std::count(piece.begin(), piece.end(), '\n');
+                    return write_paced(body, piece);
+                  })
+    .then([body, count, range_count] (pplx::task<void> scan) {
+        try {
+          scan.get();
+        }
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Export failed: " << e.what();
+          return close_body(body, std::current_exception());
+        }
+        log_info(log_category::request) << "Exported " << count->load() << " entities from "
+                                        << range_count << " ranges";
+        return close_body(body);
+      });
+}
+
+/*
+  Code for ReadEntityAdmin/<table>[/<partition>/<row>]
+
+  Reads one entity, every entity of a partition (row "*"), or a whole
+  table, optionally matching a filter parameter or the properties of
+  a JSON body.
+ */
+void handle_read_entity_admin (http_request message, const route_path& route, const request_body& content) {
+  const string table_name {route[1]};
+  json_body_status body_status {json_body_status::ok};
+  unordered_map<string,string> json_body {get_json_body (content, &body_status)};
+  if (reply_body_error(message, body_status))
+    return;
+
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  // Scans return everything at once unless the client asked for pages
+  pair<status_code,page_params> page {get_page_params(message)};
+  if (page.first != status_codes::OK) {
+    message.reply(page.first);
+    return;
+  }
+
+  // Reads return every property unless the client selected some
+  vector<string> select_columns {get_select_columns(message)};
+
+  /*
+    Scan for the entities matching the filter parameter, a filter
+    expression (see FilterExpr.h). Storage applies as much of it as
+    fits in a filter and this server tests the rest as entities
+    stream past. Malformed expressions get BadRequest.
+   */
+  auto query_params = uri::split_query(message.relative_uri().query());
+  auto filter_text = query_params.find(filter_param);
+  if (route.size() == 2 && filter_text != query_params.end()) {
+    compiled_filter compiled {};
+    string error {};
+    if (json_body.size() > 0)
+      error = "filter and property match are exclusive";
+    if ( ! error.empty() ||
+        ! compile_filter(uri::decode(filter_text->second), max_filter_comparisons, compiled, error)) {
+      log_info(log_category::request) << "Bad filter: " << error;
+      message.reply(status_codes::BadRequest);
+      return;
+    }
+    log_debug(log_category::request) << "Storage filter: " << compiled.storage_filter;
+
+    table_query query {};
+    if ( ! compiled.storage_filter.empty())
+      query.set_filter_string(compiled.storage_filter);
+
+    // The residual test needs its properties even if not selected
+    vector<string> returned {};
+    if (select_columns.size() > 0) {
+      vector<string> fetched {select_columns};
+      for (const auto& name : compiled.residual_properties) {
+        if (std::find(fetched.begin(), fetched.end(), name) == fetched.end())
+          fetched.push_back(name);
+      }
+      if (fetched.size() > select_columns.size())
+        returned = select_columns;
+      query.set_select_columns(fetched);
+    }
+
+    if (page.second.paged)
+      reply_query_page(message, table, query, page.second, status_codes::OK, compiled.residual, returned);
     else
-      message.reply(code);
+      reply_query_streamed(message, table, query, nullptr, nullptr, compiled.residual, returned);
+    return;
+  }
+
+  /*
+    Code for Operation 2
+
+    Get entities containing properties specific to the ones in the body
+    Size of the path is 2
+  */
+  if (route.size() == 2 && json_body.size() > 0) {
+    /*
+      Only entities holding every requested property match. Storage
+      tests as many properties as fit in one filter and this server
+      tests the rest. Matching entities are returned whole unless the
+      client selected some properties.
+     */
+    const size_t max_filtered {max_filter_comparisons / property_filter_comparisons};
+    size_t filtered {0};
+    vector<string> unfiltered;      // Beyond what one filter can test, so checked here
+    string filter;
+    for (const auto& prop : json_body) {
+      if (filtered == max_filtered) {
+        unfiltered.push_back(prop.first);
+        continue;
+      }
+      string condition {has_property_filter(prop.first)};
+      if (filter.empty())
+        filter = condition;
+      else
+        filter = table_query::combine_filter_conditions(filter,
+                                                        azure::storage::query_logical_operator::op_and,
+                                                        condition);
+      ++filtered;
+    }
+
+    // The server-side test needs its properties even if not selected
+    vector<string> returned {select_columns};
+    table_query query {};
+    query.set_filter_string(filter);
+    if (select_columns.size() > 0) {
+      vector<string> fetched {select_columns};
+      for (const auto& name : unfiltered) {
+        if (std::find(fetched.begin(), fetched.end(), name) == fetched.end())
+          fetched.push_back(name);
+      }
+      query.set_select_columns(fetched);
+    }
+
+    if (page.second.paged) {
+      reply_query_page(message, table, query, page.second, status_codes::NotFound,
+                       [unfiltered] (const table_entity& entity) { return has_properties(entity, unfiltered); },
+                       returned);
+      return;
+    }
+
+    // The reply, built as segments arrive
+    struct match_reply {
+      string body;
+      size_t found;
+    };
+    auto reply = std::make_shared<match_reply>(match_reply {"[", 0});
+    for_each_segment_async(table, query, [reply, unfiltered, returned] (const table_query_segment& segment) {
+        for (const auto& entity : segment.results()) {
+          if ( ! has_properties(entity, unfiltered))
+            continue;
+          log_debug(log_category::entity) << "GET: " << entity.partition_key() << " / " << entity.row_key();
+          if (reply->found > 0)
+            reply->body += ",";
+          append_entity_json(reply->body, entity, returned);
+          ++reply->found;
+        }
+      })
+      .then([message, reply, table_name] (pplx::task<void> scan) {
+        try {
+          scan.get();
+
+          // If nothing was found return NotFound and an empty body
+          if (reply->found == 0) {
+            message.reply(status_codes::NotFound, value::array());
+            return;
+          }
+
+          // If something was found return OK with entities in a body
+          reply->body += "]";
+          message.reply(status_codes::OK, reply->body, "application/json");
+        }
+        catch (const storage_exception& e) {
+          // Storage rejects property names that cannot appear in a filter
+          log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+          note_storage_error(table_name, e);
+          if (e.result().http_status_code() == status_codes::BadRequest ||
+              e.result().http_status_code() == status_codes::NotFound)
+            message.reply(e.result().http_status_code());
+          else
+            message.reply(status_codes::InternalError);
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+    return;
+  }
+
+  // GET all entries in table
+  if (route.size() == 2) {
+    table_query query {};
+    if (select_columns.size() > 0)
+      query.set_select_columns(select_columns);
+    if (page.second.paged) {
+      reply_query_page(message, table, query, page.second, status_codes::OK);
+      return;
+    }
+    ScanFlights::joined scan {scan_flights.join(table_name, scan_key("table", string {}, select_columns))};
+    if ( ! scan.leads) {
+      log_debug(log_category::cache) << "Following a scan in progress";
+      scan.flight->follow(message, scan.follower_id);
+      return;
+    }
+    reply_query_streamed(message, table, query,
+                         std::make_shared<MissCache::scan_recorder>(miss_cache, table_name, string {}, true),
+                         std::make_shared<ScanFlights::lead>(scan_flights, table_name,
+                                                             scan_key("table", string {}, select_columns),
+                                                             scan.flight));
+    return;
+  }
+
+  // GET specific entry: Partition == route[2], Row == route[3]
+  if (route.size() != 4) {
+    message.reply (status_codes::BadRequest);
+    return;
+  }
+  const string partition {route[2]};
+  const string row {route[3]};
+
+  /*
+    Code for Operation 1
+
+    GET all entities from a specific partition
+    Size of the path is 4
+
+    Note that Ted's code above this makes sure there are 4 parameters
+    If the row is '*' it will get all entities within the specified partition
+    If the row is not '*' it will skip this and go to Teds code where it will get all entities with the specified partition and row
+  */
+  if( row == "*" ) {
+      // Let storage select the partition so the scan only touches its entities
+      table_query query {};
+      query.set_filter_string(table_query::generate_filter_condition("PartitionKey",
+                                                                     azure::storage::query_comparison_operator::equal,
+                                                                     partition));
+      if (select_columns.size() > 0)
+        query.set_select_columns(select_columns);
+
+      if (page.second.token.empty() && miss_cache.partition_known_missing(table_name, partition)) {
+        log_debug(log_category::cache) << "Partition " << partition << " known to be empty";
+        message.reply(status_codes::NotFound, value::array());
+        return;
+      }
+
+      if (page.second.paged) {
+        reply_query_page(message, table, query, page.second, status_codes::NotFound);
+        return;
+      }
+
+      const string key {scan_key("partition", partition, select_columns)};
+      ScanFlights::joined scan {scan_flights.join(table_name, key)};
+      if ( ! scan.leads) {
+        log_debug(log_category::cache) << "Following a scan in progress";
+        scan.flight->follow(message, scan.follower_id);
+        return;
+      }
+      auto lead = std::make_shared<ScanFlights::lead>(scan_flights, table_name, key, scan.flight);
+      auto recorder = std::make_shared<MissCache::scan_recorder>(miss_cache, table_name, partition, false);
+      // The reply, built as segments arrive
+      struct partition_reply {
+        string body;
+        size_t count;
+      };
+      auto reply = std::make_shared<partition_reply>(partition_reply {"[", 0});
+      for_each_segment_async(table, query, [recorder, reply] (const table_query_segment& segment) {
+          for (const auto& entity : segment.results()) {
+            log_debug(log_category::entity) << "GET: " << entity.partition_key() << " / " << entity.row_key();
+            recorder->add(entity.partition_key(), entity.row_key());
+            if (reply->count > 0)
+              reply->body += ",";
+            append_entity_json(reply->body, entity);
+            ++reply->count;
+          }
+        })
+        .then([message, lead, recorder, reply, table_name, partition] (pplx::task<void> scan) {
+          try {
+            scan.get();
+            recorder->finish();
+            log_info(log_category::request) << "Partition " << partition << ": " << reply->count << " entities returned by storage";
+
+            // If nothing was found return NotFound and an empty body
+            // If something was found return OK with entities in a body
+            status_code found_status {reply->count == 0 ? status_codes::NotFound : status_codes::OK};
+            reply->body += "]";
+            lead->flight().seal(found_status);
+            lead->flight().append(reply->body);
+            lead->flight().finish();
+            message.reply(found_status, reply->body, "application/json");
+          }
+          catch (const storage_exception& e) {
+            log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+            note_storage_error(table_name, e);
+            if (e.result().http_status_code() == status_codes::NotFound) {
+              // The followers get the same answer
+              lead->flight().seal(status_codes::NotFound);
+              lead->flight().finish();
+              message.reply(status_codes::NotFound);
+            }
+            else {
+              // The lead fails the followers as it goes
+              message.reply(status_codes::InternalError);
+            }
+          }
+          catch (const std::exception& e) {
+            reply_failed(message, e);
+          }
+        });
+      return;
+  }
+
+  table_entity entity {};
+  if (entity_cache.lookup(table_name, partition, row, entity)) {
+    log_debug(log_category::cache) << "Entity cache hit";
+    if (select_columns.size() > 0)
+      entity.properties() = select_properties(entity.properties(), select_columns);
+  }
+  else if (miss_cache.known_missing(table_name, partition, row)) {
+    log_debug(log_category::cache) << "Entity known to be missing";
+    message.reply(status_codes::NotFound);
+    return;
+  }
+  else if (select_columns.size() > 0) {
+    /*
+      A retrieve always returns the whole entity, so a projected
+      point read is a query for the single key with a column selection
+     */
+    table_query query {};
+    query.set_filter_string(entity_key_filter(partition, row));
+    query.set_select_columns(select_columns);
+    query.set_take_count(1);
+    uint64_t miss_generation {miss_cache.generation()};
+    first_found_async(table, query)
+      .then([message, table_name, partition, row, miss_generation] (pplx::task<vector<table_entity>> read) {
+        try {
+          vector<table_entity> found {read.get()};
+          if (found.size() == 0) {
+            miss_cache.remember_miss(table_name, partition, row, miss_generation);
+            message.reply(status_codes::NotFound);
+            return;
+          }
+          reply_entity(message, found[0]);
+        }
+        catch (const storage_exception& e) {
+          log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+          note_storage_error(table_name, e);
+          if (e.result().http_status_code() == status_codes::NotFound)
+            message.reply(status_codes::NotFound);
+          else
+            message.reply(status_codes::InternalError);
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+    return;
   }
   else {
+    // Reply from the continuation, so no thread waits on storage
+    uint64_t generation {entity_cache.generation()};
+    uint64_t miss_generation {miss_cache.generation()};
+    table.execute_async(table_operation::retrieve_entity(partition, row))
+      .then([message, table, table_name, partition, row, generation, miss_generation]
+            (pplx::task<table_result> retrieve) {
+        try {
+          table_result retrieve_result {retrieve.get()};
+          log_info(log_category::request) << "HTTP code: " << retrieve_result.http_status_code();
+          if (retrieve_result.http_status_code() == status_codes::NotFound) {
+            miss_cache.remember_miss(table_name, partition, row, miss_generation);
+            message.reply(status_codes::NotFound);
+            return;
+          }
+          table_entity found {retrieve_result.entity()};
+          entity_cache.insert(table_name, found, generation);
+          reply_entity(message, found);
+        }
+        catch (const storage_exception& e) {
+          log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+          note_storage_error(table_name, e);
+          if (e.result().http_status_code() == status_codes::NotFound)
+            message.reply(status_codes::NotFound);
+          else
+            message.reply(status_codes::InternalError);
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+    return;
+  }
+
+  reply_entity(message, entity);
+  return;
+}
+
+/*
+  Code for Assign2 Operation 1
+
+  ReadEntityAuth/<table>/<token>/<partition>/<row>
+ */
+void handle_read_entity_auth (http_request message, const route_path& route) {
+  // Parameter checking done by ServerUtils
+  const string table_name {route[1]};
+
+  /*
+    A cached copy may only be served to a token that storage has
+    recently accepted for this very entity. Paths of any other length
+    are refused by read_with_token.
+   */
+  const bool whole_key {route.size() == 5};
+  const string token {whole_key ? route[2] : string {}};
+  const string partition {whole_key ? route[3] : string {}};
+  const string row {whole_key ? route[4] : string {}};
+  table_entity cached {};
+  if (whole_key &&
+      entity_cache.has_grant(token, table_name, partition, row) &&
+      entity_cache.lookup(table_name, partition, row, cached)) {
+    log_debug(log_category::cache) << "Entity cache hit";
+    reply_entity(message, cached);
+    return;
+  }
+
+  // Use function Ted made in ServerUtils.cpp, replying from its continuation
+  uint64_t generation {entity_cache.generation()};
+  read_with_token(message, tables_endpoint)
+    .then([message, table_name, token, partition, row, generation] (pair<status_code,table_entity> result) {
+      try {
+        // read_with_token only returns OK as status_code if an entity was found with the given partition and row name
+        if (result.first != status_codes::OK) {
+          message.reply(result.first);
+          return;
+        }
+        entity_cache.insert(table_name, result.second, generation);
+        entity_cache.remember_grant(token, table_name, partition, row);
+        reply_entity(message, result.second);
+      }
+      catch (const std::exception& e) {
+        reply_failed(message, e);
+      }
+    });
+}
+
+/*
+  Report the counters of the imports in progress
+ */
+void handle_get_imports (http_request message, const route_path&) {
+  value reply {value::object()};
+  scoped_critical_section_t lock {imports_lock};
+  for (const auto& import : imports) {
+    reply[import.first] = value::object(vector<pair<string,value>> {
+        make_pair("Table", value::string(import.second->table_name)),
+        make_pair("Lines", value::number(import.second->lines.load())),
+        make_pair("Imported", value::number(import.second->imported.load())),
+        make_pair("Failed", value::number(import.second->failed.load())),
+        make_pair("Rejected", value::number(import.second->rejected.load()))
+      });
+  }
+  message.reply(status_codes::OK, reply);
+  return;
+}
+
+/*
+  Report entity and miss cache counters
+ */
+void handle_get_cache_stats (http_request message, const route_path&) {
+  EntityCache::stats_t stats {entity_cache.stats()};
+  MissCache::stats_t miss_stats {miss_cache.stats()};
+  message.reply(status_codes::OK, value::object(vector<pair<string,value>> {
+        make_pair("Hits", value::number(stats.hits)),
+        make_pair("Misses", value::number(stats.misses)),
+        make_pair("Evictions", value::number(stats.evictions)),
+        make_pair("Entries", value::number(stats.entries)),
+        make_pair("Bytes", value::number(stats.bytes)),
+        make_pair("CapacityBytes", value::number(stats.capacity_bytes)),
+        make_pair("NegativeEntries", value::number(miss_stats.negative_entries)),
+        make_pair("NegativeHits", value::number(miss_stats.negative_hits)),
+        make_pair("KeyFilters", value::number(miss_stats.row_filters)),
+        make_pair("KeyFilterHits", value::number(miss_stats.filter_hits)),
+        make_pair("CoalescedScans", value::number(scan_flights.coalesced_count())),
+        make_pair("Merges", value::number(write_behind.merge_count())),
+        make_pair("CoalescedMerges", value::number(write_behind.coalesced_count())),
+        make_pair("SkippedWrites", value::number(skipped_writes.load()))
+      }));
+  return;
+}
+
+/*
+  Adapt handler to first write out the merges pending in write_behind
+  that the request could observe
+ */
+route_handler settled (route_handler handler) {
+  return [handler] (http_request message, const route_path& route) {
+    settle_pending_writes(route);
+    handler(message, route);
+  };
+}
+
+/*
+  Adapt handler to run only if table route[1] exists, replying
+  NotFound if it does not. A table known to exist is handled at once;
+  otherwise storage is asked and the handler runs from the
+  continuation, so no thread waits for the answer.
+ */
+route_handler if_table_exists (route_handler handler) {
+  return [handler] (http_request message, const route_path& route) {
+    const string table_name {route[1]};
+    if (table_cache.known_exists(table_name)) {
+      handler(message, route);
+      return;
+    }
+    table_cache.table_exists_async(table_name)
+      .then([handler, message, table_name] (pplx::task<bool> exists) {
+          try {
+            if ( ! exists.get()) {
+              log_info(log_category::request) << "Table does not exist";
+              message.reply(status_codes::NotFound);
+              return;
+            }
+            // The route viewed the caller's path; take it from message
+            handler(message, route_path {message.request_uri().path()});
+          }
+          catch (const storage_exception& e) {
+            log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+            note_storage_error(table_name, e);
+            message.reply(status_codes::InternalError);
+          }
+          catch (const std::exception& e) {
+            reply_failed(message, e);
+          }
+        });
+  };
+}
+
+const route_table get_routes {vector<route> {
+    {read_entity_admin, 2, 4, settled(if_table_exists(with_json_body(handle_read_entity_admin)))},
+    {read_entity_auth, 2, route_path::max_segments, settled(if_table_exists(handle_read_entity_auth))},
+    {export_entities_admin, 2, 2, settled(if_table_exists(export_entities))},
+    {read_entities_admin, 2, 2, settled(if_table_exists(with_json_body(read_entities)))},
+    {get_imports_admin, 1, route_path::max_segments, handle_get_imports},
+    {get_cache_stats_admin, 1, route_path::max_segments, handle_get_cache_stats}
+  }};
+
+/*
+  Top-level routine for processing all HTTP GET requests.
+
+  GET is the only request that has no command. All
+  operands specify the value(s) to be retrieved.
+ */
+void handle_get(http_request message) { 
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** GET " << path;
+  get_routes.dispatch(message, route_path {path});
+}
+
+/*
+  Create table route[1] (idempotent if table exists)
+ */
+void handle_create_table (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+  log_info(log_category::request) << "Create " << table_name;
+  table.create_if_not_exists_async()
+    .then([message, table, table_name] (pplx::task<bool> create) {
+      try {
+        bool created {create.get()};
+        table_cache.mark_exists(table_name);
+        log_info(log_category::server) << "Administrative table URI " << table.uri().primary_uri().to_string();
+        if (created)
+          message.reply(status_codes::Created);
+        else
+          message.reply(status_codes::Accepted);
+      }
+      catch (const std::exception& e) {
+        reply_failed(message, e);
+      }
+    });
+}
+
+const route_table post_routes {vector<route> {
+    {create_table, 2, route_path::max_segments, handle_create_table}
+  }};
+
+/*
+  Top-level routine for processing all HTTP POST requests.
+ */
+void handle_post(http_request message) {
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** POST " << path;
+  post_routes.dispatch(message, route_path {path});
+}
+
+/*
+  Build entity from a JSON object naming it with Partition and Row.
+  The other fields become properties, typed by json_to_property().
+
+  Returns false if element is not such an object.
+ */
+bool entity_from_json (const value& element, table_entity& entity) {
+  if ( ! element.is_object() ||
+       ! element.has_field("Partition") || ! element.at("Partition").is_string() ||
+       ! element.has_field("Row") || ! element.at("Row").is_string())
+    return false;
+
+  entity = table_entity {element.at("Partition").as_string(), element.at("Row").as_string()};
+  table_entity::properties_type& properties = entity.properties();
+  for (const auto& v : element.as_object()) {
+    if (v.first == "Partition" || v.first == "Row")
+      continue;
+    properties[v.first] = json_to_property(v.second);
+  }
+  return true;
+}
+
+/*
+  Code for BatchUpdateEntityAdmin/<table>
+
+  The body is a JSON array of objects, each naming an entity with
+  Partition and Row and giving the properties to insert or merge.
+  Entities are written as storage batches (see TableBatcher.h).
+
+  Replies OK with an array holding, for each element of the body in
+  order, an object with its Partition, Row, and the Status of its
+  write. An element without both keys gets Status BadRequest and is
+  not written. A body longer than max_json_body gets
+  RequestEntityTooLarge.
+ */
+void batch_update_entities (http_request message, const route_path& route, const request_body& content) {
+  const string table_name {route[1]};
+  value body {};
+  if (reply_body_error(message, read_json_value(content, body)))
+    return;
+  if ( ! body.is_array()) {
     message.reply(status_codes::BadRequest);
+    return;
+  }
+
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  const web::json::array& elements = body.as_array();
+  vector<value> results (elements.size());
+  vector<table_entity> entities {};
+  vector<size_t> result_index {};
+  for (size_t i = 0; i < elements.size(); ++i) {
+    table_entity entity {};
+    if ( ! entity_from_json(elements.at(i), entity)) {
+      results[i] = value::object(vector<pair<string,value>> {
+          make_pair("Status", value::number(status_codes::BadRequest))});
+      continue;
+    }
+    entities.push_back(entity);
+    result_index.push_back(i);
+  }
+
+  log_info(log_category::request) << "Batch update of " << entities.size() << " entities";
+  vector<pair<string,string>> keys {};
+  for (const auto& entity : entities) {
+    keys.push_back(make_pair(entity.partition_key(), entity.row_key()));
+  }
+
+  // Reply from a continuation, so no thread waits on storage
+  execute_in_batches_async(table, std::move(entities), batch_write::insert_or_merge,
+                           batch_update_partitions_in_flight)
+    .then([message, table_name, keys, result_index, results] (pplx::task<vector<status_code>> written) mutable {
+        try {
+          vector<status_code> statuses {written.get()};
+          for (size_t e = 0; e < keys.size(); ++e) {
+            // A failed write may still have reached storage
+            note_entity_write(table_name, keys[e].first, keys[e].second);
+            note_write_status(table_name, statuses[e]);
+            results[result_index[e]] = value::object(vector<pair<string,value>> {
+                make_pair("Partition", value::string(keys[e].first)),
+                make_pair("Row", value::string(keys[e].second)),
+                make_pair("Status", value::number(statuses[e]))});
+          }
+          message.reply(status_codes::OK, value::array(results));
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+}
+
+/*
+  An ImportEntitiesAdmin request, shared by the continuations that
+  read its body. line holds the part of the current line read so
+  far, unless it has grown past max_import_line (overlong).
+ */
+struct import_run {
+  http_request message;
+  string import_id;
+  std::shared_ptr<import_progress> progress;
+  std::shared_ptr<BatchWriter> writer;
+  concurrency::streams::istream body;
+  vector<value> errors;
+  uint64_t line_number {0};
+  string line;
+  bool overlong {false};
+};
+
+void reject_line (import_run& run, const string& reason) {
+  ++run.progress->rejected;
+  if (run.errors.size() < max_import_errors)
+    run.errors.push_back(value::string("line " + std::to_string(run.line_number) + ": " + reason));
+}
+
+/*
+  Import the line of run just ended: hand its entity to the writer,
+  or reject it
+ */
+void end_import_line (import_run& run) {
+  string& line = run.line;
+  if (run.overlong) {
+    ++run.progress->lines;
+    reject_line(run, "line too long");
+    run.overlong = false;
+    return;
   }
+  if ( ! line.empty() && line.back() == '\r')
+    line.pop_back();
+  if (line.find_first_not_of(" \t") == string::npos)
+    return;
+  ++run.progress->lines;
+  table_entity entity {};
+  try {
+    if ( ! entity_from_json(value::parse(line), entity)) {
+      reject_line(run, "not an object with Partition and Row");
+      return;
+    }
+  }
+  catch (const std::exception& e) {
+    reject_line(run, e.what());
+    return;
+  }
+  run.writer->add(entity);
+}
+
+/*
+  Import the lines ended in bytes, the next block of the body of run,
+  keeping the start of any line it leaves unfinished
+ */
+void import_block (import_run& run, const vector<uint8_t>& bytes) {
+  auto start = bytes.begin();
+  for (;;) {
+    auto newline = std::find(start, bytes.end(), '\n');
+    if ( ! run.overlong)
+      run.line.append(start, newline);
+    if (run.line.size() > max_import_line && ! run.overlong) {
+      run.overlong = true;
+      run.line.clear();
+    }
+    if (newline == bytes.end())
+      break;
+    ++run.line_number;
+    end_import_line(run);
+    run.line.clear();
+    start = newline + 1;
+  }
+}
+
+/*
+  Read the body of run a block at a time to its end, importing each
+  block's lines. The next block is read only once the writer has no
+  batch waiting to start, so a client that sends faster than storage
+  takes the writes is held back rather than buffered.
+ */
+pplx::task<void> import_blocks (std::shared_ptr<import_run> run) {
+  container_buffer<vector<uint8_t>> block {};
+  return run->body.read(block, import_read_bytes)
+    .then([run, block] (size_t count) mutable {
+        if (count == 0) {
+          ++run->line_number;
+          end_import_line(*run);
+          return pplx::task_from_result();
+        }
+        import_block(*run, block.collection());
+        return run->writer->room()
+          .then([run] {
+              return import_blocks(run);
+            });
+      });
+}
+
+/*
+  Code for ImportEntitiesAdmin/<table>
+
+  The body is newline-delimited JSON: one object per line, naming an
+  entity with Partition and Row as in BatchUpdateEntityAdmin. Blank
+  lines are ignored. The body is read a block at a time as it
+  arrives and the entities are written by a BatchWriter, so memory
+  use does not grow with the size of the import. Reads and writes
+  run as task continuations, so no thread waits on the client or on
+  storage.
+
+  Lines that are not such objects, or longer than max_import_line,
+  are rejected and the import carries on. GetImportsAdmin shows the
+  counters of imports in progress.
+
+  Replies with the final counters and the first few errors: OK if
+  the whole body was read, InternalError if reading it failed.
+ */
+void import_entities (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  auto run = std::make_shared<import_run>();
+  run->message = message;
+  run->body = message.body();
+  run->progress = std::make_shared<import_progress>();
+  run->progress->table_name = table_name;
+  {
+    scoped_critical_section_t lock {imports_lock};
+    run->import_id = table_name + "#" + std::to_string(++next_import_id);
+    imports[run->import_id] = run->progress;
+  }
+  log_info(log_category::request) << "Import " << run->import_id << " started";
+
+  std::shared_ptr<import_progress> progress {run->progress};
+  run->writer = std::make_shared<BatchWriter>(table, batch_write::insert_or_merge, import_batches_in_flight,
+      [progress, table_name] (const table_entity& entity, status_code status) {
+        note_entity_write(table_name, entity.partition_key(), entity.row_key());
+        note_write_status(table_name, status);
+        if (status == status_codes::OK)
+          ++progress->imported;
+        else
+          ++progress->failed;
+      });
+
+  import_blocks(run)
+    .then([run] (pplx::task<void> read) {
+        status_code status {status_codes::OK};
+        try {
+          read.get();
+        }
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Import read error: " << e.what();
+          status = status_codes::InternalError;
+        }
+        return run->writer->flush()
+          .then([run, status] {
+              {
+                scoped_critical_section_t lock {imports_lock};
+                imports.erase(run->import_id);
+              }
+              const import_progress& progress = *run->progress;
+              log_info(log_category::request) << "Import " << run->import_id << ": " << progress.imported
+                                              << " imported, " << progress.failed << " failed, "
+                                              << progress.rejected << " rejected";
+              run->message.reply(status, value::object(vector<pair<string,value>> {
+                    make_pair("Import", value::string(run->import_id)),
+                    make_pair("Lines", value::number(progress.lines.load())),
+                    make_pair("Imported", value::number(progress.imported.load())),
+                    make_pair("Failed", value::number(progress.failed.load())),
+                    make_pair("Rejected", value::number(progress.rejected.load())),
+                    make_pair("Errors", value::array(run->errors))
+                  }));
+            });
+      })
+    .then([message] (pplx::task<void> done) {
+        try {
+          done.get();
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+}
+
+/*
+  Entities written and failed so far by the BatchWriter of a request
+ */
+struct write_counts {
+  std::atomic<uint64_t> written {0};
+  std::atomic<uint64_t> failed {0};
+};
+
+/*
+  An AddPropertyAdmin or UpdatePropertyAdmin request, shared by the
+  continuations of its scans. Each pass is a filter (empty for every
+  entity) and the properties to merge into the entities it matches.
+ */
+struct property_run {
+  http_request message;
+  string operation;
+  cloud_table table;
+  string table_name;
+  vector<pair<string,table_entity::properties_type>> passes;
+  std::shared_ptr<BatchWriter> writer;
+  std::shared_ptr<write_counts> counts;
+};
+
+/*
+  Run the passes of run from p on, one after another. Each scans for
+  keys only, a segment at a time, handing the merges to the writer;
+  the next segment is fetched once the writer has room for more.
+ */
+pplx::task<void> run_property_pass (std::shared_ptr<property_run> run, size_t p) {
+  if (p >= run->passes.size())
+    return pplx::task_from_result();
+  table_query query {};
+  if ( ! run->passes[p].first.empty())
+    query.set_filter_string(run->passes[p].first);
+  query.set_select_columns(vector<string> {"PartitionKey", "RowKey"});
+  return for_each_segment_paced(run->table, query,
+      [run, p] (const table_query_segment& segment) {
+        for (const auto& found : segment.results()) {
+          table_entity entity {found.partition_key(), found.row_key()};
+          entity.properties() = run->passes[p].second;
+          run->writer->add(entity);
+        }
+        return run->writer->room();
+      })
+    .then([run, p] {
+        return run_property_pass(run, p + 1);
+      });
+}
+
+/*
+  Code for AddPropertyAdmin/<table> and UpdatePropertyAdmin/<table>
+
+  The body is a JSON object of properties. AddPropertyAdmin sets them
+  on every entity of the table; UpdatePropertyAdmin sets each one only
+  on the entities that already have it.
+
+  The table is scanned for keys only, a segment at a time, and the
+  merges go to a BatchWriter, so partitions are written in parallel
+  batches with at most property_batches_in_flight at once. Scans and
+  writes run as task continuations, and the reply is sent from the
+  last of them. A merge never recreates an entity deleted since the
+  scan saw it.
+
+  Replies with the number of entities Touched (merged) and Failed:
+  OK if the scan completed, InternalError if it did not.
+ */
+void set_property_everywhere (http_request message, const route_path& route, const request_body& content,
+                              bool only_existing) {
+  table_entity::properties_type json_body {};
+  if (reply_body_error(message, get_json_properties (content, json_body)))
+    return;
+  if (json_body.size() == 0) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+
+  const string table_name {route[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  auto run = std::make_shared<property_run>();
+  run->message = message;
+  run->operation = route[0];
+  run->table = table;
+  run->table_name = table_name;
+  std::shared_ptr<write_counts> counts {std::make_shared<write_counts>()};
+  run->counts = counts;
+  run->writer = std::make_shared<BatchWriter>(table, batch_write::merge, property_batches_in_flight,
+      [counts, table_name] (const table_entity& entity, status_code status) {
+        note_entity_write(table_name, entity.partition_key(), entity.row_key());
+        if (status == status_codes::OK)
+          ++counts->written;
+        else
+          ++counts->failed;
+      });
+
+  /*
+    AddPropertyAdmin is one scan of every entity. UpdatePropertyAdmin
+    scans, for each property, the entities that have it.
+   */
+  if (only_existing) {
+    for (const auto& prop : json_body) {
+      table_entity::properties_type only {};
+      only.insert(prop);
+      run->passes.push_back(make_pair(has_property_filter(prop.first), only));
+    }
+  }
+  else {
+    run->passes.push_back(make_pair(string {}, json_body));
+  }
+
+  run_property_pass(run, 0)
+    .then([run] (pplx::task<void> scan) {
+        status_code status {status_codes::OK};
+        try {
+          scan.get();
+        }
+        catch (const storage_exception& e) {
+          log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+          note_storage_error(run->table_name, e);
+          status = status_codes::InternalError;
+        }
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Property scan failed: " << e.what();
+          status = status_codes::InternalError;
+        }
+        return run->writer->flush()
+          .then([run, status] {
+              const write_counts& counts = *run->counts;
+              log_info(log_category::request) << run->operation << " touched " << counts.written << " entities, "
+                                              << counts.failed << " failed";
+              run->message.reply(status, value::object(vector<pair<string,value>> {
+                    make_pair("Touched", value::number(counts.written.load())),
+                    make_pair("Failed", value::number(counts.failed.load()))
+                  }));
+            });
+      })
+    .then([message] (pplx::task<void> done) {
+        try {
+          done.get();
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+}
+
+/*
+  Code for UpdateEntityAdmin/<table>/<partition>/<row> and
+  UpdateEntityAuth/<table>/<token>/<partition>/<row>
+
+  Merges the properties of the JSON body into the entity.
+ */
+void update_entity (http_request message, const route_path& route, const request_body& content) {
+  const string table_name {route[1]};
+  table_entity::properties_type json_body {};
+  if (reply_body_error(message, get_json_properties (content, json_body)))
+    return;
+
+  cloud_table table {table_cache.lookup_table(table_name)};
+
+  /*
+    Coded for Assign2 Operation 2
+    
+    Check if command is for auth access
+    Uses Teds code in ServerUtils to update
+    Return
+  */
+  // If command was UpdateEntityAuth
+  if (route.equals(0, update_entity_auth)) {
+    // The entity follows the token; update_with_token refuses paths of any other length
+    const bool whole_key {route.size() == 5};
+    const string partition {whole_key ? route[3] : string {}};
+    const string row {whole_key ? route[4] : string {}};
+    update_with_token(message, tables_endpoint, json_body)
+      .then([message, table_name, whole_key, partition, row] (status_code status) {
+        try {
+          if (whole_key)
+            note_entity_write(table_name, partition, row);
+          message.reply(status);
+        }
+        catch (const std::exception& e) {
+          reply_failed(message, e);
+        }
+      });
+    return;
+  }  
+
+  const string partition {route[2]};
+  const string row {route[3]};
+  table_entity entity {partition, row};
+
+  // Update entity
+  try {
+    if (route.equals(0, update_entity_admin)) {
+      log_debug(log_category::entity) << "Update " << entity.partition_key() << " / " << entity.row_key();
+      table_entity::properties_type& properties = entity.properties();
+      properties = json_body;
+
+      if (merge_is_noop(table_name, partition, row, properties)) {
+        log_debug(log_category::request) << "Update changes nothing, not written";
+        ++skipped_writes;
+        http_response response {status_codes::OK};
+        response.headers().add(write_skipped_header, "true");
+        message.reply(response);
+        return;
+      }
+
+      /*
+        With write-behind on, the merge waits to be coalesced and is
+        acknowledged at once, unless the client asked for sync, in
+        which case it is written now and its status returned
+       */
+      if (write_behind.enabled()) {
+        pplx::task<status_code> written {write_behind.merge(table, table_name, partition, row, properties)};
+        auto query = uri::split_query(message.relative_uri().query());
+        auto sync = query.find(sync_param);
+        if (sync == query.end() || uri::decode(sync->second) != "true") {
+          message.reply(status_codes::OK);
+          return;
+        }
+        write_behind.flush_entity(table_name, partition, row);
+        status_code status {written.get()};
+        if (status == status_codes::OK || status == status_codes::NotFound)
+          message.reply(status);
+        else
+          message.reply(status_codes::InternalError);
+        return;
+      }
+
+      // Reply from the continuation, so no thread waits on storage
+      table.execute_async(table_operation::insert_or_merge_entity(entity))
+        .then([message, table, table_name, partition, row] (pplx::task<table_result> write) {
+          try {
+            write.get();
+            note_entity_write(table_name, partition, row);
+            message.reply(status_codes::OK);
+          }
+          catch (const storage_exception& e)
+          {
+            log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+            // The write may still have reached storage
+            note_entity_write(table_name, partition, row);
+            note_storage_error(table_name, e);
+            if (e.result().http_status_code() == status_codes::NotFound)
+              message.reply(status_codes::NotFound);
+            else
+              message.reply(status_codes::InternalError);
+          }
+          catch (const std::exception& e) {
+            note_entity_write(table_name, partition, row);
+            reply_failed(message, e);
+          }
+        });
+    }
+    else {
+      message.reply(status_codes::BadRequest);
+    }
+  }
+  catch (const storage_exception& e)
+  {
+    // The write-behind sync path writes on this thread
+    log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+    note_entity_write(table_name, partition, row);
+    note_storage_error(table_name, e);
+    message.reply(status_codes::InternalError);
+  }
+}
+
+const route_table put_routes {vector<route> {
+    {update_entity_admin, 4, route_path::max_segments, if_table_exists(with_json_body(update_entity))},   // Goes through write_behind
+    {update_entity_auth, 4, route_path::max_segments, settled(if_table_exists(with_json_body(update_entity)))},
+    {batch_update_entity_admin, 2, 2, settled(if_table_exists(with_json_body(batch_update_entities)))},
+    {import_entities_admin, 2, 2, settled(if_table_exists(import_entities))},
+    {add_property_admin, 2, 2, settled(if_table_exists(with_json_body(
+          [] (http_request message, const route_path& route, const request_body& content) {
+            set_property_everywhere(message, route, content, false);
+          })))},
+    {update_property_admin, 2, 2, settled(if_table_exists(with_json_body(
+          [] (http_request message, const route_path& route, const request_body& content) {
+            set_property_everywhere(message, route, content, true);
+          })))}
+  }};
+
+/*
+  Top-level routine for processing all HTTP PUT requests.
+ */
+void handle_put(http_request message) {
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** PUT " << path;
+  put_routes.dispatch(message, route_path {path});
+}
+
+/*
+  Delete every entity of table matching filter (all of them if filter
+  is empty), for DeletePartitionAdmin and TruncateTableAdmin.
+
+  Replies OK at once with a chunked body of newline-delimited JSON
+  progress lines, one per storage segment scanned, holding the
+  Deleted and Failed counts so far. The last line also has Done,
+  true if the scan completed. The scan reads keys only, and the
+  deletes go to a BatchWriter, so partitions are deleted in parallel
+  in batches of up to 100. Scan and deletes run as task
+  continuations; finished is called once the last delete is done.
+ */
+void delete_matching (http_request message, const string& table_name, const cloud_table& table,
+                      const string& filter, std::function<void ()> finished) {
+  producer_consumer_buffer<uint8_t> body {};
+  http_response response {status_codes::OK};
+  response.set_body(body.create_istream(), "application/x-ndjson");
+  message.reply(response);
+
+  std::shared_ptr<write_counts> counts {std::make_shared<write_counts>()};
+  auto progress = [counts] () {
+    return vector<pair<string,value>> {
+      make_pair("Deleted", value::number(counts->written.load())),
+      make_pair("Failed", value::number(counts->failed.load()))
+    };
+  };
+
+  auto writer = std::make_shared<BatchWriter>(table, batch_write::remove, delete_batches_in_flight,
+      [counts, table_name] (const table_entity& entity, status_code status) {
+        note_entity_delete(table_name, entity.partition_key(), entity.row_key());
+        // Already gone counts as deleted
+        if (status == status_codes::OK || status == status_codes::NotFound)
+          ++counts->written;
+        else
+          ++counts->failed;
+      });
+
+  table_query query {};
+  if ( ! filter.empty())
+    query.set_filter_string(filter);
+  query.set_select_columns(vector<string> {"PartitionKey", "RowKey"});
+
+  // The next segment is fetched once the writer has room for its deletes
+  for_each_segment_paced(table, query,
+      [writer, body, progress] (const table_query_segment& segment) {
+        for (const auto& found : segment.results()) {
+          writer->add(table_entity {found.partition_key(), found.row_key()});
+        }
+        return write_chunk(body, value::object(progress()).serialize() + "\n")
+          .then([writer] {
+              return writer->room();
+            });
+      })
+    .then([body, writer, counts, progress, finished] (pplx::task<void> scan) {
+        bool done {true};
+        try {
+          scan.get();
+        }
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Delete scan failed: " << e.what();
+          done = false;
+        }
+        return writer->flush()
+          .then([body, counts, progress, finished, done] {
+              finished();
+              vector<pair<string,value>> last {progress()};
+              last.push_back(make_pair("Done", value::boolean(done)));
+              log_info(log_category::request) << "Deleted " << counts->written << " entities, "
+                                              << counts->failed << " failed";
+              return write_chunk(body, value::object(last).serialize() + "\n");
+            })
+          .then([body] (pplx::task<void> written) {
+              try {
+                written.get();
+              }
+              catch (const std::exception& e) {
+                log_warning(log_category::request) << "Client went away: " << e.what();
+              }
+              return close_body(body);
+            });
+      });
+}
+
+/*
+  Delete table route[1]
+ */
+void handle_delete_table (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+  log_info(log_category::request) << "Delete " << table_name;
+  table.delete_table_async()
+    .then([message, table_name] (pplx::task<void> deletion) {
+      try {
+        deletion.get();
+        entity_cache.invalidate_table(table_name);
+        miss_cache.drop_table(table_name);
+        scan_flights.detach_table(table_name);
+        table_cache.forget_exists(table_name);
+        table_cache.delete_entry(table_name);
+        message.reply(status_codes::OK);
+      }
+      catch (const storage_exception& e) {
+        log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+        note_storage_error(table_name, e);
+        if (e.result().http_status_code() == status_codes::NotFound)
+          message.reply(status_codes::NotFound);
+        else
+          message.reply(status_codes::InternalError);
+      }
+      catch (const std::exception& e) {
+        reply_failed(message, e);
+      }
+    });
+}
+
+/*
+  Delete entity route[2] / route[3] of table route[1]
+ */
+void handle_delete_entity (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+  const string partition {route[2]};
+  const string row {route[3]};
+  table_entity entity {partition, row};
+  log_debug(log_category::entity) << "Delete " << entity.partition_key() << " / " << entity.row_key();
+
+  // Reply from the continuation, so no thread waits on storage
+  table.execute_async(table_operation::delete_entity(entity))
+    .then([message, table, table_name, partition, row] (pplx::task<table_result> op) {
+      int code;
+      try {
+        code = op.get().http_status_code();
+      }
+      catch (const storage_exception& e) {
+        log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+        note_storage_error(table_name, e);
+        code = e.result().http_status_code();
+        if (code == 0)
+          code = status_codes::InternalError;
+      }
+      catch (const std::exception& e) {
+        log_error(log_category::storage) << "Delete failed: " << e.what();
+        code = status_codes::InternalError;
+      }
+      try {
+        note_entity_delete(table_name, partition, row);
+
+        if (code == status_codes::OK || 
+            code == status_codes::NoContent)
+          message.reply(status_codes::OK);
+        else
+          message.reply(code);
+      }
+      catch (const std::exception& e) {
+        reply_failed(message, e);
+      }
+    });
+}
+
+/*
+  Delete every entity of partition route[2] of table route[1]
+ */
+void handle_delete_partition (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  const string partition {route[2]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+  log_info(log_category::request) << "Delete partition " << partition;
+  delete_matching(message, table_name, table,
+                  table_query::generate_filter_condition("PartitionKey",
+                                                         azure::storage::query_comparison_operator::equal,
+                                                         partition),
+                  [table_name, partition] {
+                    miss_cache.drop_partition(table_name, partition);
+                  });
+}
+
+/*
+  Delete every entity of table route[1], keeping the table
+ */
+void handle_truncate_table (http_request message, const route_path& route) {
+  const string table_name {route[1]};
+  cloud_table table {table_cache.lookup_table(table_name)};
+  log_info(log_category::request) << "Truncate " << table_name;
+  delete_matching(message, table_name, table, string {},
+                  [table_name] {
+                    miss_cache.drop_table(table_name);
+                  });
+}
+
+const route_table delete_routes {vector<route> {
+    {delete_table, 2, route_path::max_segments, settled(if_table_exists(handle_delete_table))},
+    {delete_entity_admin, 4, route_path::max_segments, settled(handle_delete_entity)},
+    {delete_partition_admin, 3, 3, settled(if_table_exists(handle_delete_partition))},
+    {truncate_table_admin, 2, 2, settled(if_table_exists(handle_truncate_table))}
+  }};
+
+/*
+  Top-level routine for processing all HTTP DELETE requests.
+ */
+void handle_delete(http_request message) {
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** DELETE " << path;
+  delete_routes.dispatch(message, route_path {path});
 }
 
 /*
@@ -551,12 +2685,60 @@ void handle_delete(http_request message) {
   which processes each request asynchronously.
   
   Wait for a carriage return, then shut the server down.
+
+  Options:
+    --entity-cache-bytes N  Capacity of the entity cache (0 disables it)
+    --negative-ttl-ms N     How long a NotFound read is remembered (0 disables it)
+    --key-filters           Keep Bloom filters of the keys seen by complete scans.
+                            Only correct if every write goes through this server.
+    --write-behind-ms N     Hold UpdateEntityAdmin merges up to N ms to coalesce
+                            them (0, the default, writes each at once)
+    --log-level [C=]L       Log lines of level L (debug, info, warning, error or
+                            off) and above, in category C (server, request,
+                            entity, storage or cache) or in all of them.
+                            The default is info, with entity off.
+    --log-sample C=N        Log only one line in N of category C
  */
 int main (int argc, char const * argv[]) {
-  cout << "Parsing connection string" << endl;
+  long long write_behind_ms {0};
+  for (int i = 1; i < argc; ++i) {
+    const string option {argv[i]};
+    if (option == "--entity-cache-bytes" && i + 1 < argc) {
+      entity_cache.set_capacity(std::stoull(argv[++i]));
+    }
+    else if (option == "--negative-ttl-ms" && i + 1 < argc) {
+      miss_cache.set_ttl(std::chrono::milliseconds {std::stoll(argv[++i])});
+    }
+    else if (option == "--key-filters") {
+      miss_cache.enable_filters(true);
+    }
+    else if (option == "--write-behind-ms" && i + 1 < argc) {
+      write_behind_ms = std::stoll(argv[++i]);
+    }
+    else if (option == "--log-level" && i + 1 < argc && parse_log_level(argv[i + 1])) {
+      ++i;
+    }
+    else if (option == "--log-sample" && i + 1 < argc && parse_log_sample(argv[i + 1])) {
+      ++i;
+    }
+    else {
+      cout << "Usage: basicserver [--entity-cache-bytes N] [--negative-ttl-ms N] [--key-filters] [--write-behind-ms N]\n"
+           "                   [--log-level [C=]L] [--log-sample C=N]" << endl;
+      return 1;
+    }
+  }
+
+  log_info(log_category::server) << "Parsing connection string";
   table_cache.init (storage_connection_string);
 
-  cout << "Opening listener" << endl;
+  write_behind.start(std::chrono::milliseconds {write_behind_ms},
+                     [] (const string& table_name, const string& partition, const string& row,
+                         status_code status) {
+                       note_entity_write(table_name, partition, row);
+                       note_write_status(table_name, status);
+                     });
+
+  log_info(log_category::server) << "Opening listener";
   http_listener listener {def_url};
   listener.support(methods::GET, &handle_get);
   listener.support(methods::POST, &handle_post);
@@ -570,6 +2752,9 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  StreamPacer::instance().stop();
+  write_behind.stop();
+  Logger::instance().stop();
   cout << "Closed" << endl;
 }
 
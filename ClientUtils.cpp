@@ -105,6 +105,51 @@ pair<status_code,value> do_request (const method& http_method, const string& uri
   return do_request (http_method, uri_string, value {});
 }
 
+/*
+  Make an HTTP GET, revalidating a copy of the response body that the
+  caller already holds
+
+  uri_string: uri of the request
+  etag: ETag of the held copy, or empty if there is none. Updated to
+    the ETag of the response.
+  held: the held copy
+
+  If the server replies NotModified, the result is OK with the held
+  copy, so callers see the same result either way.
+ */
+pair<status_code,value> do_conditional_get (const string& uri_string, string& etag, const value& held) {
+  http_request request {web::http::methods::GET};
+  if ( ! etag.empty())
+    request.headers().add("If-None-Match", etag);
+
+  status_code code;
+  value resp_body;
+  http_client client {uri_string};
+  client.request (request)
+    .then([&code, &etag](http_response response)
+          {
+            code = response.status_code();
+            const http_headers& headers {response.headers()};
+            auto tag (headers.find("ETag"));
+            etag = tag == headers.end() ? string {} : tag->second;
+            auto content_type (headers.find("Content-Type"));
+            if (content_type == headers.end() ||
+                content_type->second != "application/json")
+              return pplx::task<value> ([] { return value::object ();});
+            else
+              return response.extract_json();
+          })
+    .then([&resp_body](value v) -> void
+          {
+            resp_body = v;
+            return;
+          })
+    .wait();
+  if (code == status_codes::NotModified)
+    return make_pair(status_codes::OK, held);
+  return make_pair(code, resp_body);
+}
+
 /*
  Return a JSON object value whose (0 or more) properties are specified as a 
  vector of <string,string> pairs
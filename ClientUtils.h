@@ -24,6 +24,9 @@ do_request (const web::http::method& http_method, const std::string& uri_string,
 req_res_t
 do_request (const web::http::method& http_method, const std::string& uri_string);
 
+req_res_t
+do_conditional_get (const std::string& uri_string, std::string& etag, const web::json::value& held);
+
 web::json::value
 build_json_value (const std::vector<std::pair<std::string,std::string>>& props);
 
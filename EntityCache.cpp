@@ -0,0 +1,194 @@
+#include "EntityCache.h"
+
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
+#include <was/table.h>
+
+using azure::storage::edm_type;
+using azure::storage::table_entity;
+
+using pplx::extensibility::scoped_critical_section_t;
+
+using std::string;
+
+namespace {
+  // Partition and row keys cannot contain control characters
+  const char key_separator {'\x1f'};
+
+  // Rough per-entity and per-property bookkeeping cost in bytes
+  constexpr size_t entity_overhead {128};
+  constexpr size_t property_overhead {64};
+
+  // How long a token stays trusted for an entity after storage accepted it
+  constexpr std::chrono::seconds grant_lifetime {60};
+  constexpr size_t max_grants {10000};
+
+  string make_key (const string& table, const string& partition, const string& row) {
+    string key {table};
+    key += key_separator;
+    key += partition;
+    key += key_separator;
+    key += row;
+    return key;
+  }
+
+  size_t entity_bytes (const string& key, const table_entity& entity) {
+    size_t bytes {entity_overhead + key.size() + entity.etag().size()};
+    for (const auto& prop : entity.properties()) {
+      bytes += property_overhead + prop.first.size();
+      if (prop.second.property_type() == edm_type::string)
+        bytes += prop.second.string_value().size();
+      else
+        bytes += sizeof(int64_t);
+    }
+    return bytes;
+  }
+}
+
+void EntityCache::set_capacity(size_t capacity) {
+  scoped_critical_section_t lock {resplock};
+  capacity_bytes = capacity;
+  evict_to(capacity_bytes);
+}
+
+uint64_t EntityCache::generation() {
+  scoped_critical_section_t lock {resplock};
+  return generation_count;
+}
+
+/*
+  Copy the cached entity table/partition/row into entity.
+
+  Returns false (and counts a miss) if it is not cached.
+ */
+bool EntityCache::lookup(const string& table, const string& partition, const string& row,
+                         table_entity& entity) {
+  scoped_critical_section_t lock {resplock};
+  if (capacity_bytes == 0)
+    return false;
+
+  auto found (index.find(make_key(table, partition, row)));
+  if (found == index.end()) {
+    ++misses;
+    return false;
+  }
+  lru.splice(lru.begin(), lru, found->second);
+  entity = found->second->entity;
+  ++hits;
+  return true;
+}
+
+/*
+  Cache entity, read from table when generation() was observed_generation.
+ */
+void EntityCache::insert(const string& table, const table_entity& entity,
+                         uint64_t observed_generation) {
+  string key {make_key(table, entity.partition_key(), entity.row_key())};
+  size_t bytes {entity_bytes(key, entity)};
+
+  scoped_critical_section_t lock {resplock};
+  if (observed_generation != generation_count || bytes > capacity_bytes)
+    return;
+
+  auto found (index.find(key));
+  if (found != index.end())
+    erase(found);
+
+  evict_to(capacity_bytes - bytes);
+  lru.push_front(entry_t {key, entity, bytes});
+  index[key] = lru.begin();
+  used_bytes += bytes;
+}
+
+void EntityCache::invalidate(const string& table, const string& partition, const string& row) {
+  scoped_critical_section_t lock {resplock};
+  ++generation_count;
+  auto found (index.find(make_key(table, partition, row)));
+  if (found != index.end())
+    erase(found);
+}
+
+void EntityCache::invalidate_table(const string& table) {
+  string prefix {table};
+  prefix += key_separator;
+
+  scoped_critical_section_t lock {resplock};
+  ++generation_count;
+  for (auto entry = index.begin(); entry != index.end(); ) {
+    auto next (std::next(entry));
+    if (entry->first.compare(0, prefix.size(), prefix) == 0)
+      erase(entry);
+    entry = next;
+  }
+  for (auto grant = grants.begin(); grant != grants.end(); ) {
+    if (grant->first.find(key_separator + prefix) != string::npos)
+      grant = grants.erase(grant);
+    else
+      ++grant;
+  }
+}
+
+/*
+  Record that storage accepted token for reading table/partition/row.
+
+  A cached entity may be returned to an authorized read only while
+  such a grant is fresh, so the cache never hands out an entity to a
+  token that storage has not accepted for it.
+ */
+void EntityCache::remember_grant(const string& token, const string& table,
+                                 const string& partition, const string& row) {
+  string key {token + key_separator + make_key(table, partition, row)};
+  grant_clock::time_point now {grant_clock::now()};
+
+  scoped_critical_section_t lock {resplock};
+  if (grants.size() >= max_grants) {
+    for (auto grant = grants.begin(); grant != grants.end(); ) {
+      if (grant->second <= now)
+        grant = grants.erase(grant);
+      else
+        ++grant;
+    }
+    if (grants.size() >= max_grants)
+      grants.clear();
+  }
+  grants[key] = now + grant_lifetime;
+}
+
+bool EntityCache::has_grant(const string& token, const string& table,
+                            const string& partition, const string& row) {
+  string key {token + key_separator + make_key(table, partition, row)};
+
+  scoped_critical_section_t lock {resplock};
+  auto found (grants.find(key));
+  if (found == grants.end())
+    return false;
+  if (found->second <= grant_clock::now()) {
+    grants.erase(found);
+    return false;
+  }
+  return true;
+}
+
+EntityCache::stats_t EntityCache::stats() {
+  scoped_critical_section_t lock {resplock};
+  return stats_t {hits, misses, evictions, index.size(), used_bytes, capacity_bytes};
+}
+
+// Caller must hold resplock
+void EntityCache::evict_to(size_t limit) {
+  while (used_bytes > limit && ! lru.empty()) {
+    auto found (index.find(lru.back().key));
+    erase(found);
+    ++evictions;
+  }
+}
+
+// Caller must hold resplock
+void EntityCache::erase(std::unordered_map<string,lru_t::iterator>::iterator entry) {
+  used_bytes -= entry->second->bytes;
+  lru.erase(entry->second);
+  index.erase(entry);
+}
@@ -0,0 +1,90 @@
+#ifndef EntityCache_h
+#define EntityCache_h
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+/*
+  Size-bounded LRU cache of entities, keyed by table, partition, and row.
+
+  Capacity is an estimate of the bytes held by the cached entities.
+  A capacity of 0 disables the cache.
+
+  Readers capture generation() before going to storage and pass it to
+  insert(). If any invalidation happened in between, the insert is
+  dropped, so a read racing a write can never cache the old version.
+ */
+class EntityCache {
+public:
+  struct stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t capacity_bytes;
+  };
+
+private:
+  struct entry_t {
+    std::string key;
+    azure::storage::table_entity entity;
+    size_t bytes;
+  };
+  using lru_t = std::list<entry_t>;
+  using grant_clock = std::chrono::steady_clock;
+
+  lru_t lru;  // Most recently used first
+  std::unordered_map<std::string,lru_t::iterator> index;
+  std::unordered_map<std::string,grant_clock::time_point> grants;
+  size_t capacity_bytes;
+  size_t used_bytes;
+  uint64_t generation_count;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  pplx::extensibility::critical_section_t resplock;
+
+  void evict_to(size_t limit);
+  void erase(std::unordered_map<std::string,lru_t::iterator>::iterator entry);
+
+public:
+  EntityCache (size_t capacity) :
+    lru {},
+    index {},
+    grants {},
+    capacity_bytes {capacity},
+    used_bytes {0},
+    generation_count {0},
+    hits {0},
+    misses {0},
+    evictions {0},
+    resplock {}
+    {};
+
+  void set_capacity(size_t capacity);
+  uint64_t generation();
+
+  bool lookup(const std::string& table, const std::string& partition, const std::string& row,
+              azure::storage::table_entity& entity);
+  void insert(const std::string& table, const azure::storage::table_entity& entity,
+              uint64_t observed_generation);
+  void invalidate(const std::string& table, const std::string& partition, const std::string& row);
+  void invalidate_table(const std::string& table);
+
+  void remember_grant(const std::string& token, const std::string& table,
+                      const std::string& partition, const std::string& row);
+  bool has_grant(const std::string& token, const std::string& table,
+                 const std::string& partition, const std::string& row);
+
+  stats_t stats();
+};
+
+#endif
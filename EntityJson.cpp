@@ -0,0 +1,149 @@
+#include "EntityJson.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <was/table.h>
+
+using azure::storage::edm_type;
+using azure::storage::entity_property;
+using azure::storage::table_entity;
+
+using std::string;
+using std::vector;
+
+namespace {
+  const char hex_digits[] {"0123456789abcdef"};
+
+  void append_integer (string& out, int64_t n) {
+    char digits[20];
+    char* const end {digits + sizeof digits};
+    char* p {end};
+    // Negate as unsigned, so the most negative value does not overflow
+    uint64_t u {n < 0 ? 0 - static_cast<uint64_t>(n) : static_cast<uint64_t>(n)};
+    do {
+      *--p = static_cast<char>('0' + u % 10);
+      u /= 10;
+    } while (u != 0);
+    if (n < 0)
+      out += '-';
+    out.append(p, end);
+  }
+
+  /*
+    Most doubles read back exactly from 15 significant digits, the
+    rest from 16 or 17.
+   */
+  void append_double (string& out, double d) {
+    if ( ! std::isfinite(d)) {
+      out += "null";
+      return;
+    }
+    char text[32];
+    int length {0};
+    for (int precision = 15; precision <= 17; ++precision) {
+      length = std::snprintf(text, sizeof text, "%.*g", precision, d);
+      if (std::strtod(text, nullptr) == d)
+        break;
+    }
+    out.append(text, length);
+  }
+
+  void append_property (string& out, const string& name, const entity_property& prop) {
+    append_json_string(out, name);
+    out += ':';
+    switch (prop.property_type()) {
+    case edm_type::string:
+      append_json_string(out, prop.string_value());
+      break;
+    case edm_type::int32:
+      append_integer(out, prop.int32_value());
+      break;
+    case edm_type::int64:
+      append_integer(out, prop.int64_value());
+      break;
+    case edm_type::double_floating_point:
+      append_double(out, prop.double_value());
+      break;
+    case edm_type::boolean:
+      out += prop.boolean_value() ? "true" : "false";
+      break;
+    default:
+      append_json_string(out, prop.str());
+      break;
+    }
+  }
+
+  /*
+    Append the members for the properties of entity, each preceded
+    by a comma unless it is the first member of the object.
+   */
+  void append_members (string& out, const table_entity& entity, const vector<string>& columns, bool first) {
+    const table_entity::properties_type& properties = entity.properties();
+    if (columns.empty()) {
+      for (const auto& prop : properties) {
+        if ( ! first)
+          out += ',';
+        append_property(out, prop.first, prop.second);
+        first = false;
+      }
+      return;
+    }
+    for (const auto& column : columns) {
+      auto prop = properties.find(column);
+      if (prop == properties.end())
+        continue;
+      if ( ! first)
+        out += ',';
+      append_property(out, prop->first, prop->second);
+      first = false;
+    }
+  }
+}
+
+void append_json_string (string& out, const string& s) {
+  out += '"';
+  size_t run {0};
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c {static_cast<unsigned char>(s[i])};
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(s, run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '"': out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\b': out += "\\b"; break;
+    case '\f': out += "\\f"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      out += "\\u00";
+      out += hex_digits[c >> 4];
+      out += hex_digits[c & 0xF];
+      break;
+    }
+  }
+  out.append(s, run, string::npos);
+  out += '"';
+}
+
+void append_properties_json (string& out, const table_entity& entity, const vector<string>& columns) {
+  out += '{';
+  append_members(out, entity, columns, true);
+  out += '}';
+}
+
+void append_entity_json (string& out, const table_entity& entity, const vector<string>& columns) {
+  out += "{\"Partition\":";
+  append_json_string(out, entity.partition_key());
+  out += ",\"Row\":";
+  append_json_string(out, entity.row_key());
+  append_members(out, entity, columns, false);
+  out += '}';
+}
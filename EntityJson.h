@@ -0,0 +1,44 @@
+#ifndef EntityJson_h
+#define EntityJson_h
+
+#include <string>
+#include <vector>
+
+#include <was/table.h>
+
+/*
+  Writing entities as JSON text, straight from table_entity.
+
+  Replies used to build a web::json::value for every entity and
+  serialize the lot; these append the same JSON to a string the
+  caller reuses, so a segment of entities costs a few appends to one
+  buffer rather than a tree of values per entity.
+
+  Property values are written as the server has always returned
+  them: strings, datetimes and other types as JSON strings (the
+  latter two in their storage text form), int32, int64 and double
+  as numbers, and booleans as true or false. Doubles are written in
+  the fewest digits that read back as the same value; infinities
+  and NaN, which JSON cannot hold, as null.
+
+  A property named by columns that the entity lacks is left out.
+ */
+
+// Append s to out as a JSON string, quotes included
+void append_json_string (std::string& out, const std::string& s);
+
+/*
+  Append the properties of entity as a JSON object. If columns is
+  not empty, only those properties are written.
+ */
+void append_properties_json (std::string& out, const azure::storage::table_entity& entity,
+                             const std::vector<std::string>& columns = std::vector<std::string> {});
+
+/*
+  Append entity as a JSON object of its Partition, Row and
+  properties, as in the replies of table and partition scans. If
+  columns is not empty, only those properties are written.
+ */
+void append_entity_json (std::string& out, const azure::storage::table_entity& entity,
+                         const std::vector<std::string>& columns = std::vector<std::string> {});
+#endif
@@ -0,0 +1,512 @@
+#include "FilterExpr.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <was/table.h>
+
+using azure::storage::edm_type;
+using azure::storage::entity_property;
+using azure::storage::table_entity;
+using azure::storage::table_query;
+
+using std::string;
+using std::vector;
+
+namespace {
+  /*
+    Lexical analysis
+   */
+  enum class token_kind {word, text, number, open, close, end};
+
+  struct token {
+    token_kind kind;
+    string text;
+    size_t position;
+  };
+
+  bool tokenize (const string& text, vector<token>& tokens, string& error) {
+    size_t i {0};
+    while (i < text.size()) {
+      char c {text[i]};
+      if (std::isspace(static_cast<unsigned char>(c))) {
+        ++i;
+      }
+      else if (c == '(' || c == ')') {
+        tokens.push_back(token {c == '(' ? token_kind::open : token_kind::close, string(1, c), i});
+        ++i;
+      }
+      else if (c == '\'') {
+        size_t start {i++};
+        string value {};
+        for (;;) {
+          if (i >= text.size()) {
+            error = "Unterminated string at " + std::to_string(start);
+            return false;
+          }
+          if (text[i] == '\'') {
+            if (i + 1 < text.size() && text[i + 1] == '\'') {
+              value += '\'';
+              i += 2;
+              continue;
+            }
+            ++i;
+            break;
+          }
+          value += text[i++];
+        }
+        tokens.push_back(token {token_kind::text, value, start});
+      }
+      else if (std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '.') {
+        size_t start {i++};
+        while (i < text.size() &&
+               (std::isalnum(static_cast<unsigned char>(text[i])) || text[i] == '.' ||
+                ((text[i] == '-' || text[i] == '+') && (text[i - 1] == 'e' || text[i - 1] == 'E')))) {
+          ++i;
+        }
+        tokens.push_back(token {token_kind::number, text.substr(start, i - start), start});
+      }
+      else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+        size_t start {i};
+        while (i < text.size() && (std::isalnum(static_cast<unsigned char>(text[i])) || text[i] == '_')) {
+          ++i;
+        }
+        tokens.push_back(token {token_kind::word, text.substr(start, i - start), start});
+      }
+      else {
+        error = string("Unexpected '") + c + "' at " + std::to_string(i);
+        return false;
+      }
+    }
+    tokens.push_back(token {token_kind::end, string {}, text.size()});
+    return true;
+  }
+
+  /*
+    Syntax tree
+   */
+  enum class literal_type {text, integer, real, boolean};
+
+  struct literal {
+    literal_type type;
+    string text;
+    int64_t integer;
+    double real;
+    bool boolean;
+  };
+
+  enum class node_kind {compare, all_of, any_of};
+
+  struct node;
+  using node_ptr = std::shared_ptr<node>;
+
+  struct node {
+    node_kind kind;
+    string name;
+    string op;
+    literal value;
+    vector<node_ptr> children;
+  };
+
+  const vector<string> operators {"eq", "ne", "gt", "ge", "lt", "le"};
+
+  bool is_key (const string& name) {
+    return name == "PartitionKey" || name == "RowKey";
+  }
+
+  /*
+    Recursive-descent parser:
+
+      expr       := term ("or" term)*
+      term       := factor ("and" factor)*
+      factor     := "(" expr ")" | comparison
+      comparison := name operator literal
+   */
+  class parser {
+  private:
+    const vector<token>& tokens;
+    size_t next;
+    string& error;
+
+    const token& peek() const { return tokens[next]; };
+
+    bool fail(const string& expected) {
+      if (error.empty())
+        error = "Expected " + expected + " at " + std::to_string(peek().position);
+      return false;
+    }
+
+    bool is_word(const string& word) const {
+      return peek().kind == token_kind::word && peek().text == word;
+    }
+
+    bool parse_literal(literal& value) {
+      const token& t {peek()};
+      if (t.kind == token_kind::text) {
+        value.type = literal_type::text;
+        value.text = t.text;
+      }
+      else if (t.kind == token_kind::word && (t.text == "true" || t.text == "false")) {
+        value.type = literal_type::boolean;
+        value.boolean = t.text == "true";
+      }
+      else if (t.kind == token_kind::number) {
+        bool integral {t.text.find_first_of(".eE") == string::npos};
+        try {
+          size_t used {0};
+          if (integral) {
+            value.integer = std::stoll(t.text, &used);
+            value.type = literal_type::integer;
+          }
+          else {
+            value.real = std::stod(t.text, &used);
+            value.type = literal_type::real;
+          }
+          if (used != t.text.size())
+            return fail("a number");
+        }
+        catch (const std::out_of_range&) {
+          if ( ! integral)
+            return fail("a number in range");
+          value.real = std::stod(t.text);
+          value.type = literal_type::real;
+        }
+        catch (const std::exception&) {
+          return fail("a number");
+        }
+        if (value.type == literal_type::real && ! std::isfinite(value.real))
+          return fail("a finite number");
+      }
+      else {
+        return fail("a string, number, true or false");
+      }
+      ++next;
+      return true;
+    }
+
+    bool parse_comparison(node_ptr& result) {
+      if (peek().kind != token_kind::word)
+        return fail("a property name");
+      result = std::make_shared<node>();
+      result->kind = node_kind::compare;
+      result->name = peek().text;
+      if (result->name == "Partition")
+        result->name = "PartitionKey";
+      else if (result->name == "Row")
+        result->name = "RowKey";
+      ++next;
+
+      if (peek().kind != token_kind::word ||
+          std::find(operators.begin(), operators.end(), peek().text) == operators.end())
+        return fail("eq, ne, gt, ge, lt or le");
+      result->op = peek().text;
+      ++next;
+
+      size_t position {peek().position};
+      if ( ! parse_literal(result->value))
+        return false;
+      if (is_key(result->name) && result->value.type != literal_type::text) {
+        error = result->name + " takes a string at " + std::to_string(position);
+        return false;
+      }
+      if (result->value.type == literal_type::boolean && result->op != "eq" && result->op != "ne") {
+        error = "Booleans take only eq and ne at " + std::to_string(position);
+        return false;
+      }
+      return true;
+    }
+
+    bool parse_factor(node_ptr& result) {
+      if (peek().kind == token_kind::open) {
+        ++next;
+        if ( ! parse_expr(result))
+          return false;
+        if (peek().kind != token_kind::close)
+          return fail("')'");
+        ++next;
+        return true;
+      }
+      return parse_comparison(result);
+    }
+
+    bool parse_list(node_kind kind, const string& joiner, node_ptr& result) {
+      node_ptr first {};
+      if ( ! (kind == node_kind::any_of ? parse_list(node_kind::all_of, "and", first) : parse_factor(first)))
+        return false;
+      if ( ! is_word(joiner)) {
+        result = first;
+        return true;
+      }
+      result = std::make_shared<node>();
+      result->kind = kind;
+      result->children.push_back(first);
+      while (is_word(joiner)) {
+        ++next;
+        node_ptr child {};
+        if ( ! (kind == node_kind::any_of ? parse_list(node_kind::all_of, "and", child) : parse_factor(child)))
+          return false;
+        result->children.push_back(child);
+      }
+      return true;
+    }
+
+  public:
+    parser (const vector<token>& all_tokens, string& error_message)
+      : tokens (all_tokens), next {0}, error (error_message) {};
+
+    bool parse_expr(node_ptr& result) {
+      return parse_list(node_kind::any_of, "or", result);
+    }
+
+    bool at_end() const { return peek().kind == token_kind::end; };
+    size_t position() const { return peek().position; };
+  };
+
+  /*
+    Storage filters
+   */
+
+  /*
+    Return the condition that an integer property, of a type ranging
+    over [low, high], compares to bound by op, or an empty string if
+    no value of the type does.
+   */
+  template <typename T>
+  string integer_condition (const string& name, const string& op, int64_t bound) {
+    const int64_t low {std::numeric_limits<T>::min()};
+    const int64_t high {std::numeric_limits<T>::max()};
+    const string any {table_query::generate_filter_condition(name, "ge", static_cast<T>(low))};
+    const string none {};
+    string result {};
+    if (op == "eq")
+      result = bound < low || bound > high ? none : table_query::generate_filter_condition(name, op, static_cast<T>(bound));
+    else if (op == "ne")
+      result = bound < low || bound > high ? any : table_query::generate_filter_condition(name, op, static_cast<T>(bound));
+    else if (op == "gt")
+      result = bound >= high ? none : bound < low ? any : table_query::generate_filter_condition(name, op, static_cast<T>(bound));
+    else if (op == "ge")
+      result = bound > high ? none : bound <= low ? any : table_query::generate_filter_condition(name, op, static_cast<T>(bound));
+    else if (op == "lt")
+      result = bound <= low ? none : bound > high ? any : table_query::generate_filter_condition(name, op, static_cast<T>(bound));
+    else
+      result = bound < low ? none : bound >= high ? any : table_query::generate_filter_condition(name, op, static_cast<T>(bound));
+    return result;
+  }
+
+  /*
+    Integer comparison equivalent to comparing an integer with the
+    non-integral value real: x gt 2.5 is x gt 2, x lt 2.5 is x lt 3.
+    eq can never hold and ne always does, which the bound expresses
+    by lying beyond every integer type.
+   */
+  void integer_bound (const string& op, double real, string& int_op, int64_t& bound) {
+    const double low {static_cast<double>(std::numeric_limits<int64_t>::min())};
+    const double high {static_cast<double>(std::numeric_limits<int64_t>::max())};
+    auto clamp = [low, high] (double d) -> int64_t {
+      if (d <= low)
+        return std::numeric_limits<int64_t>::min();
+      if (d >= high)
+        return std::numeric_limits<int64_t>::max();
+      return static_cast<int64_t>(d);
+    };
+    if (op == "gt" || op == "ge") {
+      int_op = "gt";
+      bound = clamp(std::floor(real));
+    }
+    else if (op == "lt" || op == "le") {
+      int_op = "lt";
+      bound = clamp(std::ceil(real));
+    }
+    else {
+      int_op = op;
+      bound = std::numeric_limits<int64_t>::max();
+    }
+  }
+
+  // Storage conditions, or'd together, for one comparison
+  vector<string> comparison_conditions (const node& n) {
+    const literal& v {n.value};
+    if (v.type == literal_type::text)
+      return vector<string> {table_query::generate_filter_condition(n.name, n.op, v.text)};
+    if (v.type == literal_type::boolean)
+      return vector<string> {table_query::generate_filter_condition(n.name, n.op, v.boolean)};
+
+    string int_op {n.op};
+    int64_t bound {v.integer};
+    double real {static_cast<double>(v.integer)};
+    if (v.type == literal_type::real) {
+      real = v.real;
+      if (std::floor(real) == real && real > -9.2e18 && real < 9.2e18)
+        bound = static_cast<int64_t>(real);
+      else
+        integer_bound(n.op, real, int_op, bound);
+    }
+    vector<string> conditions {};
+    for (const auto& c : {integer_condition<int32_t>(n.name, int_op, bound),
+                          integer_condition<int64_t>(n.name, int_op, bound)}) {
+      if ( ! c.empty())
+        conditions.push_back(c);
+    }
+    conditions.push_back(table_query::generate_filter_condition(n.name, n.op, real));
+    return conditions;
+  }
+
+  size_t comparisons (const node& n) {
+    if (n.kind == node_kind::compare)
+      return comparison_conditions(n).size();
+    size_t total {0};
+    for (const auto& child : n.children) {
+      total += comparisons(*child);
+    }
+    return total;
+  }
+
+  string storage_filter (const node& n) {
+    vector<string> parts {};
+    if (n.kind == node_kind::compare) {
+      parts = comparison_conditions(n);
+    }
+    else {
+      for (const auto& child : n.children) {
+        parts.push_back(storage_filter(*child));
+      }
+    }
+    const string joiner {n.kind == node_kind::all_of ? azure::storage::query_logical_operator::op_and
+                                                     : azure::storage::query_logical_operator::op_or};
+    string filter {parts[0]};
+    for (size_t i = 1; i < parts.size(); ++i) {
+      filter = table_query::combine_filter_conditions(filter, joiner, parts[i]);
+    }
+    return filter;
+  }
+
+  /*
+    Server-side predicates
+   */
+  template <typename T>
+  bool compare_values (const T& left, const string& op, const T& right) {
+    if (op == "eq") return left == right;
+    if (op == "ne") return ! (left == right);
+    if (op == "gt") return right < left;
+    if (op == "ge") return ! (left < right);
+    if (op == "lt") return left < right;
+    return ! (right < left);
+  }
+
+  entity_predicate compile_predicate (const node_ptr& n) {
+    if (n->kind != node_kind::compare) {
+      vector<entity_predicate> children {};
+      for (const auto& child : n->children) {
+        children.push_back(compile_predicate(child));
+      }
+      bool all {n->kind == node_kind::all_of};
+      return [children, all] (const table_entity& entity) {
+        for (const auto& child : children) {
+          if (child(entity) != all)
+            return ! all;
+        }
+        return all;
+      };
+    }
+
+    const string name {n->name};
+    const string op {n->op};
+    const literal v {n->value};
+    if (name == "PartitionKey")
+      return [op, v] (const table_entity& entity) { return compare_values(entity.partition_key(), op, v.text); };
+    if (name == "RowKey")
+      return [op, v] (const table_entity& entity) { return compare_values(entity.row_key(), op, v.text); };
+
+    return [name, op, v] (const table_entity& entity) {
+      auto found = entity.properties().find(name);
+      if (found == entity.properties().end() || found->second.is_null())
+        return false;
+      const entity_property& prop {found->second};
+      switch (v.type) {
+      case literal_type::text:
+        return prop.property_type() == edm_type::string && compare_values(prop.string_value(), op, v.text);
+      case literal_type::boolean:
+        return prop.property_type() == edm_type::boolean && compare_values(prop.boolean_value(), op, v.boolean);
+      default:
+        break;
+      }
+      // Compare numbers by value, whatever their types
+      long double right {v.type == literal_type::integer ? static_cast<long double>(v.integer) : v.real};
+      long double left {};
+      if (prop.property_type() == edm_type::int32)
+        left = prop.int32_value();
+      else if (prop.property_type() == edm_type::int64)
+        left = prop.int64_value();
+      else if (prop.property_type() == edm_type::double_floating_point)
+        left = prop.double_value();
+      else
+        return false;
+      return compare_values(left, op, right);
+    };
+  }
+
+  void collect_properties (const node& n, vector<string>& names) {
+    if (n.kind != node_kind::compare) {
+      for (const auto& child : n.children) {
+        collect_properties(*child, names);
+      }
+    }
+    else if ( ! is_key(n.name) && std::find(names.begin(), names.end(), n.name) == names.end()) {
+      names.push_back(n.name);
+    }
+  }
+}
+
+bool compile_filter (const string& text, size_t max_comparisons, compiled_filter& result, string& error) {
+  vector<token> tokens {};
+  if ( ! tokenize(text, tokens, error))
+    return false;
+  node_ptr root {};
+  parser p {tokens, error};
+  if ( ! p.parse_expr(root))
+    return false;
+  if ( ! p.at_end()) {
+    error = "Expected 'and', 'or' or the end at " + std::to_string(p.position());
+    return false;
+  }
+
+  // Give storage as many of the top-level "and" terms as fit
+  vector<node_ptr> terms {};
+  if (root->kind == node_kind::all_of)
+    terms = root->children;
+  else
+    terms.push_back(root);
+
+  vector<node_ptr> stored {};
+  vector<node_ptr> residual {};
+  size_t used {0};
+  for (const auto& term : terms) {
+    size_t needed {comparisons(*term)};
+    if (used + needed <= max_comparisons) {
+      stored.push_back(term);
+      used += needed;
+    }
+    else {
+      residual.push_back(term);
+    }
+  }
+
+  result = compiled_filter {};
+  if (stored.size() > 0) {
+    node all {node_kind::all_of, string {}, string {}, literal {}, stored};
+    result.storage_filter = stored.size() == 1 ? storage_filter(*stored[0]) : storage_filter(all);
+  }
+  if (residual.size() > 0) {
+    node_ptr all {std::make_shared<node>(node {node_kind::all_of, string {}, string {}, literal {}, residual})};
+    result.residual = compile_predicate(all);
+    collect_properties(*all, result.residual_properties);
+  }
+  return true;
+}
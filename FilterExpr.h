@@ -0,0 +1,60 @@
+#ifndef FilterExpr_h
+#define FilterExpr_h
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <was/table.h>
+
+/*
+  Filter expressions for table scans, as given in the filter
+  parameter of ReadEntityAdmin.
+
+  An expression is comparisons joined by "and" and "or" ("and" binds
+  tighter), with parentheses for grouping:
+
+    Year ge 1970 and (Genre eq 'Folk' or Rating gt 4.5)
+    PartitionKey ge 'A' and PartitionKey lt 'M'
+
+  A comparison is a property name, an operator (eq, ne, gt, ge, lt,
+  le) and a literal: a string in single quotes (two quotes stand for
+  one), a number, or true or false (eq and ne only). PartitionKey and
+  RowKey (or Partition and Row) name the keys and take strings.
+
+  As in storage, a comparison is false for an entity that lacks the
+  property or holds it with another kind of value. Strings compare
+  as strings, numbers (int32, int64 or double) by value, so 5 matches
+  5, 5L and 5.0, and booleans only with eq and ne. Strings that look
+  like numbers are strings.
+ */
+using entity_predicate = std::function<bool (const azure::storage::table_entity&)>;
+
+/*
+  An expression split between storage and the server.
+
+  storage_filter: filter string for the table query, empty if none.
+  residual: test for the entities storage returns, empty if none.
+  residual_properties: properties residual reads, which the query
+    must select if it selects any.
+ */
+struct compiled_filter {
+  std::string storage_filter;
+  entity_predicate residual;
+  std::vector<std::string> residual_properties;
+};
+
+/*
+  Compile text into result.
+
+  A comparison of a number becomes one storage comparison for each
+  numeric type, so an expression may need more comparisons than a
+  filter allows. The storage filter then holds as many of the
+  expression's top-level "and" terms as fit in max_comparisons, and
+  residual tests the rest.
+
+  Returns false, with a message in error, if text is malformed.
+ */
+bool compile_filter (const std::string& text, size_t max_comparisons,
+                     compiled_filter& result, std::string& error);
+#endif
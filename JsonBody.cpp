@@ -0,0 +1,485 @@
+#include "JsonBody.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cpprest/containerstream.h>
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+#include <pplx/pplxtasks.h>
+
+#include "Log.h"
+
+using concurrency::streams::container_buffer;
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+using web::http::http_headers;
+using web::http::http_request;
+
+namespace {
+  const string json_content_type {"application/json"};
+
+  // Bytes asked of the request stream at a time
+  const size_t body_read_bytes {64 * 1024};
+
+  // Arrays and objects nested deeper than this are malformed
+  const int max_json_depth {64};
+
+  /*
+    True if content_type is application/json, with or without
+    parameters such as a charset
+   */
+  bool is_json_type (const string& content_type) {
+    return content_type.compare(0, json_content_type.size(), json_content_type) == 0 &&
+      (content_type.size() == json_content_type.size() ||
+       content_type[json_content_type.size()] == ';');
+  }
+
+  void append_utf8 (string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+      out += static_cast<char>(code_point);
+    }
+    else if (code_point < 0x800) {
+      out += static_cast<char>(0xC0 | (code_point >> 6));
+      out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    else if (code_point < 0x10000) {
+      out += static_cast<char>(0xE0 | (code_point >> 12));
+      out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+    else {
+      out += static_cast<char>(0xF0 | (code_point >> 18));
+      out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code_point & 0x3F));
+    }
+  }
+
+  /*
+    Parser over one body. Each routine returns false if the text at
+    pos is malformed, leaving pos anywhere.
+
+    Values inside arrays and objects are copied verbatim, apart from
+    whitespace between tokens, so a composite member's text is
+    compact JSON with the escapes it was sent with.
+   */
+  class json_parser {
+    const char* text;
+    size_t size;
+    size_t pos;
+
+    bool more () const { return pos < size; }
+    char peek () const { return text[pos]; }
+
+    bool hex4 (uint32_t& unit) {
+      if (size - pos < 4)
+        return false;
+      unit = 0;
+      for (size_t end = pos + 4; pos < end; ++pos) {
+        char c {text[pos]};
+        unit <<= 4;
+        if (c >= '0' && c <= '9')
+          unit |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+          unit |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+          unit |= c - 'A' + 10;
+        else
+          return false;
+      }
+      return true;
+    }
+
+    /*
+      A \u escape, pos just past the u. A high surrogate must be
+      followed by an escaped low one.
+     */
+    bool unicode_escape (string& out) {
+      uint32_t unit {0};
+      if ( ! hex4(unit))
+        return false;
+      if (unit >= 0xDC00 && unit <= 0xDFFF)
+        return false;
+      if (unit >= 0xD800 && unit <= 0xDBFF) {
+        uint32_t low {0};
+        if (size - pos < 2 || text[pos] != '\\' || text[pos + 1] != 'u')
+          return false;
+        pos += 2;
+        if ( ! hex4(low) || low < 0xDC00 || low > 0xDFFF)
+          return false;
+        unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+      }
+      append_utf8(out, unit);
+      return true;
+    }
+
+    /*
+      A string, pos at its opening quote. Appends the unescaped
+      string to out, or if raw the string as written, quotes and all.
+     */
+    bool string_value (string& out, bool raw) {
+      size_t start {pos};
+      ++pos;
+      for (;;) {
+        // Copy the run up to the next quote, escape or end
+        size_t run {pos};
+        while (pos < size && text[pos] != '"' && text[pos] != '\\') {
+          if (static_cast<unsigned char>(text[pos]) < 0x20)
+            return false;
+          ++pos;
+        }
+        if ( ! raw)
+          out.append(text + run, pos - run);
+        if ( ! more())
+          return false;
+        if (peek() == '"') {
+          ++pos;
+          break;
+        }
+
+        ++pos;
+        if ( ! more())
+          return false;
+        char c {text[pos++]};
+        if (c == 'u') {
+          string decoded {};
+          if ( ! unicode_escape(decoded))
+            return false;
+          if ( ! raw)
+            out += decoded;
+          continue;
+        }
+        char unescaped {};
+        switch (c) {
+        case '"': unescaped = '"'; break;
+        case '\\': unescaped = '\\'; break;
+        case '/': unescaped = '/'; break;
+        case 'b': unescaped = '\b'; break;
+        case 'f': unescaped = '\f'; break;
+        case 'n': unescaped = '\n'; break;
+        case 'r': unescaped = '\r'; break;
+        case 't': unescaped = '\t'; break;
+        default: return false;
+        }
+        if ( ! raw)
+          out += unescaped;
+      }
+      if (raw)
+        out.append(text + start, pos - start);
+      return true;
+    }
+
+    bool digits () {
+      size_t start {pos};
+      while (more() && peek() >= '0' && peek() <= '9')
+        ++pos;
+      return pos > start;
+    }
+
+    /*
+      A number, appended as written
+     */
+    bool number (string& out) {
+      size_t start {pos};
+      if (peek() == '-')
+        ++pos;
+      if (more() && peek() == '0')
+        ++pos;
+      else if ( ! digits())
+        return false;
+      if (more() && peek() == '.') {
+        ++pos;
+        if ( ! digits())
+          return false;
+      }
+      if (more() && (peek() == 'e' || peek() == 'E')) {
+        ++pos;
+        if (more() && (peek() == '+' || peek() == '-'))
+          ++pos;
+        if ( ! digits())
+          return false;
+      }
+      out.append(text + start, pos - start);
+      return true;
+    }
+
+    bool literal (const string& word, string& out) {
+      if (word.compare(0, word.size(), text + pos, std::min(word.size(), size - pos)) != 0)
+        return false;
+      pos += word.size();
+      out += word;
+      return true;
+    }
+
+    /*
+      An array or object, pos at its opening bracket, appended as
+      compact text
+     */
+    bool composite (string& out, int depth) {
+      if (depth > max_json_depth)
+        return false;
+      const bool is_object {peek() == '{'};
+      const char close {is_object ? '}' : ']'};
+      out += peek();
+      ++pos;
+      skip_space();
+      if (more() && peek() == close) {
+        out += close;
+        ++pos;
+        return true;
+      }
+      for (;;) {
+        if (is_object) {
+          if ( ! more() || peek() != '"' || ! string_value(out, true))
+            return false;
+          skip_space();
+          if ( ! more() || peek() != ':')
+            return false;
+          out += ':';
+          ++pos;
+          skip_space();
+        }
+        if ( ! raw_value(out, depth))
+          return false;
+        skip_space();
+        if ( ! more())
+          return false;
+        char c {text[pos++]};
+        out += c;
+        if (c == close)
+          return true;
+        if (c != ',')
+          return false;
+        skip_space();
+      }
+    }
+
+  public:
+    json_parser (const char* t, size_t n) : text {t}, size {n}, pos {0} {}
+
+    void skip_space () {
+      while (more() && (peek() == ' ' || peek() == '\t' || peek() == '\n' || peek() == '\r'))
+        ++pos;
+    }
+
+    bool at_end () {
+      skip_space();
+      return ! more();
+    }
+
+    /*
+      Any value, appended as written (compactly, for composites)
+     */
+    bool raw_value (string& out, int depth) {
+      json_kind kind {};
+      return more() && (peek() == '"' ? string_value(out, true) : member_value(kind, out, depth));
+    }
+
+    /*
+      The value of a top-level member, with its kind. Strings are
+      unescaped.
+     */
+    bool member_value (json_kind& kind, string& out, int depth) {
+      if ( ! more())
+        return false;
+      char c {peek()};
+      if (c == '"') {
+        kind = json_kind::string;
+        return string_value(out, false);
+      }
+      if (c == '{' || c == '[') {
+        kind = json_kind::composite;
+        return composite(out, depth + 1);
+      }
+      if (c == '-' || (c >= '0' && c <= '9')) {
+        kind = json_kind::number;
+        return number(out);
+      }
+      if (c == 't' || c == 'f') {
+        kind = json_kind::boolean;
+        return literal(c == 't' ? "true" : "false", out);
+      }
+      kind = json_kind::null;
+      return literal("null", out);
+    }
+
+    /*
+      The whole body: an object whose members go to on_member, or any
+      other value, which is checked and dropped
+     */
+    bool body (const json_member_callback& on_member) {
+      skip_space();
+      if ( ! more())
+        return false;
+      if (peek() != '{') {
+        string ignored {};
+        return raw_value(ignored, 0) && at_end();
+      }
+
+      ++pos;
+      skip_space();
+      if (more() && peek() == '}') {
+        ++pos;
+        return at_end();
+      }
+      for (;;) {
+        string name {};
+        if ( ! more() || peek() != '"' || ! string_value(name, false))
+          return false;
+        skip_space();
+        if ( ! more() || peek() != ':')
+          return false;
+        ++pos;
+        skip_space();
+        json_kind kind {};
+        string value {};
+        if ( ! member_value(kind, value, 0))
+          return false;
+        on_member(std::move(name), kind, std::move(value));
+        skip_space();
+        if ( ! more())
+          return false;
+        char c {text[pos++]};
+        if (c == '}')
+          return at_end();
+        if (c != ',')
+          return false;
+        skip_space();
+      }
+    }
+  };
+
+  json_body_status parse_json_bytes (const char* text, size_t size, const json_member_callback& on_member) {
+    json_parser parser {text, size};
+    if (parser.at_end())
+      return json_body_status::not_json;
+    return parser.body(on_member) ? json_body_status::ok : json_body_status::malformed;
+  }
+
+  /*
+    Check the type and declared length of the body of message: ok if
+    it is to be read
+   */
+  json_body_status check_body (const http_request& message, size_t max_bytes) {
+    const http_headers& headers {message.headers()};
+    auto content_type (headers.find("Content-Type"));
+    if (content_type == headers.end() || ! is_json_type(content_type->second))
+      return json_body_status::not_json;
+    // Refuse a declared length at once; a chunked body is cut off below
+    if (headers.content_length() > max_bytes)
+      return json_body_status::too_large;
+    return json_body_status::ok;
+  }
+
+  /*
+    Read the rest of body into buffer, total bytes having been read
+    so far. The task completes with ok at the end of the body or
+    too_large past max_bytes, and never fails: a body the client
+    breaks off is malformed.
+   */
+  pplx::task<json_body_status> read_rest (concurrency::streams::istream body,
+                                          container_buffer<vector<uint8_t>> buffer,
+                                          size_t total, size_t max_bytes) {
+    return body.read(buffer, body_read_bytes)
+      .then([body, buffer, total, max_bytes] (pplx::task<size_t> read) {
+        size_t count {0};
+        try {
+          count = read.get();
+        }
+        catch (const std::exception& e) {
+          log_info(log_category::request) << "Body not read: " << e.what();
+          return pplx::task_from_result(json_body_status::malformed);
+        }
+        if (count == 0)
+          return pplx::task_from_result(json_body_status::ok);
+        if (total + count > max_bytes)
+          return pplx::task_from_result(json_body_status::too_large);
+        return read_rest(body, buffer, total + count, max_bytes);
+      });
+  }
+
+  // Reply InternalError for a handler that failed with e
+  void reply_handler_failed (const http_request& message, const std::exception& e) {
+    log_error(log_category::request) << "Request failed: " << e.what();
+    try {
+      message.reply(web::http::status_codes::InternalError);
+    }
+    catch (const std::exception& again) {
+      log_error(log_category::request) << "Reply failed: " << again.what();
+    }
+  }
+}
+
+route_handler with_json_body (body_route_handler handler, size_t max_bytes) {
+  return [handler, max_bytes] (http_request message, const route_path& route) {
+    json_body_status checked {check_body(message, max_bytes)};
+    if (checked != json_body_status::ok) {
+      handler(message, route, request_body {checked, string {}});
+      return;
+    }
+    container_buffer<vector<uint8_t>> buffer {};
+    read_rest(message.body(), buffer, 0, max_bytes)
+      .then([message, handler, buffer] (json_body_status status) mutable {
+        try {
+          request_body content {status, string {}};
+          if (status == json_body_status::ok) {
+            const vector<uint8_t>& bytes = buffer.collection();
+            content.text.assign(bytes.begin(), bytes.end());
+          }
+          // The request holds the path for as long as the handler can use it
+          const route_path route {message.request_uri().path()};
+          handler(message, route, content);
+        }
+        catch (const std::exception& e) {
+          reply_handler_failed(message, e);
+        }
+      });
+  };
+}
+
+json_body_status parse_json_object (const string& text, const json_member_callback& on_member) {
+  return parse_json_bytes(text.data(), text.size(), on_member);
+}
+
+json_body_status read_json_object (const request_body& content, const json_member_callback& on_member) {
+  if (content.status != json_body_status::ok)
+    return content.status;
+  return parse_json_object(content.text, on_member);
+}
+
+json_body_status read_json_value (const request_body& content, web::json::value& json) {
+  if (content.status != json_body_status::ok)
+    return content.status;
+  if (content.text.find_first_not_of(" \t\r\n") == string::npos)
+    return json_body_status::not_json;
+  try {
+    json = web::json::value::parse(content.text);
+  }
+  catch (const web::json::json_exception&) {
+    return json_body_status::malformed;
+  }
+  return json_body_status::ok;
+}
+
+unordered_map<string,string> get_json_body (const request_body& content, json_body_status* status) {
+  unordered_map<string,string> results {};
+  json_body_status s {read_json_object(content,
+                                       [&results] (string&& name, json_kind, string&& text) {
+                                         results[std::move(name)] = std::move(text);
+                                       })};
+  if (s != json_body_status::ok)
+    results.clear();
+  if (status)
+    *status = s;
+  return results;
+}
@@ -0,0 +1,98 @@
+#ifndef JsonBody_h
+#define JsonBody_h
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <cpprest/http_listener.h>
+#include <cpprest/json.h>
+
+#include "Routes.h"
+
+/*
+  Decoding of JSON request bodies, shared by the servers.
+
+  The body is read from the request stream without holding a thread
+  (see with_json_body()) and its top-level object decoded in one
+  pass, each member handed straight to the caller as it is parsed,
+  without building a JSON value for the body first.
+
+  A member's value comes with its kind and its text:
+
+    string:     the string, unescaped (\uXXXX escapes become UTF-8)
+    number:     the number as sent, e.g. "19", "-2.5e3"
+    boolean:    "true" or "false"
+    null:       "null"
+    composite:  an array or object, as compact JSON text
+
+  Bodies longer than max_json_body bytes are not read past that
+  length. A body that is valid JSON but not an object has no members.
+ */
+const size_t max_json_body {1024 * 1024};
+
+enum class json_body_status {
+  ok,          // Decoded (possibly with no members)
+  not_json,    // No body, or Content-Type is not application/json
+  too_large,   // Longer than the limit
+  malformed    // Not valid JSON
+};
+
+enum class json_kind { string, number, boolean, null, composite };
+
+using json_member_callback = std::function<void (std::string&& name, json_kind kind, std::string&& text)>;
+
+/*
+  The body of a request, read in full by with_json_body() before its
+  handler runs. status is ok, not_json or too_large; text holds the
+  body only if it is ok.
+ */
+struct request_body {
+  json_body_status status;
+  std::string text;
+};
+
+using body_route_handler = std::function<void (web::http::http_request message, const route_path& route,
+                                               const request_body& content)>;
+
+/*
+  Adapt handler to run once the body of the request is read. The
+  body is read as task continuations, so no thread waits while the
+  client sends it, and no more than max_bytes of it is kept. A
+  request without a JSON body goes to handler at once.
+
+  handler may run on a continuation, after dispatch has returned, so
+  it is passed a route_path over the request's own path. Exceptions
+  from handler are logged and answered with InternalError.
+ */
+route_handler with_json_body (body_route_handler handler, size_t max_bytes = max_json_body);
+
+/*
+  Decode content, calling on_member for each member of its top-level
+  object in the order sent. On any status but ok, some members may
+  already have been passed to on_member.
+ */
+json_body_status read_json_object (const request_body& content, const json_member_callback& on_member);
+
+/*
+  Decode content, of any JSON type, into json as a whole value. For
+  bodies that need the whole value, such as arrays of entities.
+ */
+json_body_status read_json_value (const request_body& content, web::json::value& json);
+
+/*
+  Decode text as above.
+ */
+json_body_status parse_json_object (const std::string& text, const json_member_callback& on_member);
+
+/*
+  Return content as an unordered map of strings to strings: each
+  member's text as above. A member sent twice keeps its last value.
+
+  If content is not a JSON object, or it cannot be decoded, return an
+  empty map, setting *status (if given) to the reason.
+ */
+std::unordered_map<std::string,std::string>
+get_json_body (const request_body& content, json_body_status* status = nullptr);
+#endif
@@ -0,0 +1,217 @@
+#include "Log.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+using std::string;
+
+const size_t Logger::capacity;
+
+namespace {
+  const size_t mask {Logger::capacity - 1};
+
+  // How long the writer waits for lines before looking again
+  const std::chrono::milliseconds poll_interval {10};
+
+  const char* const category_names[log_category_count] {"server", "request", "entity", "storage", "cache"};
+  const char* const level_names[] {"debug", "info", "warning", "error", "off"};
+
+  bool find_name (const char* const names[], size_t count, const string& name, size_t& index) {
+    for (size_t i = 0; i < count; ++i) {
+      if (name == names[i]) {
+        index = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Split "category=value"; category is empty if there is no '='
+  void split_setting (const string& setting, string& category, string& value) {
+    const size_t equals {setting.find('=')};
+    if (equals == string::npos) {
+      category.clear();
+      value = setting;
+      return;
+    }
+    category = setting.substr(0, equals);
+    value = setting.substr(equals + 1);
+  }
+}
+
+/*
+  The ring is the bounded queue of Dmitry Vyukov: the sequence of
+  each slot says whose turn it is. A slot whose sequence equals a
+  position is free for the thread that claims that position, and
+  one whose sequence is a position plus one holds the line queued
+  there, waiting for the writer.
+ */
+Logger::Logger () : slots {new slot[capacity]}, enqueue_pos {0}, dequeue_pos {0}, dropped {0},
+                    lock {}, changed {}, writer {}, stopping {false} {
+  for (size_t i = 0; i < capacity; ++i) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  for (auto& s : settings) {
+    s.level.store(static_cast<int>(log_level::info), std::memory_order_relaxed);
+    s.sample.store(1, std::memory_order_relaxed);
+    s.counter.store(0, std::memory_order_relaxed);
+  }
+  settings[static_cast<size_t>(log_category::entity)].level.store(static_cast<int>(log_level::off),
+                                                                    std::memory_order_relaxed);
+  writer = std::thread {&Logger::run, this};
+}
+
+Logger::~Logger () {
+  stop();
+}
+
+Logger& Logger::instance() {
+  static Logger logger {};
+  return logger;
+}
+
+void Logger::set_level(log_category category, log_level level) {
+  settings[static_cast<size_t>(category)].level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void Logger::set_level(log_level level) {
+  for (auto& s : settings) {
+    s.level.store(static_cast<int>(level), std::memory_order_relaxed);
+  }
+}
+
+void Logger::set_sampling(log_category category, uint32_t every) {
+  settings[static_cast<size_t>(category)].sample.store(every == 0 ? 1 : every, std::memory_order_relaxed);
+}
+
+bool Logger::should_log(log_level level, log_category category) {
+  category_setting& s = settings[static_cast<size_t>(category)];
+  if (static_cast<int>(level) < s.level.load(std::memory_order_relaxed) || level == log_level::off)
+    return false;
+  const uint32_t sample {s.sample.load(std::memory_order_relaxed)};
+  if (sample <= 1)
+    return true;
+  return s.counter.fetch_add(1, std::memory_order_relaxed) % sample == 0;
+}
+
+void Logger::submit(string&& text) {
+  size_t pos {enqueue_pos.load(std::memory_order_relaxed)};
+  slot* s {nullptr};
+  while (true) {
+    s = &slots[pos & mask];
+    const size_t sequence {s->sequence.load(std::memory_order_acquire)};
+    const intptr_t difference {static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos)};
+    if (difference == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if (difference < 0) {
+      // The writer has not yet emptied this slot: the ring is full
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  s->text = std::move(text);
+  s->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool Logger::pop(string& text) {
+  slot& s = slots[dequeue_pos & mask];
+  if (s.sequence.load(std::memory_order_acquire) != dequeue_pos + 1)
+    return false;
+  text.swap(s.text);
+  s.text.clear();
+  s.sequence.store(dequeue_pos + capacity, std::memory_order_release);
+  ++dequeue_pos;
+  return true;
+}
+
+/*
+  Write out what is queued, then wait a little and look again, until
+  stopping. Threads that log never wake the writer, which would cost
+  them a lock; a line waits at most poll_interval.
+ */
+void Logger::run() {
+  string batch {};
+  string line {};
+  uint64_t reported_drops {0};
+  while (true) {
+    bool done {false};
+    {
+      std::unique_lock<std::mutex> l {lock};
+      done = stopping;
+    }
+    batch.clear();
+    while (pop(line)) {
+      batch += line;
+      batch += '\n';
+    }
+    const uint64_t drops {dropped_count()};
+    if (drops != reported_drops) {
+      batch += "Log: " + std::to_string(drops - reported_drops) + " lines dropped\n";
+      reported_drops = drops;
+    }
+    if ( ! batch.empty()) {
+      std::fwrite(batch.data(), 1, batch.size(), stdout);
+      std::fflush(stdout);
+    }
+    if (done)
+      return;
+    std::unique_lock<std::mutex> l {lock};
+    changed.wait_for(l, poll_interval, [this] { return stopping; });
+  }
+}
+
+void Logger::stop() {
+  {
+    std::lock_guard<std::mutex> l {lock};
+    stopping = true;
+  }
+  changed.notify_all();
+  if (writer.joinable())
+    writer.join();
+}
+
+log_line::~log_line () {
+  if (active)
+    Logger::instance().submit(std::move(text));
+}
+
+bool parse_log_level(const string& setting) {
+  string category {};
+  string value {};
+  split_setting(setting, category, value);
+  size_t level {0};
+  if ( ! find_name(level_names, sizeof level_names / sizeof level_names[0], value, level))
+    return false;
+  if (category.empty()) {
+    Logger::instance().set_level(static_cast<log_level>(level));
+    return true;
+  }
+  size_t c {0};
+  if ( ! find_name(category_names, log_category_count, category, c))
+    return false;
+  Logger::instance().set_level(static_cast<log_category>(c), static_cast<log_level>(level));
+  return true;
+}
+
+bool parse_log_sample(const string& setting) {
+  string category {};
+  string value {};
+  split_setting(setting, category, value);
+  size_t c {0};
+  if ( ! find_name(category_names, log_category_count, category, c))
+    return false;
+  char* end {nullptr};
+  const unsigned long every {std::strtoul(value.c_str(), &end, 10)};
+  if (value.empty() || *end != '\0' || every == 0 || every > UINT32_MAX)
+    return false;
+  Logger::instance().set_sampling(static_cast<log_category>(c), static_cast<uint32_t>(every));
+  return true;
+}
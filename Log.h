@@ -0,0 +1,154 @@
+#ifndef Log_h
+#define Log_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+/*
+  Logging shared by the servers.
+
+  Every line has a level and a category. A line is kept if its level
+  is at least the level set for its category and, when the category
+  is sampled, it is one of every N lines of the category. Testing
+  this is a couple of atomic loads, and a line that is not kept is
+  never formatted, so a disabled log on a hot path costs next to
+  nothing.
+
+  Kept lines go into a fixed ring of slots, claimed by the threads
+  that log without taking a lock, and a background thread writes
+  them to standard output in batches, flushing once per batch rather
+  than once per line. When the ring is full, lines are dropped and
+  counted rather than making the thread that logs wait.
+
+  Per-entity lines (category entity) are off by default.
+
+  stop() writes out everything queued; call it before the process
+  exits.
+ */
+enum class log_level {debug, info, warning, error, off};
+
+enum class log_category {
+  server,     // Startup, shutdown and calls to other servers
+  request,    // One line or so per request
+  entity,     // One line per entity scanned, read or written
+  storage,    // Errors and misses from Azure Table Storage
+  cache       // Cache hits and followed scans
+};
+const size_t log_category_count {5};
+
+class Logger {
+public:
+  static const size_t capacity {8192};   // Slots in the ring, a power of two
+
+private:
+  struct slot {
+    std::atomic<size_t> sequence;
+    std::string text;
+  };
+
+  struct category_setting {
+    std::atomic<int> level;
+    std::atomic<uint32_t> sample;     // Keep one line in sample; 1 keeps every line
+    std::atomic<uint32_t> counter;
+  };
+
+  std::unique_ptr<slot[]> slots;
+  std::atomic<size_t> enqueue_pos;
+  size_t dequeue_pos;                 // Only the writer thread touches this
+  category_setting settings[log_category_count];
+  std::atomic<uint64_t> dropped;
+
+  std::mutex lock;                    // Guards stopping, for the writer's waits only
+  std::condition_variable changed;
+  std::thread writer;
+  bool stopping;
+
+  bool pop(std::string& text);
+  void run();
+
+  Logger ();
+
+public:
+  ~Logger ();
+  Logger (const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  static Logger& instance();
+
+  void set_level(log_category category, log_level level);
+  void set_level(log_level level);     // For every category
+  void set_sampling(log_category category, uint32_t every);
+
+  // True if a line of level in category is to be kept
+  bool should_log(log_level level, log_category category);
+
+  // Queue a line, without its newline
+  void submit(std::string&& text);
+
+  void stop();
+
+  // Lines dropped because the ring was full
+  uint64_t dropped_count() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+/*
+  One line of the log, built with << and queued when destroyed.
+  Nothing is formatted if the line is not to be kept.
+ */
+class log_line {
+public:
+  log_line (log_level level, log_category category)
+    : active {Logger::instance().should_log(level, category)}, text {} {}
+  log_line (log_line&& other) : active {other.active}, text {std::move(other.text)} { other.active = false; }
+  ~log_line ();
+  log_line (const log_line&) = delete;
+  log_line& operator=(const log_line&) = delete;
+
+  log_line& operator<< (const std::string& s) { if (active) text += s; return *this; }
+  log_line& operator<< (const char* s) { if (active) text += s; return *this; }
+  log_line& operator<< (char c) { if (active) text += c; return *this; }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value, log_line&>::type operator<< (T n) {
+    if (active)
+      text += std::to_string(n);
+    return *this;
+  }
+
+  // Anything else that can be written to a stream
+  template <typename T>
+  typename std::enable_if< ! std::is_integral<T>::value, log_line&>::type operator<< (const T& v) {
+    if (active) {
+      std::ostringstream s {};
+      s << v;
+      text += s.str();
+    }
+    return *this;
+  }
+
+private:
+  bool active;
+  std::string text;
+};
+
+inline log_line log_debug (log_category category) { return log_line {log_level::debug, category}; }
+inline log_line log_info (log_category category) { return log_line {log_level::info, category}; }
+inline log_line log_warning (log_category category) { return log_line {log_level::warning, category}; }
+inline log_line log_error (log_category category) { return log_line {log_level::error, category}; }
+
+/*
+  Apply a --log-level or --log-sample option value, "category=value"
+  or, for levels, a bare level for every category. Return false if
+  the value is not understood.
+ */
+bool parse_log_level(const std::string& value);
+bool parse_log_sample(const std::string& value);
+#endif
@@ -0,0 +1,353 @@
+#include "MissCache.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+using pplx::extensibility::scoped_critical_section_t;
+
+using std::string;
+
+namespace {
+  // Partition and row keys cannot contain control characters
+  const char key_separator {'\x1f'};
+
+  // 64 Kbit filters with 4 probes: under 1% false positives at 6000 keys
+  constexpr size_t filter_words {1024};
+  constexpr size_t filter_bits {filter_words * 64};
+  constexpr int filter_probes {4};
+  constexpr size_t filter_max_keys {6000};
+
+  constexpr size_t max_misses {100000};
+
+  string join (const string& a, const string& b) {
+    string key {a};
+    key += key_separator;
+    key += b;
+    return key;
+  }
+
+  // Double hashing: probe i is h1 + i*h2
+  void probes (const string& key, size_t (&positions)[filter_probes]) {
+    uint64_t h1 {std::hash<string> {} (key)};
+    uint64_t h2 {(h1 * 0x9E3779B97F4A7C15ULL) | 1};
+    for (int i = 0; i < filter_probes; ++i) {
+      positions[i] = (h1 + i * h2) % filter_bits;
+    }
+  }
+}
+
+void MissCache::key_filter::add(const string& key) {
+  if (bits.empty())
+    bits.assign(filter_words, 0);
+  size_t positions[filter_probes];
+  probes(key, positions);
+  for (size_t pos : positions) {
+    bits[pos / 64] |= uint64_t {1} << (pos % 64);
+  }
+  ++keys;
+}
+
+bool MissCache::key_filter::may_contain(const string& key) const {
+  if (bits.empty())
+    return false;
+  size_t positions[filter_probes];
+  probes(key, positions);
+  for (size_t pos : positions) {
+    if ((bits[pos / 64] & (uint64_t {1} << (pos % 64))) == 0)
+      return false;
+  }
+  return true;
+}
+
+bool MissCache::key_filter::overfull() const {
+  return keys > filter_max_keys;
+}
+
+MissCache::scan_recorder::scan_recorder (MissCache& miss_cache, const string& table_name,
+                                         const string& partition_name, bool covers_table) :
+  cache {miss_cache.filters_on() ? &miss_cache : nullptr},
+  table {table_name},
+  whole_table {covers_table},
+  has_partition {false},
+  partition {},
+  row_build {0},
+  partition_build {0},
+  finished {false}
+{
+  if (cache == nullptr)
+    return;
+  if (whole_table) {
+    partition_build = cache->begin_build(cache->partition_filters, table);
+  }
+  else {
+    // Knowing a partition is empty is worth as much as knowing its rows
+    has_partition = true;
+    partition = partition_name;
+    row_build = cache->begin_build(cache->row_filters, join(table, partition));
+  }
+}
+
+MissCache::scan_recorder::~scan_recorder () {
+  if (cache == nullptr || finished)
+    return;
+  if (has_partition)
+    cache->end_build(cache->row_filters, join(table, partition), row_build, false);
+  if (whole_table)
+    cache->end_build(cache->partition_filters, table, partition_build, false);
+}
+
+void MissCache::scan_recorder::add(const string& partition_key, const string& row_key) {
+  if (cache == nullptr)
+    return;
+  if (whole_table && ( ! has_partition || partition_key != partition)) {
+    if (has_partition)
+      cache->end_build(cache->row_filters, join(table, partition), row_build, true);
+    has_partition = true;
+    partition = partition_key;
+    row_build = cache->begin_row_build(table, partition_build, partition);
+    cache->add_built(cache->partition_filters, table, partition_build, partition);
+  }
+  cache->add_built(cache->row_filters, join(table, partition), row_build, row_key);
+}
+
+void MissCache::scan_recorder::finish() {
+  if (cache == nullptr || finished)
+    return;
+  if (has_partition)
+    cache->end_build(cache->row_filters, join(table, partition), row_build, true);
+  if (whole_table)
+    cache->end_build(cache->partition_filters, table, partition_build, true);
+  finished = true;
+}
+
+void MissCache::set_ttl(std::chrono::milliseconds time_to_live) {
+  scoped_critical_section_t lock {resplock};
+  ttl = time_to_live;
+  if (ttl.count() == 0)
+    misses.clear();
+}
+
+void MissCache::enable_filters(bool enable) {
+  scoped_critical_section_t lock {resplock};
+  filters_enabled = enable;
+  if ( ! enable) {
+    row_filters.clear();
+    partition_filters.clear();
+  }
+}
+
+bool MissCache::filters_on() {
+  scoped_critical_section_t lock {resplock};
+  return filters_enabled;
+}
+
+uint64_t MissCache::generation() {
+  scoped_critical_section_t lock {resplock};
+  return generation_count;
+}
+
+/*
+  Return true if table/partition/row certainly does not exist.
+ */
+bool MissCache::known_missing(const string& table, const string& partition, const string& row) {
+  string partition_key {join(table, partition)};
+
+  scoped_critical_section_t lock {resplock};
+  auto miss (misses.find(join(partition_key, row)));
+  if (miss != misses.end()) {
+    if (miss->second > miss_clock::now()) {
+      ++negative_hits;
+      return true;
+    }
+    misses.erase(miss);
+  }
+
+  if ( ! filters_enabled)
+    return false;
+
+  auto partitions (partition_filters.find(table));
+  if (partitions != partition_filters.end() && partitions->second.complete &&
+      ! partitions->second.filter.may_contain(partition)) {
+    ++filter_hits;
+    return true;
+  }
+  auto rows (row_filters.find(partition_key));
+  if (rows != row_filters.end() && rows->second.complete &&
+      ! rows->second.filter.may_contain(row)) {
+    ++filter_hits;
+    return true;
+  }
+  return false;
+}
+
+/*
+  Return true if table certainly has no entities in partition.
+ */
+bool MissCache::partition_known_missing(const string& table, const string& partition) {
+  scoped_critical_section_t lock {resplock};
+  if ( ! filters_enabled)
+    return false;
+
+  auto partitions (partition_filters.find(table));
+  if (partitions != partition_filters.end() && partitions->second.complete &&
+      ! partitions->second.filter.may_contain(partition)) {
+    ++filter_hits;
+    return true;
+  }
+  auto rows (row_filters.find(join(table, partition)));
+  if (rows != row_filters.end() && rows->second.complete && rows->second.filter.empty()) {
+    ++filter_hits;
+    return true;
+  }
+  return false;
+}
+
+/*
+  Remember that storage reported table/partition/row missing in a read
+  that started when generation() was observed_generation.
+ */
+void MissCache::remember_miss(const string& table, const string& partition, const string& row,
+                              uint64_t observed_generation) {
+  scoped_critical_section_t lock {resplock};
+  if (ttl.count() == 0 || observed_generation != generation_count)
+    return;
+
+  miss_clock::time_point now {miss_clock::now()};
+  if (misses.size() >= max_misses) {
+    for (auto miss = misses.begin(); miss != misses.end(); ) {
+      if (miss->second <= now)
+        miss = misses.erase(miss);
+      else
+        ++miss;
+    }
+    if (misses.size() >= max_misses)
+      misses.clear();
+  }
+  misses[join(join(table, partition), row)] = now + ttl;
+}
+
+void MissCache::note_write(const string& table, const string& partition, const string& row) {
+  string partition_key {join(table, partition)};
+
+  scoped_critical_section_t lock {resplock};
+  ++generation_count;
+  misses.erase(join(partition_key, row));
+  if ( ! filters_enabled)
+    return;
+
+  // Filters still being built take the key too, whether or not their scan sees it
+  auto partitions (partition_filters.find(table));
+  if (partitions != partition_filters.end()) {
+    filter_entry& entry = partitions->second;
+    entry.filter.add(partition);
+    if ( ! entry.complete && ! entry.writes_overflowed) {
+      if (entry.writes.size() < filter_max_keys) {
+        entry.writes.push_back(std::make_pair(partition, row));
+      }
+      else {
+        entry.writes.clear();
+        entry.writes_overflowed = true;
+      }
+    }
+  }
+  auto rows (row_filters.find(partition_key));
+  if (rows != row_filters.end())
+    rows->second.filter.add(row);
+}
+
+void MissCache::drop_partition(const string& table, const string& partition) {
+  scoped_critical_section_t lock {resplock};
+  ++generation_count;
+  row_filters.erase(join(table, partition));
+}
+
+void MissCache::drop_table(const string& table) {
+  string prefix {table};
+  prefix += key_separator;
+
+  scoped_critical_section_t lock {resplock};
+  ++generation_count;
+  partition_filters.erase(table);
+  for (auto rows = row_filters.begin(); rows != row_filters.end(); ) {
+    if (rows->first.compare(0, prefix.size(), prefix) == 0)
+      rows = row_filters.erase(rows);
+    else
+      ++rows;
+  }
+  for (auto miss = misses.begin(); miss != misses.end(); ) {
+    if (miss->first.compare(0, prefix.size(), prefix) == 0)
+      miss = misses.erase(miss);
+    else
+      ++miss;
+  }
+}
+
+MissCache::stats_t MissCache::stats() {
+  scoped_critical_section_t lock {resplock};
+  return stats_t {misses.size(), negative_hits, row_filters.size(), filter_hits};
+}
+
+uint64_t MissCache::begin_build(std::unordered_map<string,filter_entry>& filters, const string& key) {
+  scoped_critical_section_t lock {resplock};
+  filter_entry& entry = filters[key];
+  entry.filter = key_filter {};
+  entry.complete = false;
+  entry.build_id = next_build_id++;
+  entry.writes.clear();
+  entry.writes_overflowed = false;
+  entry.missed_writes = false;
+  return entry.build_id;
+}
+
+/*
+  Begin the row filter of partition for the whole-table scan building
+  the partition filter of table as table_build, taking the writes to
+  the partition logged since that scan began. If the log is gone or
+  overflowed, the row filter may lack a row and will not complete.
+ */
+uint64_t MissCache::begin_row_build(const string& table, uint64_t table_build, const string& partition) {
+  uint64_t build_id {begin_build(row_filters, join(table, partition))};
+
+  scoped_critical_section_t lock {resplock};
+  auto rows (row_filters.find(join(table, partition)));
+  if (rows == row_filters.end() || rows->second.build_id != build_id)
+    return build_id;
+  auto partitions (partition_filters.find(table));
+  if (partitions == partition_filters.end() || partitions->second.build_id != table_build ||
+      partitions->second.writes_overflowed) {
+    rows->second.missed_writes = true;
+    return build_id;
+  }
+  for (const auto& write : partitions->second.writes) {
+    if (write.first == partition)
+      rows->second.filter.add(write.second);
+  }
+  return build_id;
+}
+
+void MissCache::add_built(std::unordered_map<string,filter_entry>& filters, const string& key,
+                          uint64_t build_id, const string& value) {
+  scoped_critical_section_t lock {resplock};
+  auto entry (filters.find(key));
+  if (entry != filters.end() && entry->second.build_id == build_id)
+    entry->second.filter.add(value);
+}
+
+void MissCache::end_build(std::unordered_map<string,filter_entry>& filters, const string& key,
+                          uint64_t build_id, bool succeeded) {
+  scoped_critical_section_t lock {resplock};
+  auto entry (filters.find(key));
+  if (entry == filters.end() || entry->second.build_id != build_id)
+    return;
+  if (succeeded && ! entry->second.filter.overfull() && ! entry->second.missed_writes) {
+    entry->second.complete = true;
+    entry->second.writes.clear();
+    entry->second.writes.shrink_to_fit();
+  }
+  else {
+    filters.erase(entry);
+  }
+}
@@ -0,0 +1,160 @@
+#ifndef MissCache_h
+#define MissCache_h
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  Answers "this entity certainly does not exist" without going to storage.
+
+  Two sources of knowledge are kept:
+
+  Negative entries: a point read that storage answered NotFound is
+    remembered for a short time-to-live (0 disables them).
+
+  Key filters (optional): Bloom filters of the row keys of a partition
+    and of the partition keys of a table, built from complete scans and
+    kept current as this server writes. A key absent from a complete
+    filter certainly does not exist. Filters assume that every write to
+    the table goes through this server, which is why they are off by
+    default.
+
+  Every write of an entity must be reported with note_write(), after
+  storage has completed it, so that neither source claims a written
+  entity is missing. As in EntityCache, readers capture generation()
+  before going to storage and pass it to remember_miss(), which drops
+  the miss if a write was noted in between.
+ */
+class MissCache {
+private:
+  using miss_clock = std::chrono::steady_clock;
+
+  /*
+    Fixed-size Bloom filter over strings.
+
+    A filter that would hold more than max_keys keys has too many
+    false positives to be worth keeping and reports itself overfull.
+   */
+  class key_filter {
+  private:
+    std::vector<uint64_t> bits;
+    size_t keys;
+  public:
+    key_filter () : bits {}, keys {0} {};
+    void add(const std::string& key);
+    bool may_contain(const std::string& key) const;
+    bool empty() const { return keys == 0; };
+    bool overfull() const;
+  };
+
+  /*
+    While a table's partition filter is being built by a whole-table
+    scan, the writes noted for the table are also logged, so that a
+    row filter the scan starts part way through can take the writes
+    that landed before it started. A row filter that may have missed
+    a write (missed_writes) is dropped rather than completed.
+   */
+  struct filter_entry {
+    key_filter filter;
+    bool complete;
+    uint64_t build_id;
+    std::vector<std::pair<std::string,std::string>> writes;   // Partition and row
+    bool writes_overflowed;                                     // Too many to log
+    bool missed_writes;
+  };
+
+  std::unordered_map<std::string,miss_clock::time_point> misses;
+  std::unordered_map<std::string,filter_entry> row_filters;        // Keyed by table/partition
+  std::unordered_map<std::string,filter_entry> partition_filters;  // Keyed by table
+  std::chrono::milliseconds ttl;
+  bool filters_enabled;
+  uint64_t next_build_id;
+  uint64_t generation_count;
+  uint64_t negative_hits;
+  uint64_t filter_hits;
+  pplx::extensibility::critical_section_t resplock;
+
+  uint64_t begin_build(std::unordered_map<std::string,filter_entry>& filters, const std::string& key);
+  uint64_t begin_row_build(const std::string& table, uint64_t table_build, const std::string& partition);
+  void add_built(std::unordered_map<std::string,filter_entry>& filters, const std::string& key,
+                 uint64_t build_id, const std::string& value);
+  void end_build(std::unordered_map<std::string,filter_entry>& filters, const std::string& key,
+                 uint64_t build_id, bool succeeded);
+
+public:
+  /*
+    Records the keys seen by a scan that covers a whole partition
+    (whole_table false) or a whole table (whole_table true), and turns
+    them into key filters when the scan finishes.
+
+    Entities must be added in storage order, that is, grouped by
+    partition. A scan that is destroyed without finish() builds nothing.
+
+    Construct the recorder before issuing the scan's query: the
+    writes noted from then on reach every filter it builds, including
+    row filters of a whole-table scan started only when the first row
+    of their partition arrives.
+   */
+  class scan_recorder {
+  private:
+    MissCache* cache;
+    std::string table;
+    bool whole_table;
+    bool has_partition;
+    std::string partition;
+    uint64_t row_build;
+    uint64_t partition_build;
+    bool finished;
+  public:
+    scan_recorder (MissCache& miss_cache, const std::string& table_name,
+                   const std::string& partition_name, bool covers_table);
+    ~scan_recorder ();
+    scan_recorder (const scan_recorder&) = delete;
+    scan_recorder& operator= (const scan_recorder&) = delete;
+    void add(const std::string& partition_key, const std::string& row_key);
+    void finish();
+  };
+
+  struct stats_t {
+    uint64_t negative_entries;
+    uint64_t negative_hits;
+    uint64_t row_filters;
+    uint64_t filter_hits;
+  };
+
+  MissCache () :
+    misses {},
+    row_filters {},
+    partition_filters {},
+    ttl {2000},
+    filters_enabled {false},
+    next_build_id {1},
+    generation_count {0},
+    negative_hits {0},
+    filter_hits {0},
+    resplock {}
+    {};
+
+  void set_ttl(std::chrono::milliseconds time_to_live);
+  void enable_filters(bool enable);
+  bool filters_on();
+  uint64_t generation();
+
+  bool known_missing(const std::string& table, const std::string& partition, const std::string& row);
+  bool partition_known_missing(const std::string& table, const std::string& partition);
+  void remember_miss(const std::string& table, const std::string& partition, const std::string& row,
+                     uint64_t observed_generation);
+  void note_write(const std::string& table, const std::string& partition, const std::string& row);
+  void drop_partition(const std::string& table, const std::string& partition);
+  void drop_table(const std::string& table);
+
+  stats_t stats();
+};
+
+#endif
@@ -20,6 +20,9 @@
 #include <was/storage_account.h>
 #include <was/table.h>
 
+#include "JsonBody.h"
+#include "Log.h"
+#include "Routes.h"
 #include "TableCache.h"
 #include "make_unique.h"
 
@@ -72,6 +75,7 @@ const string create_table {"CreateTableAdmin"};
 const string delete_table {"DeleteTableAdmin"};
 
 const string read_entity_admin {"ReadEntityAdmin"};
+const string read_entities_admin {"ReadEntitiesAdmin"};
 const string update_entity_admin {"UpdateEntityAdmin"};
 const string delete_entity_admin {"DeleteEntityAdmin"};
 
@@ -108,122 +112,96 @@ const string data_table_name {"DataTable"};
 }*/
 
 /*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-
-  If the message has no JSON body, return an empty map.
+  PushStatus/<partition>/<row>/<status>: append the status to the
+  Updates of every friend in the Friends list of the body
+ */
+void handle_push_status (http_request message, const route_path& route, const request_body& content) {
+  const string user_status {route[3]};
+
+  // Extract info from original message to obtain the password
+  json_body_status body_status {json_body_status::ok};
+  unordered_map<string,string> json_body {get_json_body (content, &body_status)};
+  if (body_status == json_body_status::too_large) {
+    message.reply(status_codes::RequestEntityTooLarge);
+    return;
+  }
+  if (body_status == json_body_status::malformed) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+  string friend_list {json_body["Friends"]};
 
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
+  // Obtain a vector containing all the information about the users friends
+  friends_list_t user_friends {parse_friends_list(friend_list)};
 
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
- */
-unordered_map<string,string> get_json_body(http_request message) {  
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-    {
-            json = v;
-      return true;
-    })
-    .wait();
-
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-  results[v.first] = v.second.as_string();
-      }
-      else {
-  results[v.first] = v.second.serialize();
-      }
+  // Read every friend's entity with a single request to BasicServer
+  vector<value> friend_keys {};
+  for (const auto& f : user_friends) {
+    friend_keys.push_back(build_json_value("Partition", f.first, "Row", f.second));
+  }
+  pair<status_code,value> friend_props {do_request (methods::GET,
+                                                    basic_url +
+                                                    read_entities_admin + "/" +
+                                                    data_table_name,
+                                                    value::array(friend_keys))};
+  assert(friend_props.first == status_codes::OK);
+
+  string friend_country, friend_name;
+
+  auto it = user_friends.begin();
+  while (it != user_friends.end()) {
+
+    // Get the partition and the row of the friend
+    friend_country = it->first;
+    friend_name = it->second;
+
+    // Dont assert because no guarantees the friends are in the table
+    // Check if the friend was in DataTable; should return OK if was inside
+    value friend_prop {friend_props.second[friend_country][friend_name]};
+    if (friend_prop.has_field("Status") &&
+        friend_prop.at("Status").as_integer() == status_codes::OK) {
+
+      // Obtain a string correspondin to the friends current value for the property "Updates"
+      string friend_updates {get_json_object_prop(friend_prop.at("Entity"), prop_updates)};
+
+      // Given the string for the friends current "Updates" property, concatenate the new status and add "\n" to the end of it
+      friend_updates = friend_updates+user_status+"\n";
+
+      // Build a new json value for the property "Friends" using the edited friend list
+      pair<string,string> new_updates_property {make_pair(prop_updates, friend_updates)};
+      value new_properties {build_json_value(new_updates_property)};
+
+      // Make a request to the BasicServer to update the property "Updates" for the friend
+      pair<status_code,value> update_properties {do_request (methods::PUT,
+                                                     basic_url +
+                                                     update_entity_admin + "/" +
+                                                     data_table_name + "/" +
+                                                     friend_country + "/" +
+                                                     friend_name,
+                                                     new_properties)};
+      assert(update_properties.first == status_codes::OK);
     }
+
+    // Go to next friend
+    it++;
   }
-  return results;
+
+  // After the while loop has completed, PushServer has made an attempt to update the property "Updates" for all friends of the user
+  message.reply(status_codes::OK);
+  return;
 }
 
+const route_table post_routes {vector<route> {
+    {push_status_op, 4, 4, with_json_body(handle_push_status)}
+  }};
+
 /*
   Top-level routine for processing all HTTP POST requests.
  */
 void handle_post(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-  auto paths = uri::split_path(path);
-
-  if (paths[0] == push_status_op) {
-
-    const string user_status {paths[3]};
-
-    // Extract info from original message to obtain the password
-    unordered_map<string,string> json_body {get_json_body (message)};
-    string friend_list {json_body["Friends"]};
-
-    // Obtain a vector containing all the information about the users friends
-    friends_list_t user_friends {parse_friends_list(friend_list)};
-
-    string friend_country, friend_name;
-
-    auto it = user_friends.begin();
-    while (it != user_friends.end()) {
-
-      // Get the partition and the row of the friend
-      friend_country = it->first;
-      friend_name = it->second;
-
-      // Obtain the users properties through an admin GET using BasicServer
-      pair<status_code,value> friend_prop {do_request (methods::GET,
-                                                       basic_url +
-                                                       read_entity_admin + "/" +
-                                                       data_table_name + "/" +
-                                                       friend_country + "/" +
-                                                       friend_name)};
-      // Dont assert because no guarantees the friends are in the table
-      // Check if the friend was in DataTable; should return OK if was inside
-      if (friend_prop.first == status_codes::OK) {
-
-        // Obtain a string correspondin to the friends current value for the property "Updates"
-        string friend_updates {get_json_object_prop(friend_prop.second, prop_updates)};
-
-        // Given the string for the friends current "Updates" property, concatenate the new status and add "\n" to the end of it
-        friend_updates = friend_updates+user_status+"\n";
-
-        // Build a new json value for the property "Friends" using the edited friend list
-        pair<string,string> new_updates_property {make_pair(prop_updates, friend_updates)};
-        value new_properties {build_json_value(new_updates_property)};
-
-        // Make a request to the BasicServer to update the property "Updates" for the friend
-        pair<status_code,value> update_properties {do_request (methods::PUT,
-                                                       basic_url +
-                                                       update_entity_admin + "/" +
-                                                       data_table_name + "/" +
-                                                       friend_country + "/" +
-                                                       friend_name,
-                                                       new_properties)};
-        assert(update_properties.first == status_codes::OK);
-      }
-
-      // Go to next friend
-      it++;
-    }
-
-    // After the while loop has completed, PushServer has made an attempt to update the property "Updates" for all friends of the user
-    message.reply(status_codes::OK);
-    return;
-  }
-
-  // No more accepted commands beyond this point
-  // Return BadRequest due to possible malformed request
-  message.reply(status_codes::BadRequest);
-  return;
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** POST " << path;
+  post_routes.dispatch(message, route_path {path});
 }
 
 /*
@@ -235,10 +213,10 @@ void handle_post(http_request message) {
   Wait for a carriage return, then shut the server down.
  */
 int main (int argc, char const * argv[]) {
-  cout << "PushServer Open" << endl;
-  cout << "Parsing connection string" << endl;
+  log_info(log_category::server) << "PushServer Open";
+  log_info(log_category::server) << "Parsing connection string";
 
-  cout << "Opening listener" << endl;
+  log_info(log_category::server) << "Opening listener";
   http_listener listener {def_url};
   //listener.support(methods::GET, &handle_get);
   listener.support(methods::POST, &handle_post);
@@ -252,6 +230,7 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  Logger::instance().stop();
   cout << "Closed" << endl;
 }
 
@@ -0,0 +1,191 @@
+#include "RangeScan.h"
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+using azure::storage::cloud_table;
+using azure::storage::continuation_token;
+using azure::storage::table_entity;
+using azure::storage::table_query;
+using azure::storage::table_query_segment;
+
+using std::string;
+using std::vector;
+
+namespace {
+  // Boundaries are two characters from ' ' to '~'
+  constexpr int first_char {0x20};
+  constexpr int chars {0x7f - first_char};
+  constexpr int positions {chars * chars};
+
+  int char_digit (const string& key, size_t i) {
+    if (i >= key.size())
+      return 0;
+    int c {static_cast<unsigned char>(key[i])};
+    if (c < first_char)
+      return 0;
+    if (c >= first_char + chars)
+      return chars - 1;
+    return c - first_char;
+  }
+
+  int key_position (const string& key) {
+    return char_digit(key, 0) * chars + char_digit(key, 1);
+  }
+
+  string position_key (int position) {
+    string key {};
+    key += static_cast<char>(first_char + position / chars);
+    key += static_cast<char>(first_char + position % chars);
+    return key;
+  }
+
+  /*
+    The state the scans of one scan_key_ranges() call share
+   */
+  struct range_scans {
+    cloud_table table;
+    std::function<string (const table_entity&)> format;
+    std::function<pplx::task<void> (const string&)> write;
+
+    std::mutex lock;                  // Guards the rest
+    pplx::task<void> writes;          // Last piece queued to write
+    bool stopped;
+    std::exception_ptr error;
+  };
+
+  /*
+    Queue piece to be written after the pieces already queued. The
+    task completes once it has been written.
+   */
+  pplx::task<void> queue_piece (std::shared_ptr<range_scans> scans, string piece) {
+    std::lock_guard<std::mutex> l {scans->lock};
+    scans->writes = scans->writes.then([scans, piece] {
+        return scans->write(piece);
+      });
+    return scans->writes;
+  }
+
+  void stop_scans (range_scans& scans, std::exception_ptr error) {
+    std::lock_guard<std::mutex> l {scans.lock};
+    if ( ! scans.error)
+      scans.error = error;
+    scans.stopped = true;
+  }
+
+  bool scans_stopped (range_scans& scans) {
+    std::lock_guard<std::mutex> l {scans.lock};
+    return scans.stopped;
+  }
+
+  /*
+    Scan range_query from token on, a segment at a time, each after
+    the last one's piece has been written
+   */
+  pplx::task<void> scan_range (std::shared_ptr<range_scans> scans, const table_query& range_query,
+                               const continuation_token& token) {
+    return scans->table.execute_query_segmented_async(range_query, token)
+      .then([scans, range_query] (table_query_segment segment) {
+          if (scans_stopped(*scans))
+            return pplx::task_from_result();
+          string piece {};
+          for (const auto& entity : segment.results()) {
+            piece += scans->format(entity);
+          }
+          const continuation_token next {segment.continuation_token()};
+          pplx::task<void> written {piece.empty() ? pplx::task_from_result()
+                                                  : queue_piece(scans, std::move(piece))};
+          return written.then([scans, range_query, next] {
+              if (next.empty() || scans_stopped(*scans))
+                return pplx::task_from_result();
+              return scan_range(scans, range_query, next);
+            });
+        });
+  }
+}
+
+vector<key_range> split_key_range (const key_range& range, size_t parts) {
+  int low {key_position(range.first)};
+  int high {range.second.empty() ? positions : key_position(range.second)};
+
+  // Interior boundaries must lie strictly inside the range, in order
+  vector<key_range> ranges {};
+  string from {range.first};
+  for (size_t i = 1; i < parts && high > low; ++i) {
+    string boundary {position_key(low + static_cast<int>((high - low) * i / parts))};
+    if (boundary <= from || ( ! range.second.empty() && boundary >= range.second))
+      continue;
+    ranges.push_back(key_range {from, boundary});
+    from = boundary;
+  }
+  ranges.push_back(key_range {from, range.second});
+  return ranges;
+}
+
+string key_range_filter (const key_range& range) {
+  string from_filter {};
+  if ( ! range.first.empty())
+    from_filter = table_query::generate_filter_condition("PartitionKey",
+                                                         azure::storage::query_comparison_operator::greater_than_or_equal,
+                                                         range.first);
+  if (range.second.empty())
+    return from_filter;
+
+  string to_filter {table_query::generate_filter_condition("PartitionKey",
+                                                           azure::storage::query_comparison_operator::less_than,
+                                                           range.second)};
+  if (from_filter.empty())
+    return to_filter;
+  return table_query::combine_filter_conditions(from_filter, azure::storage::query_logical_operator::op_and, to_filter);
+}
+
+pplx::task<void> scan_key_ranges (const cloud_table& table,
+                                  const table_query& query,
+                                  const vector<key_range>& ranges,
+                                  const std::function<string (const table_entity&)>& format,
+                                  const std::function<pplx::task<void> (const string&)>& write) {
+  auto scans = std::make_shared<range_scans>();
+  scans->table = table;
+  scans->format = format;
+  scans->write = write;
+  scans->writes = pplx::task_from_result();
+  scans->stopped = false;
+
+  vector<pplx::task<void>> running {};
+  for (const auto& range : ranges) {
+    table_query range_query {query};
+    string filter {key_range_filter(range)};
+    if ( ! query.filter_string().empty() && ! filter.empty())
+      filter = table_query::combine_filter_conditions(query.filter_string(),
+                                                      azure::storage::query_logical_operator::op_and,
+                                                      filter);
+    else if (filter.empty())
+      filter = query.filter_string();
+    range_query.set_filter_string(filter);
+
+    running.push_back(scan_range(scans, range_query, continuation_token {})
+      .then([scans] (pplx::task<void> scan) {
+          try {
+            scan.get();
+          }
+          catch (...) {
+            stop_scans(*scans, std::current_exception());
+          }
+        }));
+  }
+
+  return pplx::when_all(running.begin(), running.end())
+    .then([scans] {
+        std::lock_guard<std::mutex> l {scans->lock};
+        if (scans->error)
+          std::rethrow_exception(scans->error);
+      });
+}
@@ -0,0 +1,57 @@
+#ifndef RangeScan_h
+#define RangeScan_h
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+/*
+  Scanning a table as several partition-key ranges at once.
+
+  A range is a pair (from, to) of partition keys: from is inclusive
+  and to exclusive, and an empty string leaves that end unbounded.
+ */
+using key_range = std::pair<std::string,std::string>;
+
+/*
+  Split range into at most parts ranges that cover it exactly.
+
+  Storage gives no key distribution, so the split is by the first
+  two characters of the key, evenly over printable ASCII. Keys
+  outside printable ASCII all fall in the first or last range.
+ */
+std::vector<key_range> split_key_range (const key_range& range, size_t parts);
+
+/*
+  Return the filter condition selecting the partitions in range, or
+  an empty string if range is unbounded at both ends.
+ */
+std::string key_range_filter (const key_range& range);
+
+/*
+  Scan every range of ranges concurrently, each with query restricted
+  to its range, and pass the text of each entity, as made by format,
+  to write.
+
+  The text of a storage segment is written as one piece, as segments
+  arrive from any range; pieces of different ranges interleave. write
+  is called for one piece at a time, in order, and returns a task: a
+  range fetches its next segment only once its last piece has been
+  written, so a writer that falls behind holds the scans up rather
+  than letting pieces pile up.
+
+  Everything runs as task continuations, so this returns at once. If a
+  scan or write fails, the other scans stop at their next segment and
+  the task fails with the first exception once all have stopped.
+ */
+pplx::task<void> scan_key_ranges (const azure::storage::cloud_table& table,
+                                  const azure::storage::table_query& query,
+                                  const std::vector<key_range>& ranges,
+                                  const std::function<std::string (const azure::storage::table_entity&)>& format,
+                                  const std::function<pplx::task<void> (const std::string&)>& write);
+#endif
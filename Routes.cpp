@@ -0,0 +1,80 @@
+#include "Routes.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cpprest/base_uri.h>
+#include <cpprest/http_listener.h>
+
+using std::string;
+using std::vector;
+
+using web::http::http_request;
+using web::http::status_code;
+using web::http::status_codes;
+
+using web::uri;
+
+const size_t route_path::max_segments;
+
+route_path::route_path (const string& p) : path {&p}, starts {}, lengths {}, count {0}, overflowed {false} {
+  size_t start {0};
+  while (start < p.size()) {
+    size_t end {p.find('/', start)};
+    if (end == string::npos)
+      end = p.size();
+    if (end > start) {
+      if (count == max_segments) {
+        overflowed = true;
+        return;
+      }
+      starts[count] = start;
+      lengths[count] = end - start;
+      ++count;
+    }
+    start = end + 1;
+  }
+}
+
+int route_path::compare (size_t i, const string& text) const {
+  return path->compare(starts[i], lengths[i], text);
+}
+
+string route_path::operator[] (size_t i) const {
+  string segment {*path, starts[i], lengths[i]};
+  if (segment.find('%') != string::npos)
+    return uri::decode(segment);
+  return segment;
+}
+
+route_table::route_table (vector<route> table, status_code unknown_status)
+  : routes {std::move(table)}, unknown {unknown_status} {
+  std::sort(routes.begin(), routes.end(),
+            [] (const route& a, const route& b) { return a.operation < b.operation; });
+}
+
+const route* route_table::find (const route_path& path) const {
+  if (path.size() == 0)
+    return nullptr;
+  auto found = std::lower_bound(routes.begin(), routes.end(), path,
+                                [] (const route& r, const route_path& p) { return p.compare(0, r.operation) > 0; });
+  if (found == routes.end() || path.compare(0, found->operation) != 0)
+    return nullptr;
+  return &*found;
+}
+
+void route_table::dispatch (http_request message, const route_path& path) const {
+  const route* r {find(path)};
+  if (r == nullptr) {
+    message.reply(unknown);
+    return;
+  }
+  if (path.overflow() || path.size() < r->min_segments || path.size() > r->max_segments) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+  r->handler(message, path);
+}
+
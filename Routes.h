@@ -0,0 +1,96 @@
+#ifndef Routes_h
+#define Routes_h
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+
+/*
+  Dispatch of requests by operation, the first segment of the path,
+  shared by the servers.
+
+  A route_path splits the path of a request into segments without
+  copying it: each segment is a view into the request's own URI,
+  decoded only when a handler asks for it. Segments are decoded one
+  at a time, after splitting, so an encoded '/' (%2F), as in SAS
+  tokens, stays inside its segment. Empty segments are skipped, as
+  uri::split_path() skips them.
+
+  A route_table is built once at startup. It finds the route for an
+  operation by binary search over its sorted names and checks the
+  number of segments the route takes, so a request reaches its
+  handler, or is refused with BadRequest, without allocating.
+
+  Handlers take the route_path itself and decode only the segments
+  they use, each once, into the string the storage call needs. The
+  operation is only ever compared, never decoded.
+ */
+class route_path {
+public:
+  static const size_t max_segments {8};
+
+  // path must outlive the route_path
+  explicit route_path (const std::string& path);
+
+  // Number of segments, counting the operation
+  size_t size () const { return count; }
+
+  // True if the path had more than max_segments segments
+  bool overflow () const { return overflowed; }
+
+  // Compare segment i, as sent, with text (which needs no decoding)
+  int compare (size_t i, const std::string& text) const;
+  bool equals (size_t i, const std::string& text) const { return i < count && compare(i, text) == 0; }
+
+  // Segment i, decoded
+  std::string operator[] (size_t i) const;
+
+  const std::string& text () const { return *path; }
+
+private:
+  const std::string* path;
+  size_t starts[max_segments];
+  size_t lengths[max_segments];
+  size_t count;
+  bool overflowed;
+};
+
+using route_handler = std::function<void (web::http::http_request message, const route_path& route)>;
+
+/*
+  An operation and the handler for it.
+
+  min_segments and max_segments bound the segments of the path,
+  counting the operation; paths outside them get BadRequest.
+ */
+struct route {
+  std::string operation;
+  size_t min_segments;
+  size_t max_segments;
+  route_handler handler;
+};
+
+class route_table {
+public:
+  // Requests for operations not in table get unknown_status
+  explicit route_table (std::vector<route> table,
+                        web::http::status_code unknown_status = web::http::status_codes::BadRequest);
+
+  // The route for the operation of path, or nullptr if there is none
+  const route* find (const route_path& path) const;
+
+  /*
+    Call the handler of the route for message, whose path is path.
+    Reply unknown_status if there is no such route, or BadRequest if
+    the path does not have the number of segments it takes.
+   */
+  void dispatch (web::http::http_request message, const route_path& path) const;
+
+private:
+  std::vector<route> routes;   // Sorted by operation
+  web::http::status_code unknown;
+};
+#endif
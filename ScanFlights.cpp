@@ -0,0 +1,255 @@
+#include "ScanFlights.h"
+
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <cpprest/producerconsumerstream.h>
+
+using concurrency::streams::producer_consumer_buffer;
+
+using std::string;
+
+using web::http::http_request;
+using web::http::http_response;
+using web::http::status_code;
+using web::http::status_codes;
+
+namespace {
+  // Table names cannot contain control characters
+  const char key_separator {'\x1f'};
+
+  /*
+    Queue a write of piece to body after the writes already queued.
+    The task never fails: a follower that has gone just stops taking
+    writes.
+   */
+  pplx::task<void> queue_write (const pplx::task<void>& writes, producer_consumer_buffer<uint8_t> body,
+                                std::shared_ptr<const string> piece) {
+    return writes.then([body, piece] () mutable {
+        return body.putn(reinterpret_cast<const uint8_t*>(piece->data()), piece->size())
+          .then([piece] (pplx::task<size_t> written) {
+              try {
+                written.get();
+              }
+              catch (const std::exception&) {
+              }
+            });
+      });
+  }
+
+  // Queue the end of body, with an error if the scan failed
+  pplx::task<void> queue_close (const pplx::task<void>& writes, producer_consumer_buffer<uint8_t> body,
+                                bool scan_failed) {
+    return writes.then([body, scan_failed] () mutable {
+        pplx::task<void> closed {scan_failed
+            ? body.close(std::ios_base::out, std::make_exception_ptr(std::runtime_error {"Shared scan failed"}))
+            : body.close(std::ios_base::out)};
+        return closed.then([] (pplx::task<void> c) {
+            try {
+              c.get();
+            }
+            catch (const std::exception&) {
+            }
+          });
+      });
+  }
+}
+
+constexpr size_t ScanFlight::max_retained;
+
+/*
+  Drop the pieces no current or future follower can need: once the
+  flight takes no more followers and every follower has been given
+  what was appended so far.
+
+  Caller must hold lock.
+ */
+void ScanFlight::trim() {
+  if (joinable)
+    return;
+  for (const auto& f : followers) {
+    if ( ! f.streaming)
+      return;
+  }
+  pieces.clear();
+  retained_bytes = 0;
+}
+
+/*
+  Reply to follower f with a chunked response and queue the pieces so
+  far on it.
+
+  Caller must hold lock.
+ */
+void ScanFlight::start_streaming(follower& f) {
+  http_response response {status};
+  response.set_body(f.body.create_istream(), "application/json");
+  f.message.reply(response);
+  f.streaming = true;
+  for (const auto& piece : pieces) {
+    f.writes = queue_write(f.writes, f.body, piece);
+  }
+}
+
+/*
+  End follower f, which has been handed over, now that the leader is
+  done.
+
+  Caller must hold lock.
+ */
+void ScanFlight::end_follower(follower& f) {
+  if (f.streaming) {
+    f.writes = queue_close(f.writes, f.body, failed);
+    return;
+  }
+  f.streaming = true;         // Nothing more to give it
+  if ( ! sealed || failed) {
+    f.message.reply(status_codes::InternalError);
+    return;
+  }
+  // The whole body is here, so it goes out at once
+  string body {};
+  for (const auto& piece : pieces) {
+    body += *piece;
+  }
+  f.message.reply(status, body, "application/json");
+}
+
+void ScanFlight::seal(status_code reply_status) {
+  std::lock_guard<std::mutex> l {lock};
+  status = reply_status;
+  sealed = true;
+  for (auto& f : followers) {
+    if (f.attached && ! f.streaming)
+      start_streaming(f);
+  }
+  trim();
+}
+
+void ScanFlight::append(const string& piece) {
+  std::lock_guard<std::mutex> l {lock};
+  piece_ptr shared {std::make_shared<const string>(piece)};
+  pieces.push_back(shared);
+  retained_bytes += piece.size();
+  if (retained_bytes > max_retained)
+    joinable = false;
+  for (auto& f : followers) {
+    if (f.streaming)
+      f.writes = queue_write(f.writes, f.body, shared);
+  }
+  trim();
+}
+
+void ScanFlight::finish() {
+  std::lock_guard<std::mutex> l {lock};
+  if (done)
+    return;
+  done = true;
+  joinable = false;
+  for (auto& f : followers) {
+    if (f.attached)
+      end_follower(f);
+  }
+}
+
+void ScanFlight::fail() {
+  std::lock_guard<std::mutex> l {lock};
+  if (done)
+    return;
+  failed = true;
+  done = true;
+  joinable = false;
+  for (auto& f : followers) {
+    if (f.attached)
+      end_follower(f);
+  }
+  pieces.clear();
+  retained_bytes = 0;
+}
+
+bool ScanFlight::add_follower(size_t& follower_id) {
+  std::lock_guard<std::mutex> l {lock};
+  if ( ! joinable)
+    return false;
+  follower_id = followers.size();
+  followers.push_back(follower {false, false, http_request {}, producer_consumer_buffer<uint8_t> {},
+                                pplx::task_from_result()});
+  return true;
+}
+
+/*
+  Hand message over to the flight.
+
+  If the leader has already finished, the whole body goes out at
+  once. If it has sealed the reply, the reply is chunked and every
+  piece so far is queued on it, later pieces following as the leader
+  appends them; if the leader fails part way, the body is closed with
+  an error, as the leader's own reply is. Otherwise the reply waits
+  for seal().
+ */
+void ScanFlight::follow(http_request message, size_t follower_id) {
+  std::lock_guard<std::mutex> l {lock};
+  follower& f = followers[follower_id];
+  f.message = message;
+  f.attached = true;
+  if (done)
+    end_follower(f);
+  else if (sealed) {
+    start_streaming(f);
+  }
+  trim();
+}
+
+ScanFlights::lead::lead (ScanFlights& flights, const string& table_name, const string& scan_key,
+                         const flight_ptr& flight)
+  : registry (flights), key {table_name + key_separator + scan_key}, held {flight} {}
+
+ScanFlights::lead::~lead () {
+  held->fail();
+  registry.leave(key, held);
+}
+
+void ScanFlights::leave(const string& key, const flight_ptr& flight) {
+  std::lock_guard<std::mutex> l {lock};
+  auto found = flights.find(key);
+  if (found != flights.end() && found->second == flight)
+    flights.erase(found);
+}
+
+/*
+  Join the scan of table_name identified by scan_key, starting a new
+  flight if none is in progress or the current one takes no more
+  followers.
+ */
+ScanFlights::joined ScanFlights::join(const string& table_name, const string& scan_key) {
+  const string key {table_name + key_separator + scan_key};
+  std::lock_guard<std::mutex> l {lock};
+  auto found = flights.find(key);
+  size_t follower_id {0};
+  if (found != flights.end() && found->second->add_follower(follower_id)) {
+    ++coalesced;
+    return joined {found->second, false, follower_id};
+  }
+  flight_ptr flight {std::make_shared<ScanFlight>()};
+  flights[key] = flight;
+  return joined {flight, true, 0};
+}
+
+void ScanFlights::detach_table(const string& table_name) {
+  const string prefix {table_name + key_separator};
+  std::lock_guard<std::mutex> l {lock};
+  for (auto it = flights.begin(); it != flights.end(); ) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0)
+      it = flights.erase(it);
+    else
+      ++it;
+  }
+}
+
+uint64_t ScanFlights::coalesced_count() {
+  std::lock_guard<std::mutex> l {lock};
+  return coalesced;
+}
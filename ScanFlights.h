@@ -0,0 +1,140 @@
+#ifndef ScanFlights_h
+#define ScanFlights_h
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+#include <cpprest/producerconsumerstream.h>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  One scan in progress, whose serialized response is shared by every
+  request for the same scan that arrives while it runs.
+
+  The request that starts the scan (the leader) publishes the reply:
+  seal() fixes the status, append() adds each piece of the body as it
+  is serialized, and finish() or fail() ends it. Other requests
+  (followers) call follow(), which registers them with the flight and
+  returns at once. The leader's calls reply to the followers and
+  queue each piece on their response streams as task continuations,
+  so no thread waits for the leader's scan.
+
+  A follower needs the body from its first piece, so the flight keeps
+  every piece until it has held more than max_retained bytes. It then
+  stops taking followers and, once every follower is streaming, drops
+  the pieces, so a long scan nobody joins holds almost none of its
+  body.
+ */
+class ScanFlight {
+private:
+  using piece_ptr = std::shared_ptr<const std::string>;
+
+  struct follower {
+    bool attached;                  // follow() has been called
+    bool streaming;                 // Given every piece so far; later ones go to body
+    web::http::http_request message;
+    concurrency::streams::producer_consumer_buffer<uint8_t> body;
+    pplx::task<void> writes;        // Last write queued on body
+  };
+
+  std::mutex lock;
+  bool sealed;
+  bool done;
+  bool failed;
+  bool joinable;
+  web::http::status_code status;
+  std::deque<piece_ptr> pieces;
+  size_t retained_bytes;
+  std::vector<follower> followers;
+
+  void trim();
+  void start_streaming(follower& f);
+  void end_follower(follower& f);
+
+public:
+  static constexpr size_t max_retained {4 * 1024 * 1024};
+
+  ScanFlight () : lock {}, sealed {false}, done {false}, failed {false}, joinable {true}, status {},
+                  pieces {}, retained_bytes {0}, followers {} {};
+  ScanFlight (const ScanFlight&) = delete;
+  ScanFlight& operator=(const ScanFlight&) = delete;
+
+  // Leader side
+  void seal(web::http::status_code reply_status);
+  void append(const std::string& piece);
+  void finish();
+  void fail();
+
+  /*
+    Follower side: add_follower() reserves a place from the first
+    piece, or returns false if the flight no longer takes followers.
+    follow() hands over the follower's request, to be replied to as
+    the leader goes; it never blocks.
+   */
+  bool add_follower(size_t& follower_id);
+  void follow(web::http::http_request message, size_t follower_id);
+};
+
+/*
+  Registry of the scans in progress, keyed by table and scan key.
+
+  A scan key must identify everything that determines the response
+  body: the kind of read, the filter, and the selected columns.
+
+  Writes to a table must call detach_table() once storage has
+  completed them, so that later reads start a new scan that sees
+  the write instead of joining one that may have missed it.
+ */
+class ScanFlights {
+public:
+  using flight_ptr = std::shared_ptr<ScanFlight>;
+
+  struct joined {
+    flight_ptr flight;
+    bool leads;           // Caller must run the scan and hold a lead
+    size_t follower_id;   // Otherwise, pass this to follow()
+  };
+
+  /*
+    Held by the request that leads a scan. If the leader returns
+    without finishing, its followers are failed rather than left
+    waiting, and the scan leaves the registry either way.
+   */
+  class lead {
+  private:
+    ScanFlights& registry;
+    std::string key;
+    flight_ptr held;
+  public:
+    lead (ScanFlights& flights, const std::string& table_name, const std::string& scan_key,
+          const flight_ptr& flight);
+    ~lead ();
+    lead (const lead&) = delete;
+    lead& operator=(const lead&) = delete;
+    ScanFlight& flight() { return *held; };
+  };
+
+private:
+  std::mutex lock;
+  std::unordered_map<std::string,flight_ptr> flights;
+  uint64_t coalesced;
+
+  void leave(const std::string& key, const flight_ptr& flight);
+
+public:
+  ScanFlights () : lock {}, flights {}, coalesced {0} {};
+  ScanFlights (const ScanFlights&) = delete;
+  ScanFlights& operator=(const ScanFlights&) = delete;
+
+  joined join(const std::string& table_name, const std::string& scan_key);
+  void detach_table(const std::string& table_name);
+  uint64_t coalesced_count();
+};
+#endif
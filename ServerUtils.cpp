@@ -4,7 +4,7 @@
 
 #include "ServerUtils.h"
 
-#include <iostream>
+#include <exception>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -12,6 +12,8 @@
 
 #include <was/table.h>
 
+#include "Log.h"
+
 using azure::storage::cloud_table;
 using azure::storage::cloud_table_client;
 using azure::storage::entity_property;
@@ -21,8 +23,6 @@ using azure::storage::table_entity;
 using azure::storage::table_operation;
 using azure::storage::table_result;
 
-using std::cout;
-using std::endl;
 using std::make_pair;
 using std::pair;
 using std::string;
@@ -34,6 +34,32 @@ using web::http::status_code;
 using web::http::status_codes;
 using web::http::uri;
 
+namespace {
+  /*
+    Return the status to reply for a storage error on a token
+    operation: Forbidden if storage refused the token, InternalError
+    for anything else
+   */
+  status_code token_error_status (const storage_exception& e) {
+    log_error(log_category::storage) << "Azure Table Storage error: " << e.what() << ": "
+        << e.result().extended_error().message();
+    if (e.result().http_status_code() == status_codes::Forbidden)
+      return status_codes::Forbidden;
+    else
+      return status_codes::InternalError;
+  }
+
+  /*
+    Return a reference to table tname that authenticates with token
+   */
+  cloud_table token_table (const string& endpoint, const string& token, const string& tname) {
+    uri endpoint_uri {endpoint};
+    storage_credentials creds {token};
+    cloud_table_client client {endpoint_uri, creds};
+    return client.get_table_reference(tname);
+  }
+}
+
 /*
   Read from a table using a security token
 
@@ -45,12 +71,13 @@ using web::http::uri;
     "http://STORAGE.table.core.windows.net/", where STORAGE is
     replaced by the user's Azure Storage account name.
 
-  Returns a pair:
+  Returns a task, completed once storage answers, of a pair:
     first: HTTP status code from the read
     second: if the status code is OK, the entity read from the table
+  The task never fails; storage errors become the status code.
  */
-pair<status_code,table_entity> read_with_token (const http_request& message,
-                                                 const string& endpoint) {
+pplx::task<pair<status_code,table_entity>> read_with_token (const http_request& message,
+                                                             const string& endpoint) {
   /*
     Tokens can contain %2F ('/'). Thus we split the URI path
     *before* decoding and pass the undecoded values to Azure Storage
@@ -58,7 +85,7 @@ pair<status_code,table_entity> read_with_token (const http_request& message,
   const string undecoded_path {message.relative_uri().path()};
   const vector<string> undecoded_paths {uri::split_path(undecoded_path)};
   if (undecoded_paths.size () != 5) {
-    return make_pair (status_codes::BadRequest, table_entity{});
+    return pplx::task_from_result(make_pair (status_codes::BadRequest, table_entity{}));
   }
 
   const string tname {undecoded_paths[1]};
@@ -67,32 +94,32 @@ pair<status_code,table_entity> read_with_token (const http_request& message,
   const string row {undecoded_paths[4]};
 
   try {
-    uri endpoint_uri {endpoint};
-    storage_credentials creds {token};
-    cloud_table_client client {endpoint_uri, creds};
-
     table_operation op {table_operation::retrieve_entity(partition, row)};
-    cloud_table table_cred {client.get_table_reference(tname)};
-    table_result retrieve_result {table_cred.execute(op)};
-    if (retrieve_result.http_status_code() == status_codes::NotFound) {
-      cout << "Not found" << endl;
-      return make_pair (status_codes::NotFound,
-                         table_entity{});
-    }
-
-    table_entity entity {retrieve_result.entity()};
-    return make_pair (status_codes::OK,
-                       entity);
+    return token_table(endpoint, token, tname).execute_async(op)
+      .then([] (pplx::task<table_result> retrieve) {
+        try {
+          table_result retrieve_result {retrieve.get()};
+          if (retrieve_result.http_status_code() == status_codes::NotFound) {
+            log_debug(log_category::storage) << "Not found";
+            return make_pair (status_codes::NotFound,
+                               table_entity{});
+          }
+          return make_pair (status_codes::OK,
+                             retrieve_result.entity());
+        }
+        catch (const storage_exception& e) {
+          return make_pair (token_error_status(e),
+                             table_entity{});
+        }
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Read with token failed: " << e.what();
+          return make_pair (status_codes::InternalError,
+                             table_entity{});
+        }
+      });
   }
   catch (const storage_exception& e) {
-    cout << "Azure Table Storage error: " << e.what() << endl;
-    cout << e.result().extended_error().message() << endl;
-    if (e.result().http_status_code() == status_codes::Forbidden)
-      return make_pair (status_codes::Forbidden,
-                         table_entity{});
-    else
-      return make_pair (status_codes::InternalError,
-                         table_entity{});
+    return pplx::task_from_result(make_pair (token_error_status(e), table_entity{}));
   }
 }
 
@@ -106,14 +133,16 @@ pair<status_code,table_entity> read_with_token (const http_request& message,
   endpoint is the URI endpoint for Azure tables. It takes the form
     "http://STORAGE.table.core.windows.net/", where STORAGE is
     replaced by the user's Azure Storage account name.
-  props is an unordered_map of properties to be merged into
-    the entity. This will typically be the result of get_json_body().
+  props is the properties to be merged into the entity. This will
+    typically be the result of get_json_properties().
 
-  Returns:  HTTP status code from the write.
+  Returns:  a task, completed once storage answers, of the HTTP
+    status code from the write. The task never fails; storage errors
+    become the status code.
  */
-status_code update_with_token (const http_request& message,
-                               const string& endpoint,
-                               const unordered_map<string,string>& props) {
+pplx::task<status_code> update_with_token (const http_request& message,
+                                           const string& endpoint,
+                                           const table_entity::properties_type& props) {
   
   /*
     Tokens can contain %2F ('/'). Thus we split the URI path
@@ -122,7 +151,7 @@ status_code update_with_token (const http_request& message,
   const string undecoded_path {message.relative_uri().path()};
   const vector<string> undecoded_paths {uri::split_path(undecoded_path)};
   if (undecoded_paths.size () != 5) {
-    return status_codes::BadRequest;
+    return pplx::task_from_result(status_codes::BadRequest);
   }
   
   const string tname {undecoded_paths[1]};
@@ -131,31 +160,29 @@ status_code update_with_token (const http_request& message,
   const string row {undecoded_paths[4]};
   table_entity entity {partition, row};
   try {
-    uri endpoint_uri {endpoint};
-    storage_credentials creds {token};
-    cloud_table_client client {endpoint_uri, creds};
-
-    table_entity::properties_type& properties = entity.properties();
-    for (const auto v : props) {
-      properties[v.first] = entity_property {v.second};
-    }
+    entity.properties() = props;
 
     table_operation op {table_operation::merge_entity(entity)};
-    cloud_table table_cred {client.get_table_reference(tname)};
-    table_result update_result {table_cred.execute(op)};
-    status_code status {static_cast<status_code> (update_result.http_status_code())};
-    if (status == status_codes::NoContent || status == status_codes::OK)
-      return status_codes::OK;
-    else
-      return status;
+    return token_table(endpoint, token, tname).execute_async(op)
+      .then([] (pplx::task<table_result> update) {
+        try {
+          status_code status {static_cast<status_code> (update.get().http_status_code())};
+          if (status == status_codes::NoContent || status == status_codes::OK)
+            return status_codes::OK;
+          else
+            return status;
+        }
+        catch (const storage_exception& e) {
+          return token_error_status(e);
+        }
+        catch (const std::exception& e) {
+          log_error(log_category::storage) << "Update with token failed: " << e.what();
+          return static_cast<status_code> (status_codes::InternalError);
+        }
+      });
   }
   catch (const storage_exception& e)
   {
-    cout << "Azure Table Storage error: " << e.what() << endl;
-    cout << e.result().extended_error().message() << endl;
-    if (e.result().http_status_code() == status_codes::Forbidden)
-      return status_codes::Forbidden;
-    else
-      return status_codes::InternalError;
+    return pplx::task_from_result(token_error_status(e));
   }
 }
@@ -0,0 +1,112 @@
+#include "StreamPacer.h"
+
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <cpprest/producerconsumerstream.h>
+
+using concurrency::streams::producer_consumer_buffer;
+
+using std::vector;
+
+namespace {
+  const std::chrono::milliseconds poll_interval {5};
+  const std::chrono::seconds stall_timeout {60};
+}
+
+constexpr size_t StreamPacer::def_max_unread;
+
+StreamPacer::StreamPacer () : lock {}, changed {}, waiters {}, checker {}, stopping {false} {
+  checker = std::thread {&StreamPacer::run, this};
+}
+
+StreamPacer::~StreamPacer () {
+  stop();
+}
+
+StreamPacer& StreamPacer::instance() {
+  static StreamPacer pacer {};
+  return pacer;
+}
+
+/*
+  Return a task that completes once body has fewer than max_unread
+  bytes waiting to be read, at once if it already has.
+ */
+pplx::task<void> StreamPacer::room(producer_consumer_buffer<uint8_t> body, size_t max_unread) {
+  const size_t unread {body.in_avail()};
+  if (unread < max_unread || ! body.can_read())
+    return pplx::task_from_result();
+  pplx::task_completion_event<void> ready {};
+  {
+    std::lock_guard<std::mutex> l {lock};
+    if (stopping)
+      return pplx::task_from_result();
+    waiters.push_back(waiter {body, max_unread, unread, std::chrono::steady_clock::now(), ready});
+  }
+  changed.notify_all();
+  return pplx::create_task(ready);
+}
+
+void StreamPacer::run() {
+  std::unique_lock<std::mutex> l {lock};
+  while ( ! stopping) {
+    if (waiters.empty()) {
+      changed.wait(l, [this] { return stopping || ! waiters.empty(); });
+      continue;
+    }
+    changed.wait_for(l, poll_interval);
+
+    // Completing a task may run its continuation, so do it unlocked
+    vector<waiter> released {};
+    vector<waiter> stalled {};
+    const auto now = std::chrono::steady_clock::now();
+    for (auto w = waiters.begin(); w != waiters.end(); ) {
+      const size_t unread {w->body.in_avail()};
+      if (unread < w->max_unread || ! w->body.can_read()) {
+        released.push_back(std::move(*w));
+        w = waiters.erase(w);
+        continue;
+      }
+      if (unread < w->unread) {
+        w->unread = unread;
+        w->progressed = now;
+      }
+      if (now - w->progressed > stall_timeout) {
+        stalled.push_back(std::move(*w));
+        w = waiters.erase(w);
+        continue;
+      }
+      ++w;
+    }
+    l.unlock();
+    for (auto& w : released) {
+      w.ready.set();
+    }
+    for (auto& w : stalled) {
+      w.ready.set_exception(std::make_exception_ptr(std::runtime_error {"Client stopped reading"}));
+    }
+    l.lock();
+  }
+
+  vector<waiter> left {std::move(waiters)};
+  waiters.clear();
+  l.unlock();
+  for (auto& w : left) {
+    w.ready.set();
+  }
+}
+
+void StreamPacer::stop() {
+  {
+    std::lock_guard<std::mutex> l {lock};
+    stopping = true;
+  }
+  changed.notify_all();
+  if (checker.joinable())
+    checker.join();
+}
@@ -0,0 +1,68 @@
+#ifndef StreamPacer_h
+#define StreamPacer_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cpprest/producerconsumerstream.h>
+
+#include <pplx/pplxtasks.h>
+
+/*
+  Holds back the producers of streamed response bodies until the
+  listener has sent what they already wrote.
+
+  A producer_consumer_buffer takes every write at once, however far
+  behind the client is, so a scan that produces faster than its
+  client reads would pile the whole result up in memory. Before
+  producing more, a producer asks for room(): the task completes
+  once fewer than max_unread bytes of the body wait to be read.
+
+  No request thread waits for a client. One background thread checks
+  the paused bodies every poll_interval and releases those that have
+  drained. A body closed for reading is released at once, so the
+  producer's next write fails. If a client reads nothing for
+  stall_timeout, the task fails, so the producer can give up on it.
+ */
+class StreamPacer {
+public:
+  static constexpr size_t def_max_unread {256 * 1024};
+
+private:
+  struct waiter {
+    concurrency::streams::producer_consumer_buffer<uint8_t> body;
+    size_t max_unread;
+    size_t unread;                          // When last checked
+    std::chrono::steady_clock::time_point progressed;
+    pplx::task_completion_event<void> ready;
+  };
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<waiter> waiters;
+  std::thread checker;
+  bool stopping;
+
+  void run();
+
+  StreamPacer ();
+
+public:
+  ~StreamPacer ();
+  StreamPacer (const StreamPacer&) = delete;
+  StreamPacer& operator=(const StreamPacer&) = delete;
+
+  static StreamPacer& instance();
+
+  pplx::task<void> room(concurrency::streams::producer_consumer_buffer<uint8_t> body,
+                        size_t max_unread = def_max_unread);
+
+  // Release every paused producer and end the background thread
+  void stop();
+};
+#endif
@@ -0,0 +1,378 @@
+#include "TableBatcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+#include "Log.h"
+
+using azure::storage::cloud_table;
+using azure::storage::storage_exception;
+using azure::storage::table_batch_operation;
+using azure::storage::table_entity;
+using azure::storage::table_operation;
+using azure::storage::table_result;
+
+using std::string;
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+
+using web::http::status_code;
+using web::http::status_codes;
+
+namespace {
+  /*
+    Map a status returned by storage for a write to the status
+    reported for the entity
+   */
+  status_code write_status (int http_status) {
+    if (http_status == status_codes::OK ||
+        http_status == status_codes::Created ||
+        http_status == status_codes::NoContent)
+      return status_codes::OK;
+    if (http_status == 0)
+      return status_codes::InternalError;
+    return static_cast<status_code>(http_status);
+  }
+
+  void add_write (table_batch_operation& batch, const table_entity& entity, batch_write write) {
+    switch (write) {
+    case batch_write::insert_or_merge:
+      batch.insert_or_merge_entity(entity);
+      break;
+    case batch_write::merge:
+      batch.merge_entity(entity);
+      break;
+    case batch_write::remove:
+      batch.delete_entity(entity);
+      break;
+    }
+  }
+
+  table_operation single_write (const table_entity& entity, batch_write write) {
+    switch (write) {
+    case batch_write::merge:
+      return table_operation::merge_entity(entity);
+    case batch_write::remove:
+      return table_operation::delete_entity(entity);
+    case batch_write::insert_or_merge:
+    default:
+      return table_operation::insert_or_merge_entity(entity);
+    }
+  }
+
+  /*
+    Write batch entries from i on one at a time, recording each
+    entity's status in statuses, and give statuses once all are done.
+   */
+  pplx::task<vector<status_code>> write_singly (const cloud_table& table,
+                                                std::shared_ptr<const vector<table_entity>> batch,
+                                                batch_write write,
+                                                std::shared_ptr<vector<status_code>> statuses, size_t i) {
+    if (i >= batch->size())
+      return pplx::task_from_result(*statuses);
+    return table.execute_async(single_write((*batch)[i], write))
+      .then([table, batch, write, statuses, i] (pplx::task<table_result> done) {
+          try {
+            (*statuses)[i] = write_status(done.get().http_status_code());
+          }
+          catch (const storage_exception& e) {
+            log_error(log_category::storage) << "Azure Table Storage error: " << e.what();
+            (*statuses)[i] = write_status(e.result().http_status_code());
+          }
+          catch (const std::exception& e) {
+            log_error(log_category::storage) << "Write error: " << e.what();
+          }
+          return write_singly(table, batch, write, statuses, i + 1);
+        });
+  }
+
+  /*
+    Write batch (at most max_batch_size entities of one partition, no
+    two the same) as one transaction, falling back to one write per
+    entity if the transaction fails. The task gives each entity's
+    status and never fails.
+   */
+  pplx::task<vector<status_code>> write_batch_async (const cloud_table& table,
+                                                     std::shared_ptr<const vector<table_entity>> batch,
+                                                     batch_write write) {
+    table_batch_operation operation {};
+    for (const auto& entity : *batch) {
+      add_write(operation, entity, write);
+    }
+    return table.execute_batch_async(operation)
+      .then([table, batch, write] (pplx::task<vector<table_result>> done) {
+          try {
+            vector<table_result> results {done.get()};
+            vector<status_code> statuses (batch->size(), status_codes::OK);
+            for (size_t i = 0; i < results.size() && i < batch->size(); ++i) {
+              statuses[i] = write_status(results[i].http_status_code());
+            }
+            return pplx::task_from_result(statuses);
+          }
+          catch (const storage_exception& e) {
+            log_error(log_category::storage) << "Azure Table Storage batch error: " << e.what();
+          }
+          catch (const std::exception& e) {
+            log_error(log_category::storage) << "Batch write error: " << e.what();
+          }
+
+          // Find out which writes of the failed batch can succeed alone
+          auto statuses = std::make_shared<vector<status_code>>(batch->size(), status_codes::InternalError);
+          return write_singly(table, batch, write, statuses, 0);
+        });
+  }
+
+  /*
+    The entities of an execute_in_batches_async() call, grouped by
+    partition in order of first appearance, shared by its lanes. Each
+    partition writes to its own elements of statuses.
+   */
+  struct batch_run {
+    cloud_table table;
+    batch_write write;
+    vector<table_entity> entities;
+    vector<vector<size_t>> partitions;
+    vector<status_code> statuses;
+    std::atomic<size_t> next_partition {0};
+  };
+
+  /*
+    Write the entities of partition p of run, one batch at a time,
+    starting from its index next
+   */
+  pplx::task<void> write_partition (std::shared_ptr<batch_run> run, size_t p, size_t next) {
+    const vector<size_t>& indices = run->partitions[p];
+    if (next >= indices.size())
+      return pplx::task_from_result();
+
+    // A batch may not name the same entity twice
+    vector<size_t> members {};
+    auto batch = std::make_shared<vector<table_entity>>();
+    unordered_set<string> rows {};
+    while (next < indices.size() && members.size() < max_batch_size &&
+           rows.insert(run->entities[indices[next]].row_key()).second) {
+      members.push_back(indices[next]);
+      batch->push_back(run->entities[indices[next]]);
+      ++next;
+    }
+
+    return write_batch_async(run->table, batch, run->write)
+      .then([run, p, next, members] (vector<status_code> batch_statuses) {
+          for (size_t m = 0; m < members.size(); ++m) {
+            run->statuses[members[m]] = batch_statuses[m];
+          }
+          return write_partition(run, p, next);
+        });
+  }
+
+  /*
+    Write the partitions of run one after another, taking each from
+    those not yet started, until none are left. A few such lanes bound
+    the partitions written at once, so a body of many partitions
+    cannot flood storage.
+   */
+  pplx::task<void> partition_lane (std::shared_ptr<batch_run> run) {
+    const size_t p {run->next_partition++};
+    if (p >= run->partitions.size())
+      return pplx::task_from_result();
+    return write_partition(run, p, 0).then([run] { return partition_lane(run); });
+  }
+}
+
+pplx::task<vector<status_code>> execute_in_batches_async (const cloud_table& table,
+                                                          vector<table_entity> entities,
+                                                          batch_write write, size_t max_in_flight) {
+  auto run = std::make_shared<batch_run>();
+  run->table = table;
+  run->write = write;
+  run->statuses.assign(entities.size(), status_codes::InternalError);
+
+  // Group by partition, keeping the order of first appearance
+  unordered_map<string,size_t> partition_index {};
+  for (size_t i = 0; i < entities.size(); ++i) {
+    auto found = partition_index.find(entities[i].partition_key());
+    if (found == partition_index.end()) {
+      found = partition_index.insert(std::make_pair(entities[i].partition_key(), run->partitions.size())).first;
+      run->partitions.push_back(vector<size_t> {});
+    }
+    run->partitions[found->second].push_back(i);
+  }
+  run->entities = std::move(entities);
+
+  vector<pplx::task<void>> lanes {};
+  const size_t lane_count {std::min(std::max(max_in_flight, size_t {1}), run->partitions.size())};
+  for (size_t l = 0; l < lane_count; ++l) {
+    lanes.push_back(partition_lane(run));
+  }
+  if (lanes.empty())
+    return pplx::task_from_result(run->statuses);
+  return pplx::when_all(lanes.begin(), lanes.end())
+    .then([run] {
+        return run->statuses;
+      });
+}
+
+/*
+  Send the buffer of partition as one batch, after any batch of the
+  partition already sent: at once if fewer than max_in_flight are
+  running, otherwise once those ahead of it have started.
+
+  partition is taken by value, as callers pass keys of buffers.
+ */
+void BatchWriter::send(string partition) {
+  auto buffer = buffers.find(partition);
+  if (buffer == buffers.end())
+    return;
+  queued_batch batch {partition, vector<table_entity> {}};
+  batch.entities.swap(buffer->second);
+  buffers.erase(buffer);
+  buffered -= batch.entities.size();
+
+  std::lock_guard<std::mutex> l {lock};
+  if (in_flight < max_in_flight && queued.empty())
+    start(std::move(batch));
+  else
+    queued.push_back(std::move(batch));
+}
+
+/*
+  Run batch after the batch of its partition already started, if any.
+
+  Caller must hold lock. Nothing here runs the batch's continuation,
+  so its call of batch_done() cannot find lock held by this thread.
+ */
+void BatchWriter::start(queued_batch batch) {
+  ++in_flight;
+  auto self = shared_from_this();
+  auto entities = std::make_shared<const vector<table_entity>>(std::move(batch.entities));
+
+  // Never fails, so a continuation of it always runs
+  auto run = [self, entities] {
+    return write_batch_async(self->table, entities, self->write)
+      .then([self, entities] (vector<status_code> statuses) {
+          for (size_t i = 0; i < entities->size(); ++i) {
+            try {
+              self->on_result((*entities)[i], statuses[i]);
+            }
+            catch (const std::exception& e) {
+              log_error(log_category::storage) << "Batch result error: " << e.what();
+            }
+          }
+          self->batch_done();
+        });
+  };
+
+  auto tail = tails.find(batch.partition);
+  if (tail == tails.end() || tail->second.is_done())
+    tails[batch.partition] = run();
+  else
+    tail->second = tail->second.then(run);
+
+  // Forget partitions whose batches have all finished
+  if (tails.size() > 4 * max_in_flight) {
+    for (auto it = tails.begin(); it != tails.end(); ) {
+      if (it->second.is_done())
+        it = tails.erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+/*
+  Note that a batch has finished: start the next queued batch, and
+  release the producers waiting for room or for the last batch
+ */
+void BatchWriter::batch_done() {
+  vector<pplx::task_completion_event<void>> released {};
+  vector<pplx::task_completion_event<void>> idle {};
+  {
+    std::lock_guard<std::mutex> l {lock};
+    --in_flight;
+    while (in_flight < max_in_flight && ! queued.empty()) {
+      queued_batch batch {std::move(queued.front())};
+      queued.pop_front();
+      start(std::move(batch));
+    }
+    if (queued.empty())
+      released.swap(room_waiters);
+    if (queued.empty() && in_flight == 0) {
+      idle.swap(idle_waiters);
+      tails.clear();
+    }
+  }
+  for (auto& waiter : released) {
+    waiter.set();
+  }
+  for (auto& waiter : idle) {
+    waiter.set();
+  }
+}
+
+void BatchWriter::add(const table_entity& entity) {
+  const string& partition = entity.partition_key();
+  auto buffer = buffers.find(partition);
+  if (buffer != buffers.end()) {
+    for (const auto& held : buffer->second) {
+      if (held.row_key() == entity.row_key()) {
+        send(partition);
+        break;
+      }
+    }
+  }
+
+  buffers[partition].push_back(entity);
+  ++buffered;
+  if (buffers[partition].size() >= max_batch_size) {
+    send(partition);
+  }
+  else if (buffered > max_in_flight * max_batch_size) {
+    auto largest = buffers.begin();
+    for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+      if (it->second.size() > largest->second.size())
+        largest = it;
+    }
+    send(largest->first);
+  }
+}
+
+/*
+  Return a task that completes once no batch waits to start
+ */
+pplx::task<void> BatchWriter::room() {
+  std::lock_guard<std::mutex> l {lock};
+  if (queued.empty())
+    return pplx::task_from_result();
+  pplx::task_completion_event<void> ready {};
+  room_waiters.push_back(ready);
+  return pplx::create_task(ready);
+}
+
+/*
+  Send every buffered entity and return a task that completes once
+  all batches have finished
+ */
+pplx::task<void> BatchWriter::flush() {
+  while (buffers.size() > 0) {
+    send(buffers.begin()->first);
+  }
+  std::lock_guard<std::mutex> l {lock};
+  if (in_flight == 0 && queued.empty())
+    return pplx::task_from_result();
+  pplx::task_completion_event<void> idle {};
+  idle_waiters.push_back(idle);
+  return pplx::create_task(idle);
+}
@@ -0,0 +1,118 @@
+#ifndef TableBatcher_h
+#define TableBatcher_h
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+/*
+  Writing many entities as storage entity-group transactions.
+
+  Table storage accepts batches of up to 100 operations, all in one
+  partition and each on a different entity. execute_in_batches_async()
+  groups the entities by partition, splits each partition's entities
+  into such batches in the order given, and writes up to
+  max_in_flight partitions concurrently. The batches of one partition
+  run in order, so later writes to an entity land after earlier ones.
+
+  Every write is a storage task continuation: no thread waits on
+  storage, and nothing here blocks its caller.
+
+  A batch succeeds or fails as a whole. When one fails, its
+  operations are retried one at a time, so every entity gets the
+  status of its own write.
+ */
+enum class batch_write {insert_or_merge, merge, remove};
+
+constexpr size_t max_batch_size {100};
+
+/*
+  Apply write to every entity of entities in table, writing at most
+  max_in_flight partitions at a time.
+
+  The task gives the status of each entity's write, in the order of
+  entities: OK on success, otherwise the storage status
+  (InternalError if storage gave none). It never fails.
+ */
+pplx::task<std::vector<web::http::status_code>>
+execute_in_batches_async (const azure::storage::cloud_table& table,
+                          std::vector<azure::storage::table_entity> entities,
+                          batch_write write, size_t max_in_flight);
+
+/*
+  Writes a stream of entities in batches, for inputs too large to
+  hold at once.
+
+  Entities given to add() are buffered by partition. A partition's
+  buffer is sent as a batch when it is full, or when it would name an
+  entity twice, or (largest buffer first) when the buffers together
+  hold more than max_in_flight full batches. At most max_in_flight
+  batches run at once; the rest queue, in order, until one finishes.
+  Batches of one partition run in order.
+
+  add() never blocks. A producer bounds what queues by waiting for
+  room() before adding more: it completes once no batch is queued.
+  flush() sends what is buffered and completes once every batch has
+  finished.
+
+  on_result is called for every entity once its write is done, from
+  the thread that ran the batch, so it must be thread-safe.
+
+  add() and flush() must not be called concurrently with each other.
+  The writer must be held by a shared_ptr, as its running batches
+  keep it alive.
+ */
+class BatchWriter : public std::enable_shared_from_this<BatchWriter> {
+public:
+  using result_callback = std::function<void (const azure::storage::table_entity&, web::http::status_code)>;
+
+private:
+  struct queued_batch {
+    std::string partition;
+    std::vector<azure::storage::table_entity> entities;
+  };
+
+  azure::storage::cloud_table table;
+  batch_write write;
+  size_t max_in_flight;
+  result_callback on_result;
+
+  // Only add() and flush() touch these
+  std::unordered_map<std::string,std::vector<azure::storage::table_entity>> buffers;
+  size_t buffered;
+
+  std::mutex lock;                                            // Guards the rest
+  std::deque<queued_batch> queued;
+  std::unordered_map<std::string,pplx::task<void>> tails;     // Last batch started for each partition
+  size_t in_flight;
+  std::vector<pplx::task_completion_event<void>> room_waiters;
+  std::vector<pplx::task_completion_event<void>> idle_waiters;
+
+  void send(std::string partition);
+  void start(queued_batch batch);
+  void batch_done();
+
+public:
+  BatchWriter (const azure::storage::cloud_table& to_table, batch_write write_kind,
+               size_t max_batches, result_callback callback)
+    : table {to_table}, write {write_kind}, max_in_flight {max_batches}, on_result {callback},
+      buffers {}, buffered {0}, lock {}, queued {}, tails {}, in_flight {0},
+      room_waiters {}, idle_waiters {} {};
+  BatchWriter (const BatchWriter&) = delete;
+  BatchWriter& operator=(const BatchWriter&) = delete;
+
+  void add(const azure::storage::table_entity& entity);
+  pplx::task<void> room();
+  pplx::task<void> flush();
+};
+#endif
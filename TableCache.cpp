@@ -4,12 +4,14 @@
 #include <string>
 #include <unordered_map>
 
+#include <was/common.h>
 #include <was/storage_account.h>
 #include <was/table.h>
 
 using azure::storage::cloud_storage_account;
 using azure::storage::cloud_table;
 using azure::storage::cloud_table_client;
+using azure::storage::storage_exception;
 using azure::storage::storage_uri;
 
 using pplx::extensibility::critical_section_t;
@@ -40,3 +42,56 @@ bool TableCache::delete_entry(const string& table_name) {
   cache_t::size_type count {table_cache.erase(table_name)};
   return count == 1;
 }
+
+/*
+  Return true if the table is known to exist, without asking storage.
+ */
+bool TableCache::known_exists(const string& table_name) {
+  scoped_critical_section_t lock {resplock};
+  return known_tables.count(table_name) == 1;
+}
+
+/*
+  Return a task giving true if the table exists in storage. If it is
+  not known to exist, storage is asked with exists_async(), so no
+  thread waits for the answer.
+
+  Only a positive answer is remembered, so once a table is known to
+  exist, later calls cost no storage round trip and the task is
+  complete at once. A table that does not exist is checked again on
+  every call, as another server may create it at any time.
+
+  Callers keep the remembered state current: mark_exists() after
+  creating a table, forget_exists() after deleting one or after a
+  storage operation reports it missing.
+ */
+pplx::task<bool> TableCache::table_exists_async(const string& table_name) {
+  if (known_exists(table_name))
+    return pplx::task_from_result(true);
+  return lookup_table(table_name).exists_async()
+    .then([this, table_name] (bool exists) {
+        if (exists)
+          mark_exists(table_name);
+        return exists;
+      });
+}
+
+void TableCache::mark_exists(const string& table_name) {
+  scoped_critical_section_t lock {resplock};
+  known_tables.insert(table_name);
+}
+
+void TableCache::forget_exists(const string& table_name) {
+  scoped_critical_section_t lock {resplock};
+  known_tables.erase(table_name);
+}
+
+/*
+  Storage answers NotFound both for a missing table and for a missing
+  entity; only the error code, TableNotFound, tells them apart. A
+  missing entity says nothing about the table.
+ */
+void TableCache::forget_if_missing(const string& table_name, const storage_exception& e) {
+  if (e.result().extended_error().code() == "TableNotFound")
+    forget_exists(table_name);
+}
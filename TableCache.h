@@ -3,6 +3,7 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include <pplx/pplxtasks.h>
 
@@ -14,12 +15,14 @@ private:
   azure::storage::cloud_storage_account account;
   azure::storage::cloud_table_client client;
   std::unordered_map<std::string,azure::storage::cloud_table> table_cache;
+  std::unordered_set<std::string> known_tables;
   pplx::extensibility::critical_section_t resplock;
 public:
   TableCache () : 
     account {},
     client {},
     table_cache {},
+    known_tables {},
     resplock {}
     {};
 
@@ -30,6 +33,14 @@ public:
 
   azure::storage::cloud_table lookup_table(const std::string& table_name);
   bool delete_entry(const std::string& table_name);
+
+  bool known_exists(const std::string& table_name);
+  pplx::task<bool> table_exists_async(const std::string& table_name);
+  void mark_exists(const std::string& table_name);
+  void forget_exists(const std::string& table_name);
+
+  // Forget that table_name exists if e reports the table missing
+  void forget_if_missing(const std::string& table_name, const azure::storage::storage_exception& e);
 };
 
 #endif
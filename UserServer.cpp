@@ -21,6 +21,9 @@
 #include <was/storage_account.h>
 #include <was/table.h>
 
+#include "JsonBody.h"
+#include "Log.h"
+#include "Routes.h"
 #include "TableCache.h"
 #include "make_unique.h"
 
@@ -119,58 +122,22 @@ const string data_table_name {"DataTable"};
   return message.headers()["Content-type"] == "application/json";
 }*/
 
-/*
-  Given an HTTP message with a JSON body, return the JSON
-  body as an unordered map of strings to strings.
-
-  If the message has no JSON body, return an empty map.
-
-  THIS ROUTINE CAN ONLY BE CALLED ONCE FOR A GIVEN MESSAGE
-  (see http://microsoft.github.io/cpprestsdk/classweb_1_1http_1_1http__request.html#ae6c3d7532fe943de75dcc0445456cbc7
-  for source of this limit).
-
-  Note that all types of JSON values are returned as strings.
-  Use C++ conversion utilities to convert to numbers or dates
-  as necessary.
- */
-unordered_map<string,string> get_json_body(http_request message) {  
-  unordered_map<string,string> results {};
-  const http_headers& headers {message.headers()};
-  auto content_type (headers.find("Content-Type"));
-  if (content_type == headers.end() ||
-      content_type->second != "application/json")
-    return results;
-
-  value json{};
-  message.extract_json(true)
-    .then([&json](value v) -> bool
-    {
-            json = v;
-      return true;
-    })
-    .wait();
-
-  if (json.is_object()) {
-    for (const auto& v : json.as_object()) {
-      if (v.second.is_string()) {
-  results[v.first] = v.second.as_string();
-      }
-      else {
-  results[v.first] = v.second.serialize();
-      }
-    }
-  }
-  return results;
-}
-
 // Delcare the struture used to track whether or not a user is signed into the table
 unordered_map<string,tuple<string,string,string>> user_base;
 
+/*
+  Guards user_base and user_entities, which handlers on any listener
+  thread read and change. Never held across a request to another
+  server.
+ */
+critical_section_t sessions_lock;
+
 /*
   Function takes in a string (the user id)
   Returns a boolean: true if found, false if not found
 */
 bool find_user(string user_id) {
+  scoped_critical_section_t lock {sessions_lock};
   for (auto it = user_base.begin(); it != user_base.end(); it++) {
     if (it->first == user_id)
       return true;
@@ -186,6 +153,7 @@ bool find_user(string user_id) {
         This will return empty strings if the user is not found
 */
 tuple<string,string,string> get_user_properties(string user_id) {
+  scoped_critical_section_t lock {sessions_lock};
   for (auto it = user_base.begin(); it != user_base.end(); it++) {
     if (it->first == user_id) {
       return make_tuple(get<0>(it->second), get<1>(it->second), get<2>(it->second));
@@ -195,357 +163,432 @@ tuple<string,string,string> get_user_properties(string user_id) {
 }
 
 /*
-  Top-level routine for processing all HTTP POST requests.
+  Last copy of each online user's DataTable entity, with its ETag,
+  so reads can be revalidated instead of downloaded again
  */
-void handle_post(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** POST " << path << endl;
-  auto paths = uri::split_path(path);
+unordered_map<string,pair<string,value>> user_entities;
 
-  // SignOn and SignOff require exactly two parameters (command, userid); no more no less
-  if (paths.size() != 2) {
-    message.reply(status_codes::BadRequest);
-    return;
-  }
-
-  // Both SignOn and SignOff have the user id as a parameter so set up a string and initialize it to the user id
-  const string user_id {paths[1]};
-
-  if (paths[0] == sign_on_op) {
-
-    // Extract info from original message to obtain the password
-    unordered_map<string,string> json_body {get_json_body (message)};
-    string password {json_body["Password"]};
-
-    // Check the AuthTable and obtain a token for the session if the user is found
-    pair<status_code,value> auth_result {do_request (methods::GET,
-                                                     auth_url +
-                                                     get_update_data_op + "/" +
-                                                     user_id,
-                                                     value::object (vector<pair<string,value>>
-                                                                      {make_pair("Password",
-                                                                                 value::string(password))})
-                                                    )};
-
-    // If AuthServer gives anything other than OK return NotFound; if OK then continue on
-    if (auth_result.first != status_codes::OK) {
-      message.reply(status_codes::NotFound);
-      return;
-    }
+/*
+  Read the DataTable entity of an online user through BasicServer
 
-    //Store the information return from AuthServer for token, associated partition and associate row
-    const string user_token {get_json_object_prop(auth_result.second, "token")};
-    const string user_partition {get_json_object_prop(auth_result.second, "DataPartition")};
-    const string user_row {get_json_object_prop(auth_result.second, "DataRow")};
+  Note: Only use this if find_user was already called and returned true
+*/
+pair<status_code,value> read_user_entity(const string& user_id) {
+  tuple<string,string,string> user_creds {get_user_properties(user_id)};
 
-    // Check the DataTable if the entity corresponding to the partition and data obtained from AuthServer exists
-    pair<status_code,value> basic_result {do_request (methods::GET,
-                                                      basic_url +
-                                                      read_entity_admin+ "/" +
+  // Work on a copy, as SignOff may drop the held entity meanwhile
+  pair<string,value> held {};
+  {
+    scoped_critical_section_t lock {sessions_lock};
+    auto found = user_entities.find(user_id);
+    if (found != user_entities.end())
+      held = found->second;
+  }
+  pair<status_code,value> result {do_conditional_get (basic_url +
+                                                      read_entity_auth + "/" +
                                                       data_table_name + "/" +
-                                                      user_partition + "/" +
-                                                      user_row)};
-
-    // If BasicServer does not return OK with the above request then the user is not in DataTable
-    if (basic_result.first != status_codes::OK) {
-      message.reply(status_codes::NotFound);
-      return;
-    }
-
-    // At this point, the user has been authenticated (has correct password) and is found in both Auth and Data tables
-    // Therefore we can sign the user in (add the user to the hashtable)
+                                                      get<0>(user_creds) + "/" +
+                                                      get<1>(user_creds) + "/" +
+                                                      get<2>(user_creds),
+                                                      held.first, held.second)};
+
+  // Keep the copy only while the user is still online
+  scoped_critical_section_t lock {sessions_lock};
+  if (result.first == status_codes::OK && user_base.count(user_id) == 1)
+    user_entities[user_id] = make_pair(held.first, result.second);
+  else
+    user_entities.erase(user_id);
+  return result;
+}
 
-    // Check if user is already online
-    if (bool online {find_user(user_id)}) {
-      cout << "User is already online" << endl;
-      message.reply(status_codes::OK);
-      return;
-    }
+/*
+  SignOn/<userid>: start a session for the user, whose password is
+  in the body
+ */
+void handle_sign_on (http_request message, const route_path& route, const request_body& content) {
+  const string user_id {route[1]};
+
+  // Extract info from original message to obtain the password
+  json_body_status body_status {json_body_status::ok};
+  unordered_map<string,string> json_body {get_json_body (content, &body_status)};
+  if (body_status == json_body_status::too_large) {
+    message.reply(status_codes::RequestEntityTooLarge);
+    return;
+  }
+  if (body_status == json_body_status::malformed) {
+    message.reply(status_codes::BadRequest);
+    return;
+  }
+  string password {json_body["Password"]};
+
+  // Check the AuthTable and obtain a token for the session if the user is found
+  pair<status_code,value> auth_result {do_request (methods::GET,
+                                                   auth_url +
+                                                   get_update_data_op + "/" +
+                                                   user_id,
+                                                   value::object (vector<pair<string,value>>
+                                                                    {make_pair("Password",
+                                                                               value::string(password))})
+                                                  )};
+
+  // If AuthServer gives anything other than OK return NotFound; if OK then continue on
+  if (auth_result.first != status_codes::OK) {
+    message.reply(status_codes::NotFound);
+    return;
+  }
 
-    // If the user attempts to log in with the wrong credentials then it will return NotFound prior to this
+  //Store the information return from AuthServer for token, associated partition and associate row
+  const string user_token {get_json_object_prop(auth_result.second, "token")};
+  const string user_partition {get_json_object_prop(auth_result.second, "DataPartition")};
+  const string user_row {get_json_object_prop(auth_result.second, "DataRow")};
+
+  // Check the DataTable if the entity corresponding to the partition and data obtained from AuthServer exists
+  pair<status_code,value> basic_result {do_request (methods::GET,
+                                                    basic_url +
+                                                    read_entity_admin+ "/" +
+                                                    data_table_name + "/" +
+                                                    user_partition + "/" +
+                                                    user_row)};
+
+  // If BasicServer does not return OK with the above request then the user is not in DataTable
+  if (basic_result.first != status_codes::OK) {
+    message.reply(status_codes::NotFound);
+    return;
+  }
 
-    // Add user to hashtable (Now Online)
-    tuple<string,string,string> properties {make_tuple(user_token, user_partition, user_row)};
-    user_base.insert(make_pair(user_id, properties));
+  // At this point, the user has been authenticated (has correct password) and is found in both Auth and Data tables
+  // Therefore we can sign the user in (add the user to the hashtable)
 
-    cout << user_id << " is now online" << endl;
-    cout << "There are currently " << user_base.size() << " users online" << endl;
+  // If the user attempts to log in with the wrong credentials then it will return NotFound prior to this
 
+  // Add user to hashtable (Now Online), unless the user is already online
+  tuple<string,string,string> properties {make_tuple(user_token, user_partition, user_row)};
+  bool added {false};
+  size_t online {0};
+  {
+    scoped_critical_section_t lock {sessions_lock};
+    added = user_base.insert(make_pair(user_id, properties)).second;
+    online = user_base.size();
+  }
+  if ( ! added) {
+    log_info(log_category::request) << "User is already online";
     message.reply(status_codes::OK);
     return;
   }
 
-  if (paths[0] == sign_off_op) {
-    
-    /*
-      Don't use the find_user function
-      Modify the find_user function instead so it will remove the user and return
-      If it does not return from that then the user is clearly not 'online'
-    */
-
-    // Find the user; if found remove from hashtable
-    for (auto it = user_base.begin(); it != user_base.end(); it++) {
-      if (it->first == user_id) {
-        user_base.erase(it);
-        cout << user_id << " is now offline" << endl;
-        cout << "There are " << user_base.size() << " users still online" << endl;
-        message.reply(status_codes::OK);
-        return;
-      }
-    }
+  log_info(log_category::request) << user_id << " is now online";
+  log_info(log_category::request) << "There are currently " << online << " users online";
 
-    // If did not return during the iteration then the user did not have an active session
-    message.reply(status_codes::NotFound);
+  message.reply(status_codes::OK);
+  return;
+}
+
+/*
+  SignOff/<userid>: end the session of the user
+ */
+void handle_sign_off (http_request message, const route_path& route) {
+  const string user_id {route[1]};
+
+  /*
+    Don't use the find_user function
+    Modify the find_user function instead so it will remove the user and return
+    If it does not return from that then the user is clearly not 'online'
+  */
+
+  // Find the user; if found remove from hashtable
+  bool removed {false};
+  size_t online {0};
+  {
+    scoped_critical_section_t lock {sessions_lock};
+    removed = user_base.erase(user_id) == 1;
+    user_entities.erase(user_id);
+    online = user_base.size();
+  }
+  if (removed) {
+    log_info(log_category::request) << user_id << " is now offline";
+    log_info(log_category::request) << "There are " << online << " users still online";
+    message.reply(status_codes::OK);
     return;
-  } 
+  }
 
-  // No more accepted commands beyond this point
-  // Return BadRequest due to possible malformed request
-  message.reply(status_codes::BadRequest);
+  // If did not return during the iteration then the user did not have an active session
+  message.reply(status_codes::NotFound);
   return;
 }
 
+// SignOn and SignOff require exactly two parameters (command, userid); no more no less
+const route_table post_routes {vector<route> {
+    {sign_on_op, 2, 2, with_json_body(handle_sign_on)},
+    {sign_off_op, 2, 2, handle_sign_off}
+  }};
+
 /*
-  Top-level routine for processing all HTTP PUT requests.
+  Top-level routine for processing all HTTP POST requests.
  */
-void handle_get(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** GET " << path << endl;
-  auto paths = uri::split_path(path);
+void handle_post(http_request message) {
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** POST " << path;
+  post_routes.dispatch(message, route_path {path});
+}
 
-  const string user_id {paths[1]};
+/*
+  ReadFriendList/<userid>: the friends list of a signed-on user
+ */
+void handle_read_friend_list (http_request message, const route_path& route) {
+  const string user_id {route[1]};
 
-  // Cant do if (! bool online{find_user(user_id)}) so use this
   // Check if user has an active session
-  bool online{find_user(user_id)};
-  if (! online) {
-    cout << user_id << " does not have an active session" << endl;
+  if ( ! find_user(user_id)) {
+    log_info(log_category::request) << user_id << " does not have an active session";
     message.reply(status_codes::Forbidden);
     return;    
   }
 
-  if (paths[0] == read_friend_list_op) {
-
-    tuple<string,string,string> user_creds {get_user_properties(user_id)};
-    const string user_token {get<0>(user_creds)};
-    const string user_partition {get<1>(user_creds)};
-    const string user_row {get<2>(user_creds)};
-
-    // Obtain the users properties through an authorized GET using BasicServer
-    pair<status_code,value> user_prop {do_request (methods::GET,
-                                                     basic_url +
-                                                     read_entity_auth + "/" +
-                                                     data_table_name + "/" +
-                                                     user_token + "/" +
-                                                     user_partition + "/" +
-                                                     user_row)};
-    assert(user_prop.first == status_codes::OK);
-
-    string friend_list {get_json_object_prop(user_prop.second, prop_friends)};  
+  // Obtain the users properties through an authorized GET using BasicServer
+  pair<status_code,value> user_prop {read_user_entity(user_id)};
+  assert(user_prop.first == status_codes::OK);
 
-    cout << friend_list << endl;
+  string friend_list {get_json_object_prop(user_prop.second, prop_friends)};  
 
-    // Pair "Friends" with a string that contains the friends list then package it into a json value
-    pair<string,string> new_friend_properties {make_pair (prop_friends, friend_list)};
-    value json_friends {build_json_value(new_friend_properties)};
+  log_debug(log_category::request) << friend_list;
 
-    message.reply(status_codes::OK,json_friends);
-    return;
-  }
+  // Pair "Friends" with a string that contains the friends list then package it into a json value
+  pair<string,string> new_friend_properties {make_pair (prop_friends, friend_list)};
+  value json_friends {build_json_value(new_friend_properties)};
 
-  // No more accepted commands beyond this point
-  // Return BadRequest due to possible malformed request
-  message.reply(status_codes::BadRequest);
+  message.reply(status_codes::OK,json_friends);
   return;
 }
 
+const route_table get_routes {vector<route> {
+    {read_friend_list_op, 2, 2, handle_read_friend_list}
+  }};
+
 /*
-  Top-level routine for processing all HTTP PUT requests.
+  Top-level routine for processing all HTTP GET requests.
  */
-void handle_put(http_request message) {
-  string path {uri::decode(message.relative_uri().path())};
-  cout << endl << "**** PUT " << path << endl;
-  auto paths = uri::split_path(path);
+void handle_get(http_request message) {
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** GET " << path;
+  get_routes.dispatch(message, route_path {path});
+}
 
-  // All three operations have user_id as a parameter
-  const string user_id {paths[1]};
+/*
+  What the PUT operations need of a user with an active session
+ */
+struct user_session {
+  string token;
+  string partition;
+  string row;
+  string friend_list;
+};
 
-  // Cant do if (! bool online{find_user(user_id)}) so use this
+/*
+  Fill session for user_id, replying Forbidden and returning false
+  if the user does not have an active session
+ */
+bool open_session (http_request message, const string& user_id, user_session& session) {
   // Check if user has an active session
-  bool online{find_user(user_id)};
-  if (! online) {
-    cout << user_id << " does not have an active session" << endl;
+  if ( ! find_user(user_id)) {
+    log_info(log_category::request) << user_id << " does not have an active session";
     message.reply(status_codes::Forbidden);
-    return;    
+    return false;
   }
 
   // Beyond this point it is assumed that the user has an active session (user is online)
 
   tuple<string,string,string> user_creds {get_user_properties(user_id)};
-  const string user_token {get<0>(user_creds)};
-  const string user_partition {get<1>(user_creds)};
-  const string user_row {get<2>(user_creds)};
+  session.token = get<0>(user_creds);
+  session.partition = get<1>(user_creds);
+  session.row = get<2>(user_creds);
 
   // Obtain the users properties through an authorized GET using BasicServer
-  pair<status_code,value> user_prop {do_request (methods::GET,
-                                                   basic_url +
-                                                   read_entity_auth + "/" +
-                                                   data_table_name + "/" +
-                                                   user_token + "/" +
-                                                   user_partition + "/" +
-                                                   user_row)};
+  pair<status_code,value> user_prop {read_user_entity(user_id)};
   assert(user_prop.first == status_codes::OK);
 
-  string friend_list {get_json_object_prop(user_prop.second, prop_friends)};
+  session.friend_list = get_json_object_prop(user_prop.second, prop_friends);
+  return true;
+}
 
-  if (paths[0] == add_friend_op) {
+/*
+  AddFriend/<userid>/<country>/<name>
+ */
+void handle_add_friend (http_request message, const route_path& route) {
+  const string user_id {route[1]};
+  user_session session {};
+  if ( ! open_session(message, user_id, session))
+    return;
 
-    const string friend_country {paths[2]};
-    const string friend_name {paths[3]};
+  const string friend_country {route[2]};
+  const string friend_name {route[3]};
 
-    // Check if the friend to add is already a friend
-    friends_list_t user_friends {parse_friends_list(friend_list)};
+  // Check if the friend to add is already a friend
+  friends_list_t user_friends {parse_friends_list(session.friend_list)};
 
-    for (auto it = user_friends.begin(); it != user_friends.end(); it++) {
-      if (it->first == friend_country && it->second == friend_name) {
-        cout << friend_name << " from " << friend_country << " is already your friend" << endl;
-        message.reply(status_codes::OK);
-        return;
-      }
-      // Else it will iterate until the friend is found
-      // If the friend is not found in the list then it will be added from from the code below
+  for (auto it = user_friends.begin(); it != user_friends.end(); it++) {
+    if (it->first == friend_country && it->second == friend_name) {
+      log_info(log_category::request) << friend_name << " from " << friend_country << " is already your friend";
+      message.reply(status_codes::OK);
+      return;
     }
+    // Else it will iterate until the friend is found
+    // If the friend is not found in the list then it will be added from from the code below
+  }
 
-    // If this far then friend was not found in the list, add friend
-    user_friends.push_back(make_pair(friend_country,friend_name));
-
-    // Update the string containing the friend list
-    friend_list = friends_list_to_string(user_friends);
+  // If this far then friend was not found in the list, add friend
+  user_friends.push_back(make_pair(friend_country,friend_name));
 
-    // Build a new json value for the property "Friends" using the edited friend list
-    pair<string,string> new_friend_properties {make_pair (prop_friends, friend_list)};
-    value new_properties {build_json_value(new_friend_properties)};
+  // Update the string containing the friend list
+  session.friend_list = friends_list_to_string(user_friends);
 
-    // Make a request to the BasicServer to update the property "Friends" for our user
-    pair<status_code,value> update_properties {do_request (methods::PUT,
-                                                   basic_url +
-                                                   update_entity_auth + "/" +
-                                                   data_table_name + "/" +
-                                                   user_token + "/" +
-                                                   user_partition + "/" +
-                                                   user_row,
-                                                   new_properties)};
-    assert(update_properties.first == status_codes::OK);
+  // Build a new json value for the property "Friends" using the edited friend list
+  pair<string,string> new_friend_properties {make_pair (prop_friends, session.friend_list)};
+  value new_properties {build_json_value(new_friend_properties)};
 
-    cout << "Added " << friend_name << " from " << friend_country << endl;
-    cout << "New Friends Property: " << new_properties << endl;
+  // Make a request to the BasicServer to update the property "Friends" for our user
+  pair<status_code,value> update_properties {do_request (methods::PUT,
+                                                 basic_url +
+                                                 update_entity_auth + "/" +
+                                                 data_table_name + "/" +
+                                                 session.token + "/" +
+                                                 session.partition + "/" +
+                                                 session.row,
+                                                 new_properties)};
+  assert(update_properties.first == status_codes::OK);
 
-    // Return what the PUT method gives; it should be OK and update the entity
-    message.reply(update_properties.first);
-    return;
-  }
+  log_info(log_category::request) << "Added " << friend_name << " from " << friend_country;
+  log_debug(log_category::request) << "New Friends Property: " << new_properties;
 
-  if (paths[0] == un_friend_op) {
-
-    const string friend_country {paths[2]};
-    const string friend_name {paths[3]};
-
-    // Check if the friend to be deleted is in the list
-    friends_list_t user_friends {parse_friends_list(friend_list)};
-
-    for (auto it = user_friends.begin(); it != user_friends.end(); it++) {
-      // If found friend to remove
-      if (it->first == friend_country && it->second == friend_name) {
-    
-        // Remove friend
-        user_friends.erase(it);
-    
-        // Update the string containing the new list of friends after removing the specified friend
-        friend_list = friends_list_to_string(user_friends);
-    
-        // Build a new json value for the property "Friends" using the edited friend list
-        pair<string,string> new_friend_properties {make_pair (prop_friends, friend_list)};
-        value new_properties {build_json_value(new_friend_properties)};
-
-        // Make a request to the BasicServer to update the property "Friends" for our user
-        pair<status_code,value> update_properties {do_request (methods::PUT,
-                                                       basic_url +
-                                                       update_entity_auth + "/" +
-                                                       data_table_name + "/" +
-                                                       user_token + "/" +
-                                                       user_partition + "/" +
-                                                       user_row,
-                                                       new_properties)};
-        assert(update_properties.first == status_codes::OK);
-
-        cout << "Removed " << friend_name << " from " << friend_country << endl;
-        cout << "New Friends Property: " << new_properties << endl;
-
-        // Return what the PUT method gives; it should be OK and update the entity
-        message.reply(update_properties.first);
-        return;
-      }
-      // Else iterate until the friend is found or the list has been exhausted
-    }
+  // Return what the PUT method gives; it should be OK and update the entity
+  message.reply(update_properties.first);
+  return;
+}
 
-    // If the list has been exhausted then the friend is not in the list
-    cout << friend_name << " from " << friend_country << " was not in your friends list" << endl;
-    message.reply(status_codes::OK);
+/*
+  UnFriend/<userid>/<country>/<name>
+ */
+void handle_un_friend (http_request message, const route_path& route) {
+  const string user_id {route[1]};
+  user_session session {};
+  if ( ! open_session(message, user_id, session))
     return;
-  }
 
-  if (paths[0] == update_status_op) {
+  const string friend_country {route[2]};
+  const string friend_name {route[3]};
 
-    const string user_new_status {paths[2]};
+  // Check if the friend to be deleted is in the list
+  friends_list_t user_friends {parse_friends_list(session.friend_list)};
 
-    // Build a new json value for the property "Status" using the edited status
-    pair<string,string> new_status_properties {make_pair (prop_status, user_new_status)};
-    value new_properties {build_json_value(new_status_properties)};
-    cout << "New Status Property: " << new_properties << endl;
+  for (auto it = user_friends.begin(); it != user_friends.end(); it++) {
+    // If found friend to remove
+    if (it->first == friend_country && it->second == friend_name) {
+  
+      // Remove friend
+      user_friends.erase(it);
+  
+      // Update the string containing the new list of friends after removing the specified friend
+      session.friend_list = friends_list_to_string(user_friends);
+  
+      // Build a new json value for the property "Friends" using the edited friend list
+      pair<string,string> new_friend_properties {make_pair (prop_friends, session.friend_list)};
+      value new_properties {build_json_value(new_friend_properties)};
 
-    // Make a request to the BasicServer to update the property "Status" for our user
-    pair<status_code,value> update_status {do_request (methods::PUT,
-                                                       basic_url +
-                                                       update_entity_auth + "/" +
-                                                       data_table_name + "/" +
-                                                       user_token + "/" +
-                                                       user_partition + "/" +
-                                                       user_row,
-                                                       new_properties)};
-    assert(update_status.first == status_codes::OK);
+      // Make a request to the BasicServer to update the property "Friends" for our user
+      pair<status_code,value> update_properties {do_request (methods::PUT,
+                                                     basic_url +
+                                                     update_entity_auth + "/" +
+                                                     data_table_name + "/" +
+                                                     session.token + "/" +
+                                                     session.partition + "/" +
+                                                     session.row,
+                                                     new_properties)};
+      assert(update_properties.first == status_codes::OK);
 
-    // Build a new json value for the property "Friends"
-    pair<string,string> friend_properties {make_pair (prop_friends, friend_list)};
-    value users_friends_to_update {build_json_value(friend_properties)};
-
-    try {
-      // Call PushServer to place the users new updated status into their friends "Updates" properties
-      pair<status_code,value> push_status {do_request (methods::POST,
-                                                       push_url +
-                                                       push_status_op + "/" +
-                                                       user_partition + "/" +
-                                                       user_row + "/" +
-                                                       user_new_status,
-                                                       users_friends_to_update)};
-      // Only return for push server is OK
-      assert(update_status.first == status_codes::OK);
-      message.reply(push_status.first);
-      return;
-    }
+      log_info(log_category::request) << "Removed " << friend_name << " from " << friend_country;
+      log_debug(log_category::request) << "New Friends Property: " << new_properties;
 
-    catch (const web::uri_exception& e) {
-      cout << "PushServer error: " << e.what() << endl;
-      message.reply(status_codes::ServiceUnavailable);
+      // Return what the PUT method gives; it should be OK and update the entity
+      message.reply(update_properties.first);
       return;
     }
+    // Else iterate until the friend is found or the list has been exhausted
   }
 
-  // No more accepted commands beyond this point
-  // Return BadRequest due to possible malformed request
-  message.reply(status_codes::BadRequest);
+  // If the list has been exhausted then the friend is not in the list
+  log_info(log_category::request) << friend_name << " from " << friend_country << " was not in your friends list";
+  message.reply(status_codes::OK);
   return;
 }
 
+/*
+  UpdateStatus/<userid>/<status>: set the status and push it to
+  the user's friends
+ */
+void handle_update_status (http_request message, const route_path& route) {
+  const string user_id {route[1]};
+  user_session session {};
+  if ( ! open_session(message, user_id, session))
+    return;
+
+  const string user_new_status {route[2]};
+
+  // Build a new json value for the property "Status" using the edited status
+  pair<string,string> new_status_properties {make_pair (prop_status, user_new_status)};
+  value new_properties {build_json_value(new_status_properties)};
+  log_debug(log_category::request) << "New Status Property: " << new_properties;
+
+  // Make a request to the BasicServer to update the property "Status" for our user
+  pair<status_code,value> update_status {do_request (methods::PUT,
+                                                     basic_url +
+                                                     update_entity_auth + "/" +
+                                                     data_table_name + "/" +
+                                                     session.token + "/" +
+                                                     session.partition + "/" +
+                                                     session.row,
+                                                     new_properties)};
+  assert(update_status.first == status_codes::OK);
+
+  // Build a new json value for the property "Friends"
+  pair<string,string> friend_properties {make_pair (prop_friends, session.friend_list)};
+  value users_friends_to_update {build_json_value(friend_properties)};
+
+  try {
+    // Call PushServer to place the users new updated status into their friends "Updates" properties
+    pair<status_code,value> push_status {do_request (methods::POST,
+                                                     push_url +
+                                                     push_status_op + "/" +
+                                                     session.partition + "/" +
+                                                     session.row + "/" +
+                                                     user_new_status,
+                                                     users_friends_to_update)};
+    // Only return for push server is OK
+    assert(update_status.first == status_codes::OK);
+    message.reply(push_status.first);
+    return;
+  }
+
+  catch (const web::uri_exception& e) {
+    log_error(log_category::server) << "PushServer error: " << e.what();
+    message.reply(status_codes::ServiceUnavailable);
+    return;
+  }
+}
+
+const route_table put_routes {vector<route> {
+    {add_friend_op, 4, 4, handle_add_friend},
+    {un_friend_op, 4, 4, handle_un_friend},
+    {update_status_op, 3, 3, handle_update_status}
+  }};
+
+/*
+  Top-level routine for processing all HTTP PUT requests.
+ */
+void handle_put(http_request message) {
+  const string& path {message.request_uri().path()};
+  log_debug(log_category::request) << "\n**** PUT " << path;
+  put_routes.dispatch(message, route_path {path});
+}
+
 /*
   Main server routine
 
@@ -555,10 +598,10 @@ void handle_put(http_request message) {
   Wait for a carriage return, then shut the server down.
  */
 int main (int argc, char const * argv[]) {
-  cout << "UserServer Open" << endl;
-  cout << "Parsing connection string" << endl;
+  log_info(log_category::server) << "UserServer Open";
+  log_info(log_category::server) << "Parsing connection string";
 
-  cout << "Opening listener" << endl;
+  log_info(log_category::server) << "Opening listener";
   http_listener listener {def_url};
   listener.support(methods::GET, &handle_get);
   listener.support(methods::POST, &handle_post);
@@ -572,6 +615,7 @@ int main (int argc, char const * argv[]) {
 
   // Shut it down
   listener.close().wait();
+  Logger::instance().stop();
   cout << "Closed" << endl;
 }
 
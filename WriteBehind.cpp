@@ -0,0 +1,262 @@
+#include "WriteBehind.h"
+
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <was/common.h>
+#include <was/storage_account.h>
+#include <was/table.h>
+
+#include "Log.h"
+
+using azure::storage::cloud_table;
+using azure::storage::storage_exception;
+using azure::storage::table_entity;
+using azure::storage::table_operation;
+
+using std::string;
+using std::vector;
+
+using web::http::status_code;
+using web::http::status_codes;
+
+namespace {
+  // Keys cannot contain control characters
+  const char key_separator {'\x1f'};
+
+  string entity_key (const string& table_name, const string& partition, const string& row) {
+    return table_name + key_separator + partition + key_separator + row;
+  }
+}
+
+WriteBehind::~WriteBehind () {
+  stop();
+}
+
+void WriteBehind::start(std::chrono::milliseconds merge_window, written_callback callback) {
+  window = merge_window;
+  on_written = callback;
+  if (enabled())
+    flusher = std::thread {&WriteBehind::run, this};
+}
+
+pplx::task<status_code> WriteBehind::merge(const cloud_table& table, const string& table_name,
+                                           const string& partition, const string& row,
+                                           const table_entity::properties_type& properties) {
+  const string key {entity_key(table_name, partition, row)};
+  std::lock_guard<std::mutex> l {lock};
+  ++merges;
+  auto found = pending.find(key);
+  if (found != pending.end()) {
+    ++coalesced;
+  }
+  else {
+    write_ptr w {std::make_shared<pending_write>()};
+    w->table = table;
+    w->table_name = table_name;
+    w->partition = partition;
+    w->row = row;
+    w->due = std::chrono::steady_clock::now() + window;
+    w->done = pplx::create_task(w->written);
+    found = pending.insert(make_pair(key, w)).first;
+    changed.notify_all();
+  }
+  for (const auto& prop : properties) {
+    found->second->properties[prop.first] = prop.second;
+  }
+  return found->second->done;
+}
+
+/*
+  Move the pending write of key, if any, to writing, setting previous
+  to the write of key it must follow.
+
+  Caller must hold lock.
+ */
+WriteBehind::write_ptr WriteBehind::take(const string& key, write_ptr& previous) {
+  auto found = pending.find(key);
+  if (found == pending.end())
+    return write_ptr {};
+  write_ptr w {found->second};
+  pending.erase(found);
+  auto sent = writing.find(key);
+  previous = sent == writing.end() ? write_ptr {} : sent->second;
+  writing[key] = w;
+  return w;
+}
+
+/*
+  Send w to storage once previous is done, then report it.
+
+  Caller must not hold lock.
+ */
+void WriteBehind::write(const string& key, const write_ptr& w, const write_ptr& previous) {
+  if (previous)
+    previous->done.wait();
+
+  status_code status {status_codes::OK};
+  try {
+    table_entity entity {w->partition, w->row};
+    entity.properties() = w->properties;
+    w->table.execute(table_operation::insert_or_merge_entity(entity));
+  }
+  catch (const storage_exception& e) {
+    status = e.result().http_status_code();
+    if (status == 0)
+      status = status_codes::InternalError;
+    log_error(log_category::storage) << "Write-behind merge failed: " << e.what();
+  }
+  catch (const std::exception& e) {
+    status = status_codes::InternalError;
+    log_error(log_category::storage) << "Write-behind merge failed: " << e.what();
+  }
+
+  if (on_written)
+    on_written(w->table_name, w->partition, w->row, status);
+  {
+    std::lock_guard<std::mutex> l {lock};
+    auto sent = writing.find(key);
+    if (sent != writing.end() && sent->second == w)
+      writing.erase(sent);
+  }
+  w->written.set(status);
+}
+
+/*
+  Write out the pending writes of keys and wait for every write of
+  them already sent.
+ */
+void WriteBehind::flush_keys(const vector<string>& keys) {
+  struct taken_write {
+    string key;
+    write_ptr w;
+    write_ptr previous;
+  };
+  vector<taken_write> taken {};
+  vector<pplx::task<status_code>> sent {};
+  {
+    std::lock_guard<std::mutex> l {lock};
+    for (const auto& key : keys) {
+      write_ptr previous {};
+      write_ptr w {take(key, previous)};
+      if (w)
+        taken.push_back(taken_write {key, w, previous});
+      else if (writing.count(key))
+        sent.push_back(writing[key]->done);
+    }
+  }
+  for (const auto& t : taken) {
+    write(t.key, t.w, t.previous);
+  }
+  for (auto& s : sent) {
+    s.wait();
+  }
+}
+
+bool WriteBehind::has_pending(const string& table_name, const string& partition, const string& row) {
+  if ( ! enabled())
+    return false;
+  const string key {entity_key(table_name, partition, row)};
+  std::lock_guard<std::mutex> l {lock};
+  return pending.count(key) > 0 || writing.count(key) > 0;
+}
+
+void WriteBehind::flush_entity(const string& table_name, const string& partition, const string& row) {
+  if ( ! enabled())
+    return;
+  flush_keys(vector<string> {entity_key(table_name, partition, row)});
+}
+
+void WriteBehind::flush_table(const string& table_name) {
+  if ( ! enabled())
+    return;
+  const string prefix {table_name + key_separator};
+  vector<string> keys {};
+  {
+    std::lock_guard<std::mutex> l {lock};
+    for (const auto& p : pending) {
+      if (p.first.compare(0, prefix.size(), prefix) == 0)
+        keys.push_back(p.first);
+    }
+    for (const auto& w : writing) {
+      if (w.first.compare(0, prefix.size(), prefix) == 0 && ! pending.count(w.first))
+        keys.push_back(w.first);
+    }
+  }
+  flush_keys(keys);
+}
+
+/*
+  Flusher thread: send each pending write when its window closes,
+  and everything once stopping.
+ */
+void WriteBehind::run() {
+  std::unique_lock<std::mutex> l {lock};
+  for (;;) {
+    changed.wait(l, [this] { return stopping || ! pending.empty(); });
+    if (pending.empty())
+      return;
+
+    auto now = std::chrono::steady_clock::now();
+    auto next_due = std::chrono::steady_clock::time_point::max();
+    vector<string> due {};
+    for (const auto& p : pending) {
+      if (stopping || p.second->due <= now)
+        due.push_back(p.first);
+      else if (p.second->due < next_due)
+        next_due = p.second->due;
+    }
+    if (due.empty()) {
+      changed.wait_until(l, next_due);
+      continue;
+    }
+
+    vector<pplx::task<void>> sends {};
+    for (const auto& key : due) {
+      write_ptr previous {};
+      write_ptr w {take(key, previous)};
+      sends.push_back(pplx::create_task([this, key, w, previous] { write(key, w, previous); }));
+    }
+    if (stopping) {
+      l.unlock();
+      for (auto& s : sends) {
+        s.wait();
+      }
+      l.lock();
+    }
+  }
+}
+
+void WriteBehind::stop() {
+  {
+    std::lock_guard<std::mutex> l {lock};
+    stopping = true;
+  }
+  changed.notify_all();
+  if (flusher.joinable())
+    flusher.join();
+
+  // Wait for writes sent before stopping
+  vector<pplx::task<status_code>> sent {};
+  {
+    std::lock_guard<std::mutex> l {lock};
+    for (const auto& w : writing) {
+      sent.push_back(w.second->done);
+    }
+  }
+  for (auto& s : sent) {
+    s.wait();
+  }
+}
+
+uint64_t WriteBehind::merge_count() {
+  std::lock_guard<std::mutex> l {lock};
+  return merges;
+}
+
+uint64_t WriteBehind::coalesced_count() {
+  std::lock_guard<std::mutex> l {lock};
+  return coalesced;
+}
@@ -0,0 +1,104 @@
+#ifndef WriteBehind_h
+#define WriteBehind_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+
+#include <pplx/pplxtasks.h>
+
+#include <was/table.h>
+
+/*
+  Write-behind coalescing of property merges.
+
+  A merge given to merge() is not written at once: it waits up to the
+  window for further merges to the same entity, whose properties are
+  folded into it (a later value of a property replaces an earlier
+  one), and the lot goes to storage as one insert-or-merge. The task
+  merge() returns completes with the status of that write.
+
+  Anything that could observe or reorder a pending merge must first
+  call flush_entity() or flush_table(), which write out the pending
+  merges concerned and wait for every write of them in progress.
+  Writes of one entity reach storage in the order of the merges.
+
+  on_written is called once for every write, after storage has
+  completed it, from the thread that wrote it.
+
+  A window of 0 (the default) disables write-behind; merge() must
+  then not be called. stop() writes out everything pending and must
+  be called before the process exits.
+ */
+class WriteBehind {
+public:
+  using written_callback = std::function<void (const std::string& table_name,
+                                               const std::string& partition,
+                                               const std::string& row,
+                                               web::http::status_code status)>;
+
+private:
+  struct pending_write {
+    azure::storage::cloud_table table;
+    std::string table_name;
+    std::string partition;
+    std::string row;
+    azure::storage::table_entity::properties_type properties;
+    std::chrono::steady_clock::time_point due;
+    pplx::task_completion_event<web::http::status_code> written;
+    pplx::task<web::http::status_code> done;
+  };
+  using write_ptr = std::shared_ptr<pending_write>;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::unordered_map<std::string,write_ptr> pending;   // Waiting for the window to close
+  std::unordered_map<std::string,write_ptr> writing;   // Last write sent for each entity
+  std::chrono::milliseconds window;
+  written_callback on_written;
+  std::thread flusher;
+  bool stopping;
+  uint64_t merges;
+  uint64_t coalesced;
+
+  write_ptr take(const std::string& key, write_ptr& previous);
+  void write(const std::string& key, const write_ptr& w, const write_ptr& previous);
+  void flush_keys(const std::vector<std::string>& keys);
+  void run();
+
+public:
+  WriteBehind () : lock {}, changed {}, pending {}, writing {}, window {0}, on_written {},
+                   flusher {}, stopping {false}, merges {0}, coalesced {0} {};
+  ~WriteBehind ();
+  WriteBehind (const WriteBehind&) = delete;
+  WriteBehind& operator=(const WriteBehind&) = delete;
+
+  void start(std::chrono::milliseconds merge_window, written_callback callback);
+  bool enabled() const { return window.count() > 0; };
+
+  pplx::task<web::http::status_code>
+  merge(const azure::storage::cloud_table& table, const std::string& table_name,
+        const std::string& partition, const std::string& row,
+        const azure::storage::table_entity::properties_type& properties);
+
+  // True if a merge of the entity is pending or being written
+  bool has_pending(const std::string& table_name, const std::string& partition, const std::string& row);
+
+  void flush_entity(const std::string& table_name, const std::string& partition, const std::string& row);
+  void flush_table(const std::string& table_name);
+  void stop();
+
+  // Merges accepted, and merges saved by folding them into others
+  uint64_t merge_count();
+  uint64_t coalesced_count();
+};
+#endif
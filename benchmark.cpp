@@ -0,0 +1,229 @@
+/*
+  Load generator for BasicServer
+
+  Keeps a fixed number of point reads (ReadEntityAdmin of one entity)
+  in flight for a few seconds at each of several concurrency levels
+  and reports the completed reads per second and their latency.
+
+  With --scans N, N full-table scans run alongside the reads the
+  whole time, each restarting when it ends. When handlers block a
+  thread for every storage call, throughput levels off once the
+  concurrency reaches the size of the server's thread pool (40 by
+  default in the REST SDK) and slow scans take threads from the
+  reads; with handlers built on task continuations it keeps rising
+  until storage or the network is the limit.
+
+  Usage: benchmark [--seconds S] [--scans N] [--rows R] [concurrency...]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cpprest/http_client.h>
+#include <cpprest/json.h>
+
+#include <pplx/pplxtasks.h>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::make_pair;
+using std::pair;
+using std::string;
+using std::vector;
+
+using web::http::http_request;
+using web::http::http_response;
+using web::http::method;
+using web::http::methods;
+using web::http::status_code;
+using web::http::status_codes;
+
+using web::http::client::http_client;
+
+using web::json::value;
+
+using bench_clock = std::chrono::steady_clock;
+
+const string addr {"http://localhost:34568/"};
+const string table {"BenchTable"};
+const string partition {"Bench"};
+
+const string create_table_op {"CreateTableAdmin"};
+const string read_entity_admin {"ReadEntityAdmin"};
+const string update_entity_admin {"UpdateEntityAdmin"};
+
+/*
+  Counts shared by the request loops of one run
+ */
+struct run_state {
+  bench_clock::time_point deadline;
+  std::atomic<uint64_t> reads {0};
+  std::atomic<uint64_t> failures {0};
+  std::atomic<uint64_t> scans {0};
+  std::mutex lock;
+  vector<double> latencies_ms;
+};
+
+/*
+  Send request to uri, call done with the status (0 if the request
+  failed), and return the task that completes after done.
+ */
+pplx::task<void> send (http_client& client, const method& http_method, const string& path,
+                       const value& body, std::function<void (status_code)> done) {
+  http_request request {http_method};
+  request.set_request_uri(path);
+  if ( ! body.is_null())
+    request.set_body(body);
+  return client.request(request)
+    .then([] (http_response response) {
+        // Drain the body, so a scan counts only once fully received
+        return response.extract_string().then([response] (string) { return response.status_code(); });
+      })
+    .then([done] (pplx::task<status_code> result) {
+        status_code code {0};
+        try {
+          code = result.get();
+        }
+        catch (const std::exception&) {
+        }
+        done(code);
+      });
+}
+
+/*
+  One point-read loop: read a row, and when the reply arrives read
+  another, until the deadline
+ */
+void read_loop (std::shared_ptr<http_client> client, std::shared_ptr<run_state> state,
+                size_t rows, size_t next_row) {
+  if (bench_clock::now() >= state->deadline)
+    return;
+  bench_clock::time_point start {bench_clock::now()};
+  string path {read_entity_admin + "/" + table + "/" + partition + "/" + std::to_string(next_row % rows)};
+  send(*client, methods::GET, path, value {},
+       [client, state, rows, next_row, start] (status_code code) {
+         if (code == status_codes::OK) {
+           ++state->reads;
+           double ms {std::chrono::duration<double, std::milli>(bench_clock::now() - start).count()};
+           std::lock_guard<std::mutex> l {state->lock};
+           state->latencies_ms.push_back(ms);
+         }
+         else {
+           ++state->failures;
+         }
+         read_loop(client, state, rows, next_row + 1);
+       });
+}
+
+/*
+  One scan loop: scan the whole table, again and again, until the
+  deadline
+ */
+void scan_loop (std::shared_ptr<http_client> client, std::shared_ptr<run_state> state) {
+  if (bench_clock::now() >= state->deadline)
+    return;
+  send(*client, methods::GET, read_entity_admin + "/" + table, value {},
+       [client, state] (status_code code) {
+         if (code == status_codes::OK)
+           ++state->scans;
+         scan_loop(client, state);
+       });
+}
+
+/*
+  Create the table and its rows, returning false if the server
+  could not
+ */
+bool set_up (size_t rows) {
+  http_client client {addr};
+  status_code created {0};
+  send(client, methods::POST, create_table_op + "/" + table, value {},
+       [&created] (status_code code) { created = code; }).wait();
+  if (created != status_codes::Created && created != status_codes::Accepted) {
+    cerr << "Cannot create " << table << ": status " << created << endl;
+    return false;
+  }
+
+  vector<pplx::task<void>> puts {};
+  std::atomic<size_t> failed {0};
+  for (size_t r = 0; r < rows; ++r) {
+    value props {value::object(vector<pair<string,value>> {
+          make_pair("Payload", value::string(string(200, 'x'))),
+          make_pair("Index", value::number(static_cast<int32_t>(r)))})};
+    puts.push_back(send(client, methods::PUT,
+                        update_entity_admin + "/" + table + "/" + partition + "/" + std::to_string(r),
+                        props,
+                        [&failed] (status_code code) { if (code != status_codes::OK) ++failed; }));
+  }
+  pplx::when_all(puts.begin(), puts.end()).wait();
+  if (failed > 0) {
+    cerr << failed << " rows could not be written" << endl;
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char const * argv[]) {
+  int seconds {10};
+  size_t scans {0};
+  size_t rows {100};
+  vector<size_t> levels {};
+  for (int i = 1; i < argc; ++i) {
+    const string option {argv[i]};
+    if (option == "--seconds" && i + 1 < argc)
+      seconds = std::atoi(argv[++i]);
+    else if (option == "--scans" && i + 1 < argc)
+      scans = std::strtoul(argv[++i], nullptr, 10);
+    else if (option == "--rows" && i + 1 < argc)
+      rows = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+    else if (option[0] != '-')
+      levels.push_back(std::strtoul(argv[i], nullptr, 10));
+    else {
+      cerr << "Usage: benchmark [--seconds S] [--scans N] [--rows R] [concurrency...]" << endl;
+      return 1;
+    }
+  }
+  if (levels.empty())
+    levels = vector<size_t> {8, 32, 64, 128, 256, 512};
+
+  if ( ! set_up(rows))
+    return 1;
+
+  cout << "concurrency  reads/s   p50 ms   p99 ms  failed  scans" << endl;
+  for (size_t level : levels) {
+    auto state = std::make_shared<run_state>();
+    state->deadline = bench_clock::now() + std::chrono::seconds {seconds};
+    for (size_t s = 0; s < scans; ++s) {
+      scan_loop(std::make_shared<http_client>(addr), state);
+    }
+    // Clients keep separate connections, so the server sees real concurrency
+    for (size_t c = 0; c < level; ++c) {
+      read_loop(std::make_shared<http_client>(addr), state, rows, c);
+    }
+
+    std::this_thread::sleep_until(state->deadline + std::chrono::seconds {1});
+    vector<double> latencies {};
+    {
+      std::lock_guard<std::mutex> l {state->lock};
+      latencies = state->latencies_ms;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies] (double p) {
+      return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    cout << level << "  " << state->reads / static_cast<double>(seconds)
+         << "  " << percentile(0.5) << "  " << percentile(0.99)
+         << "  " << state->failures << "  " << state->scans << endl;
+  }
+}
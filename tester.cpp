@@ -4,8 +4,10 @@
 
 #include <algorithm>
 #include <exception>
+#include <future>
 #include <iostream>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -22,6 +24,7 @@ using std::endl;
 using std::make_pair;
 using std::pair;
 using std::string;
+using std::tuple;
 using std::vector;
 
 using web::http::http_headers;
@@ -42,8 +45,13 @@ const string create_table_op {"CreateTableAdmin"};
 const string delete_table_op {"DeleteTableAdmin"};
 
 const string read_entity_admin {"ReadEntityAdmin"};
+const string read_entities_admin {"ReadEntitiesAdmin"};
+const string export_entities_admin {"ExportEntitiesAdmin"};
 const string update_entity_admin {"UpdateEntityAdmin"};
+const string batch_update_entity_admin {"BatchUpdateEntityAdmin"};
+const string import_entities_admin {"ImportEntitiesAdmin"};
 const string delete_entity_admin {"DeleteEntityAdmin"};
+const string delete_partition_admin {"DeletePartitionAdmin"};
 
 const string read_entity_auth {"ReadEntityAuth"};
 const string update_entity_auth {"UpdateEntityAuth"};
@@ -52,6 +60,8 @@ const string get_read_token_op  {"GetReadToken"};
 const string get_update_token_op {"GetUpdateToken"};
 const string get_update_data_op {"GetUpdateData"};
 
+const string get_cache_stats_admin {"GetCacheStatsAdmin"};
+
 // The two optional operations from Assignment 1
 const string add_property_admin {"AddPropertyAdmin"};
 const string update_property_admin {"UpdatePropertyAdmin"};
@@ -118,6 +128,55 @@ pair<status_code,value> do_request (const method& http_method, const string& uri
   return do_request (http_method, uri_string, value {});
 }
 
+/*
+  Make an HTTP request, returning the status code, any JSON value in the body,
+  and the value of one response header
+
+  header: name of the response header to return; empty if the
+    response does not have it
+  req_headers: extra headers to send with the request
+ */
+tuple<status_code,value,string> do_request_header (const method& http_method, const string& uri_string,
+                                                   const string& header, const value& req_body = value {},
+                                                   const vector<pair<string,string>>& req_headers = {}) {
+  http_request request {http_method};
+  for (const auto& h : req_headers) {
+    request.headers().add(h.first, h.second);
+  }
+  if (req_body != value {}) {
+    http_headers& headers (request.headers());
+    headers.add("Content-Type", "application/json");
+    request.set_body(req_body);
+  }
+
+  status_code code;
+  value resp_body;
+  string header_value;
+  http_client client {uri_string};
+  client.request (request)
+    .then([&code, &header, &header_value](http_response response)
+    {
+      code = response.status_code();
+      const http_headers& headers {response.headers()};
+      auto found (headers.find(header));
+      if (found != headers.end())
+        header_value = found->second;
+      auto content_type (headers.find("Content-Type"));
+      if (content_type == headers.end() ||
+          content_type->second != "application/json")
+        return pplx::task<value> ([] { return value {};});
+      else
+        return response.extract_json();
+    })
+    .then([&resp_body](value v) -> void
+    {
+      resp_body = v;
+      return;
+    })
+    .wait();
+  return std::make_tuple(code, resp_body, header_value);
+}
+
 /*
   Utility to create a table
 
@@ -507,6 +566,346 @@ SUITE(GET) {
       CHECK_EQUAL(status_codes::OK, result.first);
     }
 
+  /*
+    A test of GET of a single entity returning only selected properties
+  */
+  TEST_FIXTURE(GetFixture, GetSingleSelect) {
+    int put_result {put_entity (GetFixture::addr, GetFixture::table, GetFixture::partition, GetFixture::row, "Year", "1967")};
+    cerr << "put result " << put_result << endl;
+    assert (put_result == status_codes::OK);
+
+    pair<status_code,value> result {
+      do_request (methods::GET,
+      string(GetFixture::addr)
+      + read_entity_admin + "/"
+      + GetFixture::table + "/"
+      + GetFixture::partition + "/"
+      + GetFixture::row
+      + "?select=" + GetFixture::property)};
+
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(string("{\"")
+      + GetFixture::property
+      + "\":\""
+      + GetFixture::prop_val
+      + "\"}",
+      result.second.serialize());
+  }
+
+  /*
+    A test that repeated GETs of a single entity are served by the entity cache
+  */
+  TEST_FIXTURE(GetFixture, GetSingleCached) {
+    string entity_uri {string(GetFixture::addr)
+      + read_entity_admin + "/"
+      + GetFixture::table + "/"
+      + GetFixture::partition + "/"
+      + GetFixture::row};
+
+    CHECK_EQUAL(status_codes::OK, do_request (methods::GET, entity_uri).first);
+    pair<status_code,value> before {do_request (methods::GET, string(GetFixture::addr) + get_cache_stats_admin)};
+    CHECK_EQUAL(status_codes::OK, before.first);
+
+    pair<status_code,value> result {do_request (methods::GET, entity_uri)};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(string(GetFixture::prop_val), result.second[GetFixture::property].as_string());
+
+    pair<status_code,value> after {do_request (methods::GET, string(GetFixture::addr) + get_cache_stats_admin)};
+    CHECK_EQUAL(status_codes::OK, after.first);
+    CHECK(after.second["Hits"].as_number().to_int64() > before.second["Hits"].as_number().to_int64());
+
+    // An update must not be hidden by the cached copy
+    int put_result {put_entity (GetFixture::addr, GetFixture::table, GetFixture::partition, GetFixture::row,
+                                GetFixture::property, "THINK")};
+    CHECK_EQUAL(status_codes::OK, put_result);
+    pair<status_code,value> updated {do_request (methods::GET, entity_uri)};
+    CHECK_EQUAL(string("THINK"), updated.second[GetFixture::property].as_string());
+  }
+
+  /*
+    A point read carries the entity's ETag, and a read naming that
+    ETag in If-None-Match gets NotModified until the entity changes
+   */
+  TEST_FIXTURE(GetFixture, GetSingleNotModified) {
+    string entity_uri {string(GetFixture::addr)
+      + read_entity_admin + "/"
+      + GetFixture::table + "/"
+      + GetFixture::partition + "/"
+      + GetFixture::row};
+
+    tuple<status_code,value,string> first {do_request_header (methods::GET, entity_uri, "ETag")};
+    CHECK_EQUAL(status_codes::OK, std::get<0>(first));
+    string etag {std::get<2>(first)};
+    CHECK(etag.size() > 0);
+
+    tuple<status_code,value,string> again {
+      do_request_header (methods::GET, entity_uri, "ETag", value {},
+                         vector<pair<string,string>> {make_pair("If-None-Match", etag)})};
+    CHECK_EQUAL(status_codes::NotModified, std::get<0>(again));
+    CHECK_EQUAL(etag, std::get<2>(again));
+
+    int put_result {put_entity (GetFixture::addr, GetFixture::table, GetFixture::partition, GetFixture::row,
+                                GetFixture::property, "Gimli")};
+    CHECK_EQUAL(status_codes::OK, put_result);
+
+    tuple<status_code,value,string> changed {
+      do_request_header (methods::GET, entity_uri, "ETag", value {},
+                         vector<pair<string,string>> {make_pair("If-None-Match", etag)})};
+    CHECK_EQUAL(status_codes::OK, std::get<0>(changed));
+    CHECK_EQUAL(string("Gimli"), std::get<1>(changed)[GetFixture::property].as_string());
+    CHECK(std::get<2>(changed) != etag);
+  }
+
+  /*
+    A missing entity read twice stays missing, then appears once written
+   */
+  TEST_FIXTURE(GetFixture, GetSingleMissingThenWritten) {
+    string row {"NoSuchRow"};
+    string entity_uri {string(GetFixture::addr)
+      + read_entity_admin + "/"
+      + GetFixture::table + "/"
+      + GetFixture::partition + "/"
+      + row};
+
+    CHECK_EQUAL(status_codes::NotFound, do_request (methods::GET, entity_uri).first);
+    CHECK_EQUAL(status_codes::NotFound, do_request (methods::GET, entity_uri).first);
+
+    int put_result {put_entity (GetFixture::addr, GetFixture::table, GetFixture::partition, row,
+                                GetFixture::property, GetFixture::prop_val)};
+    CHECK_EQUAL(status_codes::OK, put_result);
+    CHECK_EQUAL(status_codes::OK, do_request (methods::GET, entity_uri).first);
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (GetFixture::addr, GetFixture::table, GetFixture::partition, row));
+  }
+
+  /*
+    Repeated updates asking for sync are all visible to the next read,
+    with or without write-behind
+   */
+  TEST_FIXTURE(GetFixture, UpdatesSyncThenRead) {
+    string entity_path {GetFixture::table + string("/") + GetFixture::partition + "/" + GetFixture::row};
+    for (const string val : {"Frodo", "Sam"}) {
+      pair<status_code,value> result {
+        do_request (methods::PUT,
+                    string(GetFixture::addr) + update_entity_admin + "/" + entity_path + "?sync=true",
+                    value::object (vector<pair<string,value>> {make_pair(GetFixture::property, value::string(val))}))};
+      CHECK_EQUAL(status_codes::OK, result.first);
+    }
+    pair<status_code,value> read {
+      do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "/" + entity_path)};
+    CHECK_EQUAL(status_codes::OK, read.first);
+    CHECK_EQUAL(string("Sam"), read.second[GetFixture::property].as_string());
+  }
+
+  /*
+    Once the entity has been read, an update that changes nothing is
+    not written, and says so; one that changes something is written
+   */
+  TEST_FIXTURE(GetFixture, UpdateUnchangedSkipped) {
+    string entity_path {GetFixture::table + string("/") + GetFixture::partition + "/" + GetFixture::row};
+    CHECK_EQUAL(status_codes::OK,
+                do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "/" + entity_path).first);
+
+    tuple<status_code,value,string> same {
+      do_request_header (methods::PUT, string(GetFixture::addr) + update_entity_admin + "/" + entity_path,
+                         "Write-Skipped",
+                         value::object (vector<pair<string,value>> {
+                             make_pair(GetFixture::property, value::string(GetFixture::prop_val))}))};
+    CHECK_EQUAL(status_codes::OK, std::get<0>(same));
+    CHECK_EQUAL(string("true"), std::get<2>(same));
+
+    tuple<status_code,value,string> changed {
+      do_request_header (methods::PUT, string(GetFixture::addr) + update_entity_admin + "/" + entity_path,
+                         "Write-Skipped",
+                         value::object (vector<pair<string,value>> {
+                             make_pair(GetFixture::property, value::string("Boromir"))}))};
+    CHECK_EQUAL(status_codes::OK, std::get<0>(changed));
+    CHECK_EQUAL(string(""), std::get<2>(changed));
+  }
+
+  /*
+    Numbers and booleans are stored with their types, read back as
+    such, and found by a property match
+   */
+  TEST_FIXTURE(GetFixture, TypedProperties) {
+    string entity_path {GetFixture::table + string("/") + GetFixture::partition + "/" + GetFixture::row};
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(GetFixture::addr) + update_entity_admin + "/" + entity_path,
+                  value::object (vector<pair<string,value>> {
+                      make_pair("Rings", value::number(19)),
+                      make_pair("Height", value::number(1.22)),
+                      make_pair("Hobbit", value::boolean(false))}))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+
+    pair<status_code,value> read {
+      do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "/" + entity_path)};
+    CHECK_EQUAL(status_codes::OK, read.first);
+    CHECK_EQUAL(19, read.second["Rings"].as_integer());
+    CHECK_EQUAL(1.22, read.second["Height"].as_double());
+    CHECK(read.second["Hobbit"].is_boolean() && ! read.second["Hobbit"].as_bool());
+    CHECK_EQUAL(string(GetFixture::prop_val), read.second[GetFixture::property].as_string());
+
+    pair<status_code,value> match {
+      do_request (methods::GET,
+                  string(GetFixture::addr) + read_entity_admin + "/" + GetFixture::table,
+                  value::object (vector<pair<string,value>> {
+                      make_pair("Rings", value::string("*")),
+                      make_pair("Hobbit", value::string("*")),
+                      make_pair(GetFixture::property, value::string("*"))}))};
+    CHECK_EQUAL(status_codes::OK, match.first);
+    CHECK_EQUAL(1, match.second.size());
+  }
+
+  /*
+    Escaped strings and nested values survive the body decoder, and
+    a body over the size limit is refused
+   */
+  TEST_FIXTURE(GetFixture, JsonBodyDecoding) {
+    string entity_path {GetFixture::table + string("/") + GetFixture::partition + "/" + GetFixture::row};
+    const string quoted {"caf\xC3\xA9 \"Green Dragon\"\n"};
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(GetFixture::addr) + update_entity_admin + "/" + entity_path,
+                  value::object (vector<pair<string,value>> {
+                      make_pair("Inn", value::string(quoted)),
+                      make_pair("Ponies", value::array(vector<value> {value::number(1), value::number(2)}))}))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+
+    pair<status_code,value> read {
+      do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "/" + entity_path)};
+    CHECK_EQUAL(status_codes::OK, read.first);
+    CHECK_EQUAL(quoted, read.second["Inn"].as_string());
+    CHECK_EQUAL(string("[1,2]"), read.second["Ponies"].as_string());
+
+    pair<status_code,value> oversized {
+      do_request (methods::PUT,
+                  string(GetFixture::addr) + update_entity_admin + "/" + entity_path,
+                  value::object (vector<pair<string,value>> {
+                      make_pair("Inn", value::string(string(1024 * 1024, 'x')))}))};
+    CHECK_EQUAL(status_codes::RequestEntityTooLarge, oversized.first);
+
+    // Array bodies have the same limit
+    value keys {value::array(vector<value> {value::object (vector<pair<string,value>> {
+            make_pair("Partition", value::string(string(1024 * 1024, 'x'))),
+            make_pair("Row", value::string(GetFixture::row))})})};
+    CHECK_EQUAL(status_codes::RequestEntityTooLarge,
+                do_request (methods::PUT,
+                            string(GetFixture::addr) + batch_update_entity_admin + "/" + GetFixture::table,
+                            keys).first);
+    CHECK_EQUAL(status_codes::RequestEntityTooLarge,
+                do_request (methods::GET,
+                            string(GetFixture::addr) + read_entities_admin + "/" + GetFixture::table,
+                            keys).first);
+  }
+
+  /*
+    Scans write escaped strings and typed numbers that parse back to
+    the values stored
+   */
+  TEST_FIXTURE(GetFixture, ScanJsonValues) {
+    string entity_path {GetFixture::table + string("/") + GetFixture::partition + "/" + GetFixture::row};
+    const string quoted {"\"Speak, friend\"\tand\\enter\x01"};
+    const int64_t big {int64_t {1} << 40};
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(GetFixture::addr) + update_entity_admin + "/" + entity_path,
+                  value::object (vector<pair<string,value>> {
+                      make_pair("Door", value::string(quoted)),
+                      make_pair("Age", value::number(big)),
+                      make_pair("Ratio", value::number(0.1)),
+                      make_pair("Open", value::boolean(true))}))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+
+    pair<status_code,value> scan {
+      do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "/" + GetFixture::table
+                  + "/" + GetFixture::partition + "/*")};
+    CHECK_EQUAL(status_codes::OK, scan.first);
+    CHECK(scan.second.is_array());
+    bool seen {false};
+    for (const auto& entity : scan.second.as_array()) {
+      if (entity.at("Row").as_string() != GetFixture::row)
+        continue;
+      seen = true;
+      CHECK_EQUAL(string(GetFixture::partition), entity.at("Partition").as_string());
+      CHECK_EQUAL(quoted, entity.at("Door").as_string());
+      CHECK_EQUAL(big, entity.at("Age").as_number().to_int64());
+      CHECK_EQUAL(0.1, entity.at("Ratio").as_double());
+      CHECK(entity.at("Open").as_bool());
+    }
+    CHECK(seen);
+  }
+
+  /*
+    Unknown operations, and paths with the wrong number of segments
+    for their operation, are refused before any work is done
+   */
+  TEST_FIXTURE(GetFixture, RouteShapes) {
+    CHECK_EQUAL(status_codes::BadRequest,
+                do_request (methods::GET, string(GetFixture::addr) + "NoSuchOperation/" + GetFixture::table).first);
+    CHECK_EQUAL(status_codes::BadRequest,
+                do_request (methods::GET, string(GetFixture::addr) + read_entity_admin).first);
+    CHECK_EQUAL(status_codes::BadRequest,
+                do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "/" + GetFixture::table
+                            + "/" + GetFixture::partition + "/" + GetFixture::row + "/Extra").first);
+    CHECK_EQUAL(status_codes::BadRequest,
+                do_request (methods::DEL, string(GetFixture::addr) + delete_partition_admin + "/" + GetFixture::table).first);
+
+    // Empty segments are ignored, as before
+    CHECK_EQUAL(status_codes::OK,
+                do_request (methods::GET, string(GetFixture::addr) + read_entity_admin + "//" + GetFixture::table
+                            + "/" + GetFixture::partition + "//" + GetFixture::row).first);
+  }
+
+  /*
+    A filter expression selects entities by typed comparisons and key
+    bounds, including terms too many for one storage filter
+   */
+  TEST_FIXTURE(BasicFixture, FilterExpression) {
+    const vector<tuple<string,string,int,double>> songs {
+      std::make_tuple("Canada", "Mitchell,Joni", 1971, 4.9),
+      std::make_tuple("Canada", "Young,Neil", 1972, 4.2),
+      std::make_tuple("UK", "Drake,Nick", 1972, 4.7)};
+    for (const auto& song : songs) {
+      pair<status_code,value> result {
+        do_request (methods::PUT,
+                    string(BasicFixture::addr) + update_entity_admin + "/" + BasicFixture::table + "/"
+                    + std::get<0>(song) + "/" + std::get<1>(song),
+                    value::object (vector<pair<string,value>> {
+                        make_pair("Year", value::number(std::get<2>(song))),
+                        make_pair("Rating", value::number(std::get<3>(song))),
+                        make_pair("Genre", value::string("Folk"))}))};
+      CHECK_EQUAL(status_codes::OK, result.first);
+    }
+
+    auto filtered = [] (const string& filter) {
+      return do_request (methods::GET,
+                         string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table
+                         + "?filter=" + web::uri::encode_data_string(filter));
+    };
+
+    pair<status_code,value> rated {filtered("Rating gt 4.5 and Partition eq 'Canada'")};
+    CHECK_EQUAL(status_codes::OK, rated.first);
+    CHECK_EQUAL(1, rated.second.size());
+
+    pair<status_code,value> either {filtered("Year eq 1971 or (Genre eq 'Folk' and Rating lt 4.5)")};
+    CHECK_EQUAL(status_codes::OK, either.first);
+    CHECK_EQUAL(2, either.second.size());
+
+    pair<status_code,value> many {
+      filtered("Year ge 1970 and Year le 1979 and Rating ge 1 and Rating le 5 and Genre eq 'Folk' and Year ne 1971")};
+    CHECK_EQUAL(status_codes::OK, many.first);
+    CHECK_EQUAL(2, many.second.size());
+
+    CHECK_EQUAL(status_codes::BadRequest, filtered("Year gt").first);
+    CHECK_EQUAL(status_codes::BadRequest, filtered("Genre eq 'Folk").first);
+
+    for (const auto& song : songs) {
+      CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table,
+                                                   std::get<0>(song), std::get<1>(song)));
+    }
+  }
+
   /*
     A test of GET all table entries
 
@@ -805,6 +1204,90 @@ SUITE(GET) {
   }
   */
 
+  // Test request for GET to return a partition in pages using limit and continuation
+  TEST_FIXTURE(MyTest, PartitionInPages) {
+    cout << "\nTest for GET to return a Partition in pages of at most two entities" << endl;
+    string partition {"Khaled,DJ"};
+    string property {"Meme_Level"};
+    vector<string> rows {"All_I_Do_Is_Win", "Hold_You_Down", "How_Many_Times"};
+
+    for (const auto& row : rows) {
+      int put_result {put_entity (MyTest::addr, "TestTable", partition, row, property, "Dank_Meme")};
+      cerr << "put result " << put_result << endl;
+      assert (put_result == status_codes::OK);
+    }
+
+    tuple<status_code,value,string> first {
+      do_request_header (methods::GET,
+                         string(MyTest::addr)
+                         + read_entity_admin + "/"
+                         + "TestTable" + "/"
+                         + partition + "/"
+                         + "*" + "?limit=2",
+                         "Continuation")};
+    CHECK_EQUAL(status_codes::OK, std::get<0>(first));
+    CHECK_EQUAL(2, std::get<1>(first).size());
+    CHECK(std::get<2>(first).size() > 0);
+
+    tuple<status_code,value,string> second {
+      do_request_header (methods::GET,
+                         string(MyTest::addr)
+                         + read_entity_admin + "/"
+                         + "TestTable" + "/"
+                         + partition + "/"
+                         + "*" + "?limit=2&continuation=" + std::get<2>(first),
+                         "Continuation")};
+    CHECK_EQUAL(status_codes::OK, std::get<0>(second));
+    CHECK_EQUAL(1, std::get<1>(second).size());
+    CHECK_EQUAL(string {}, std::get<2>(second));
+
+    tuple<status_code,value,string> bad {
+      do_request_header (methods::GET,
+                         string(MyTest::addr)
+                         + read_entity_admin + "/"
+                         + "TestTable" + "?limit=0",
+                         "Continuation")};
+    CHECK_EQUAL(status_codes::BadRequest, std::get<0>(bad));
+
+    for (const auto& row : rows) {
+      CHECK_EQUAL(status_codes::OK, delete_entity (MyTest::addr, "TestTable", partition, row));
+    }
+  }
+
+  // Identical partition scans issued together must all see the whole partition
+  TEST_FIXTURE(MyTest, ConcurrentPartitionScans) {
+    cout << "\nTest for identical partition scans issued at once" << endl;
+    string partition {"Khaled,DJ"};
+    string property {"Meme_Level"};
+    vector<string> rows {"All_I_Do_Is_Win", "Hold_You_Down", "How_Many_Times"};
+
+    for (const auto& row : rows) {
+      int put_result {put_entity (MyTest::addr, "TestTable", partition, row, property, "Dank_Meme")};
+      cerr << "put result " << put_result << endl;
+      assert (put_result == status_codes::OK);
+    }
+
+    string scan_uri {string(MyTest::addr)
+      + read_entity_admin + "/"
+      + "TestTable" + "/"
+      + partition + "/"
+      + "*"};
+    vector<std::future<pair<status_code,value>>> scans {};
+    for (int i = 0; i < 8; ++i) {
+      scans.push_back(std::async(std::launch::async,
+                                 [&scan_uri] { return do_request (methods::GET, scan_uri); }));
+    }
+    for (auto& scan : scans) {
+      pair<status_code,value> result {scan.get()};
+      CHECK_EQUAL(status_codes::OK, result.first);
+      CHECK_EQUAL(3, result.second.size());
+    }
+
+    for (const auto& row : rows) {
+      CHECK_EQUAL(status_codes::OK, delete_entity (MyTest::addr, "TestTable", partition, row));
+    }
+  }
+
   /*
     Test for assignment1 GET operation 1
     End Here
@@ -1029,11 +1512,278 @@ SUITE(GET) {
     CHECK_EQUAL(status_codes::OK, delete_entity (MyTest::addr, "TestTable", partition, row));
     CHECK_EQUAL(status_codes::OK, delete_entity (MyTest::addr, "TestTable", partition2, row2));
   }
+
+  /*
+    A property match returns the matching entities whole, or only the
+    properties given by ?select=
+   */
+  TEST_FIXTURE(MyTest, PropertyMatchReturnsWholeEntities) {
+    cout << "\nTest for GET to return the entities that have the requested Properties" << endl;
+    string partition {"Khaled,DJ"};
+    string row {"All_I_Do_Is_Win"};
+    string property {"Meme_Level"};
+    string property2 {"Awards"};
+
+    string prop_val_does_not_matter {"*"};
+
+    int putOne {put_entity (MyTest::addr, "TestTable", partition, row,
+                            vector<pair<string,value>> {make_pair(property, value::string(prop_val_does_not_matter)),
+                                                        make_pair(property2, value::string(prop_val_does_not_matter))})};
+    cerr << "put result " << putOne << endl;
+    assert (putOne == status_codes::OK);
+
+    value match {value::object (vector<pair<string,value>>
+                                {make_pair(property, value::string(prop_val_does_not_matter))})};
+    pair<status_code,value> result {
+      do_request (methods::GET,
+                  string(GetFixture::addr) + read_entity_admin + "/" + string(GetFixture::table),
+                  match)};
+
+    cout << "this was returned: " << result.second << endl;
+    CHECK_EQUAL(status_codes::OK, result.first);
+    value whole {
+      value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string(partition)),
+          make_pair(string("Row"), value::string(row)),
+          make_pair(property, value::string(prop_val_does_not_matter)),
+          make_pair(property2, value::string(prop_val_does_not_matter))
+      })
+    };
+    compare_json_arrays(vector<object> {whole.as_object()}, result.second);
+
+    result = do_request (methods::GET,
+                         string(GetFixture::addr) + read_entity_admin + "/" + string(GetFixture::table)
+                         + "?select=" + property,
+                         match);
+    CHECK_EQUAL(status_codes::OK, result.first);
+    value selected {
+      value::object(vector<pair<string,value>> {
+          make_pair(string("Partition"), value::string(partition)),
+          make_pair(string("Row"), value::string(row)),
+          make_pair(property, value::string(prop_val_does_not_matter))
+      })
+    };
+    compare_json_arrays(vector<object> {selected.as_object()}, result.second);
+    CHECK_EQUAL(status_codes::OK, delete_entity (MyTest::addr, "TestTable", partition, row));
+  }
   /*
     End of tests for GET
   */
 }
 
+SUITE(BATCH) {
+  /*
+    A bulk update writes entities of several partitions and reports
+    the status of each element, in order
+   */
+  TEST_FIXTURE(BasicFixture, BatchUpdate) {
+    auto song = [] (const string& partition, const string& row, const string& title) {
+      return value::object (vector<pair<string,value>> {make_pair("Partition", value::string(partition)),
+                                                        make_pair("Row", value::string(row)),
+                                                        make_pair("Song", value::string(title))});
+    };
+    value body {value::array(vector<value> {
+        song("Canada", "Mitchell,Joni", "Big Yellow Taxi"),
+        song("Canada", "Cohen,Leonard", "Suzanne"),
+        song("UK", "Bush,Kate", "Wuthering Heights"),
+        value::object (vector<pair<string,value>> {make_pair("Song", value::string("No keys"))})
+      })};
+
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(BasicFixture::addr) + batch_update_entity_admin + "/" + BasicFixture::table,
+                  body)};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(4, result.second.size());
+    for (size_t i = 0; i < 3; ++i) {
+      CHECK_EQUAL(status_codes::OK, result.second[i]["Status"].as_integer());
+    }
+    CHECK_EQUAL(string("UK"), result.second[2]["Partition"].as_string());
+    CHECK_EQUAL(status_codes::BadRequest, result.second[3]["Status"].as_integer());
+
+    pair<status_code,value> read {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table
+                  + "/Canada/Cohen,Leonard")};
+    CHECK_EQUAL(status_codes::OK, read.first);
+    CHECK_EQUAL(string("Suzanne"), read.second["Song"].as_string());
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Mitchell,Joni"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Cohen,Leonard"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "UK", "Bush,Kate"));
+  }
+
+  /*
+    A multi-get returns each key's status, and the entity of each key
+    that exists, keyed by partition then row
+   */
+  TEST_FIXTURE(BasicFixture, ReadMany) {
+    CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, "USA", "Simone,Nina", "Song", "Sinnerman"));
+    CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Young,Neil", "Song", "Harvest Moon"));
+
+    auto key = [] (const string& partition, const string& row) {
+      return value::object (vector<pair<string,value>> {make_pair("Partition", value::string(partition)),
+                                                        make_pair("Row", value::string(row))});
+    };
+    pair<status_code,value> result {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + read_entities_admin + "/" + BasicFixture::table,
+                  value::array(vector<value> {
+                      key(BasicFixture::partition, BasicFixture::row),
+                      key("USA", "Simone,Nina"),
+                      key("Canada", "Young,Neil"),
+                      key("Canada", "Nobody,Here")
+                    }))};
+    CHECK_EQUAL(status_codes::OK, result.first);
+    CHECK_EQUAL(status_codes::OK, result.second["USA"][BasicFixture::row]["Status"].as_integer());
+    CHECK_EQUAL(string(BasicFixture::prop_val),
+                result.second["USA"][BasicFixture::row]["Entity"][BasicFixture::property].as_string());
+    CHECK_EQUAL(string("Sinnerman"), result.second["USA"]["Simone,Nina"]["Entity"]["Song"].as_string());
+    CHECK_EQUAL(string("Harvest Moon"), result.second["Canada"]["Young,Neil"]["Entity"]["Song"].as_string());
+    CHECK_EQUAL(status_codes::NotFound, result.second["Canada"]["Nobody,Here"]["Status"].as_integer());
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "USA", "Simone,Nina"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Young,Neil"));
+  }
+
+  /*
+    An import writes each well-formed line and rejects the others
+   */
+  TEST_FIXTURE(BasicFixture, ImportLines) {
+    string lines {
+      "{\"Partition\":\"Canada\",\"Row\":\"Lightfoot,Gordon\",\"Song\":\"Sundown\"}\n"
+      "\n"
+      "not json\n"
+      "{\"Partition\":\"UK\",\"Row\":\"Bowie,David\",\"Song\":\"Heroes\"}\r\n"
+      "{\"Song\":\"No keys\"}"};
+    http_request request {methods::PUT};
+    request.set_body(lines, "application/x-ndjson");
+    http_client client {string(BasicFixture::addr) + import_entities_admin + "/" + BasicFixture::table};
+    status_code code;
+    value summary;
+    client.request (request)
+      .then([&code](http_response response)
+      {
+        code = response.status_code();
+        return response.extract_json();
+      })
+      .then([&summary](value v) -> void
+      {
+        summary = v;
+      })
+      .wait();
+    CHECK_EQUAL(status_codes::OK, code);
+    CHECK_EQUAL(4, summary["Lines"].as_integer());
+    CHECK_EQUAL(2, summary["Imported"].as_integer());
+    CHECK_EQUAL(2, summary["Rejected"].as_integer());
+    CHECK_EQUAL(2, summary["Errors"].size());
+
+    pair<status_code,value> read {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table
+                  + "/UK/Bowie,David")};
+    CHECK_EQUAL(status_codes::OK, read.first);
+    CHECK_EQUAL(string("Heroes"), read.second["Song"].as_string());
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Lightfoot,Gordon"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "UK", "Bowie,David"));
+  }
+
+  /*
+    An export bounded by partition returns one line per entity in the
+    bounds, whatever the number of ranges scanned
+   */
+  TEST_FIXTURE(BasicFixture, ExportRange) {
+    CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Cohen,Leonard", "Song", "Suzanne"));
+    CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, "UK", "Bush,Kate", "Song", "Wuthering Heights"));
+
+    for (const string parallel : {"1", "5"}) {
+      http_client client {string(BasicFixture::addr) + export_entities_admin + "/" + BasicFixture::table
+                          + "?partition_from=D&partition_to=V&parallel=" + parallel};
+      status_code code;
+      string lines;
+      client.request (methods::GET)
+        .then([&code](http_response response)
+        {
+          code = response.status_code();
+          return response.extract_string();
+        })
+        .then([&lines](string body) -> void
+        {
+          lines = body;
+        })
+        .wait();
+      CHECK_EQUAL(status_codes::OK, code);
+      CHECK_EQUAL(2, std::count(lines.begin(), lines.end(), '\n'));
+      CHECK(lines.find("Bush,Kate") != string::npos);
+      CHECK(lines.find(BasicFixture::row) != string::npos);
+      CHECK(lines.find("Canada") == string::npos);
+    }
+
+    pair<status_code,value> bad {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + export_entities_admin + "/" + BasicFixture::table
+                  + "?partition_from=V&partition_to=D")};
+    CHECK_EQUAL(status_codes::BadRequest, bad.first);
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Cohen,Leonard"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "UK", "Bush,Kate"));
+  }
+
+  // The body must be an array
+  TEST_FIXTURE(BasicFixture, BatchUpdateNotArray) {
+    pair<status_code,value> result {
+      do_request (methods::PUT,
+                  string(BasicFixture::addr) + batch_update_entity_admin + "/" + BasicFixture::table,
+                  value::object (vector<pair<string,value>> {make_pair("Partition", value::string("Canada"))}))};
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
+  }
+
+  /*
+    Deleting a partition removes all its entities, reporting progress
+    as lines of JSON, and leaves other partitions alone
+   */
+  TEST_FIXTURE(BasicFixture, DeletePartition) {
+    const string partition {"Iceland"};
+    for (const string row : {"Bjork", "Sigur Ros", "Of Monsters and Men"}) {
+      CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, partition, row, "Song", "Any"));
+    }
+
+    http_client client {string(BasicFixture::addr) + delete_partition_admin + "/" + BasicFixture::table + "/" + partition};
+    status_code code;
+    string lines;
+    client.request (methods::DEL)
+      .then([&code](http_response response)
+      {
+        code = response.status_code();
+        return response.extract_string();
+      })
+      .then([&lines](string body) -> void
+      {
+        lines = body;
+      })
+      .wait();
+    CHECK_EQUAL(status_codes::OK, code);
+    CHECK(lines.size() > 0 && lines.back() == '\n');
+    size_t last_start {lines.rfind('\n', lines.size() - 2)};
+    value last {value::parse(lines.substr(last_start == string::npos ? 0 : last_start + 1))};
+    CHECK(last["Done"].as_bool());
+    CHECK_EQUAL(3, last["Deleted"].as_integer());
+    CHECK_EQUAL(0, last["Failed"].as_integer());
+
+    pair<status_code,value> gone {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table
+                  + "/" + partition + "/Bjork")};
+    CHECK_EQUAL(status_codes::NotFound, gone.first);
+    pair<status_code,value> kept {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table
+                  + "/" + BasicFixture::partition + "/" + BasicFixture::row)};
+    CHECK_EQUAL(status_codes::OK, kept.first);
+  }
+}
+
 class AuthFixture {
 public:
   static constexpr const char* addr {"http://localhost:34568/"};
@@ -1814,8 +2564,12 @@ SUITE(PUT_AUTH) {
   }
 }
 
-SUITE(NotImplemented) {
-  TEST_FIXTURE(AuthFixture, ReturnNotImplemented) {
+SUITE(PropertyAdmin) {
+  /*
+    AddPropertyAdmin and UpdatePropertyAdmin act on a whole table, so
+    a path naming a token and an entity is malformed
+   */
+  TEST_FIXTURE(AuthFixture, RejectEntityPath) {
 
     /*
     Assume AuthTable already exists from curl since tables are rarely deleted
@@ -1864,7 +2618,7 @@ SUITE(NotImplemented) {
                                    {make_pair(added_prop.first,
                                               value::string(added_prop.second))})
                   )};
-    CHECK_EQUAL(status_codes::NotImplemented, result.first);
+    CHECK_EQUAL(status_codes::BadRequest, result.first);
     
     pair<status_code,value> result2 {
       do_request (methods::PUT,
@@ -1878,7 +2632,46 @@ SUITE(NotImplemented) {
                                    {make_pair(added_prop.first,
                                               value::string(added_prop.second))})
                   )};
-    CHECK_EQUAL(status_codes::NotImplemented, result2.first);
+    CHECK_EQUAL(status_codes::BadRequest, result2.first);
+  }
+
+  /*
+    AddPropertyAdmin sets a property on every entity; UpdatePropertyAdmin
+    then changes it only where it exists
+   */
+  TEST_FIXTURE(BasicFixture, AddThenUpdate) {
+    CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Cohen,Leonard", "Song", "Suzanne"));
+
+    pair<status_code,value> added {
+      do_request (methods::PUT,
+                  string(BasicFixture::addr) + add_property_admin + "/" + BasicFixture::table,
+                  value::object (vector<pair<string,value>> {make_pair("Decade", value::string("1960s"))}))};
+    CHECK_EQUAL(status_codes::OK, added.first);
+    CHECK(added.second["Touched"].as_integer() >= 2);
+    CHECK_EQUAL(0, added.second["Failed"].as_integer());
+
+    pair<status_code,value> read {
+      do_request (methods::GET,
+                  string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table + "/Canada/Cohen,Leonard")};
+    CHECK_EQUAL(string("1960s"), read.second["Decade"].as_string());
+    CHECK_EQUAL(string("Suzanne"), read.second["Song"].as_string());
+
+    CHECK_EQUAL(status_codes::OK, put_entity (BasicFixture::addr, BasicFixture::table, "UK", "Bush,Kate", "Song", "Wuthering Heights"));
+    pair<status_code,value> updated {
+      do_request (methods::PUT,
+                  string(BasicFixture::addr) + update_property_admin + "/" + BasicFixture::table,
+                  value::object (vector<pair<string,value>> {make_pair("Decade", value::string("1970s"))}))};
+    CHECK_EQUAL(status_codes::OK, updated.first);
+
+    read = do_request (methods::GET,
+                       string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table + "/Canada/Cohen,Leonard");
+    CHECK_EQUAL(string("1970s"), read.second["Decade"].as_string());
+    read = do_request (methods::GET,
+                       string(BasicFixture::addr) + read_entity_admin + "/" + BasicFixture::table + "/UK/Bush,Kate");
+    CHECK( ! read.second.has_field("Decade"));
+
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "Canada", "Cohen,Leonard"));
+    CHECK_EQUAL(status_codes::OK, delete_entity (BasicFixture::addr, BasicFixture::table, "UK", "Bush,Kate"));
   }
 }
 
@@ -2091,6 +2884,21 @@ SUITE(SignOn) {
 
     CHECK_EQUAL(status_codes::NotFound,password_res.first);
   }
+
+  TEST_FIXTURE(SetUpFixture, MalformedBody) {
+    // A body that is cut off is refused rather than read as no password
+    http_request request {methods::POST};
+    request.set_body(string {"{\"Password\":\"pass"}, "application/json");
+    http_client client {string {"http://localhost:34572/"} + sign_on_op + "/" + "DJKhaled"};
+    status_code code;
+    client.request (request)
+      .then([&code](http_response response)
+      {
+        code = response.status_code();
+      })
+      .wait();
+    CHECK_EQUAL(status_codes::BadRequest, code);
+  }
 }
 
 SUITE(SignOff) {